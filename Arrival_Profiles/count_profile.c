@@ -0,0 +1,94 @@
+#include "..\Headers\Simulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Prepares count files for the controllers, see Headers/Arrival_Profile.h.
+   A count file can be compiled into a profile that is mapped instead of
+   parsed when a controller loads it, and the curves fitted to the recorded
+   day can be written as a count file to start a dataset from or to compare
+   a dataset with */
+
+int write_curve_counts(const char *path, int days);
+double get_street_spawn_rate(int street_index, double current_time);
+
+
+int main() {
+  int mode, days, day;
+  char countFile[MAX_PROFILE_PATH], profileFile[MAX_PROFILE_PATH];
+  arrival_profile profile;
+
+  printf("Compile a count file(0) or write the fitted curves as a count file(1): ");
+  if(scanf("%d", &mode) != 1) return 1;
+
+  printf("\nCount file: ");
+  if(scanf("%199s", countFile) != 1) return 1;
+
+  if(mode == 1){
+    printf("\nDays to write (the weekends are the same as the weekdays): ");
+    if(scanf("%d", &days) != 1 || days < 1 || days > MAX_PROFILE_DAYS) days = 1;
+
+    if(!write_curve_counts(countFile, days)){
+      printf("Unable to write %s\n", countFile);
+      return 1;
+    }
+    printf("Wrote %d days to %s\n", days, countFile);
+    return 0;
+  }
+
+  printf("\nCompiled profile file: ");
+  if(scanf("%199s", profileFile) != 1) return 1;
+
+  if(!compile_count_file(&profile, countFile)){
+    printf("Unable to read the counts %s\n", countFile);
+    return 1;
+  }
+  if(!save_arrival_profile(&profile, profileFile)){
+    printf("Unable to write %s\n", profileFile);
+    close_arrival_profile(&profile);
+    return 1;
+  }
+
+  printf("Compiled %d days to %s\n", profile.day_count, profileFile);
+  for(day = 0; day < profile.day_count; day++)
+    printf("Day %d: %s\n", day, profile.day_types[day] == weekend ? "weekend" : "weekday");
+
+  close_arrival_profile(&profile);
+  return 0;
+}
+
+/* Writes the cars of every quarter of the fitted curves, which hold for a
+   whole hour and spawn every car in the straight lane. Returns true (1) on
+   success */
+int write_curve_counts(const char *path, int days){
+  FILE *fp = fopen(path, "w");
+  int day, i, quarter, ok;
+  double cars_per_hour;
+
+  if(fp == NULL) return 0;
+
+  fprintf(fp, "# day, day type, street, lane, quarter, cars\n");
+  for(day = 0; day < days; day++)
+    for(i = 0; i < AMOUNT_OF_STREETS; i++)
+      for(quarter = 0; quarter < QUARTERS_PER_DAY; quarter++){
+        /* Where a curve dips below zero no car spawns */
+        cars_per_hour = get_street_spawn_rate(i, quarter / 4 * SEC_PER_HOUR);
+        fprintf(fp, "%d, %s, %s, straight, %d, %0.4f\n", day, day % 7 < 5 ? "weekday" : "weekend", get_street_name(i), quarter,
+                cars_per_hour > 0 ? cars_per_hour / 4 : 0);
+      }
+
+  ok = !ferror(fp);
+  if(fclose(fp) != 0) ok = 0;
+  return ok;
+}
+
+/* Cars per hour of a street on the fitted curves, as get_probability() takes them */
+double get_street_spawn_rate(int street_index, double current_time){
+  switch(street_index){
+    case 0: return get_kjellerup_spawn_rate(current_time);
+    case 1: return get_fyensgade_spawn_rate(current_time);
+    case 2: return get_soenderbro_spawn_rate(current_time);
+    case 3: return get_jylland_spawn_rate(current_time);
+  }
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include "..\Headers\Simulation.h"
+#include "..\Headers\Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Measures the car updates of a tick on long queues. Every lane is filled with
+   the same cars at random speeds, then the cars are updated tick after tick
+   once with update_lane() on every lane, which takes the cars one at a time,
+   and once with update_lanes(), which updates two lanes side by side. Both
+   must leave every car in exactly the same place */
+
+#define KERNEL_RANDOM_STREAM 99 /* Stream key of the initial speeds */
+
+void fill_lanes(simulation_state *sim_state, int cars_per_lane);
+double run_car_updates(simulation_state *sim_state, int ticks, int kernel, long *car_updates);
+int compare_lanes(const simulation_state *a, const simulation_state *b);
+double time_accelerations(const double *speed, double *acceleration, int count, int method);
+
+int main() {
+  simulation_state scalar, pair;
+  int cars_per_lane, ticks, repeats, i, method, count;
+  long scalar_updates = 0, pair_updates = 0;
+  double scalar_time = 0, pair_time = 0, elapsed, *speed, *acceleration, best[3];
+  const char *methods[3] = {"get_model_free_acceleration()", "get_acceleration()", "get_free_accelerations()"};
+  random_stream random;
+
+  /* The kernels are timed without tick(), which fills the table otherwise */
+  init_car_model();
+
+  printf("Cars per lane (max %d): ", MAX_AMOUNT_OF_CARS);
+  if(scanf("%d", &cars_per_lane) != 1 || cars_per_lane < 1 || cars_per_lane > MAX_AMOUNT_OF_CARS) cars_per_lane = 1000;
+
+  printf("\nTicks per run: ");
+  if(scanf("%d", &ticks) != 1 || ticks < 1) ticks = 100;
+
+  printf("\nAmount of runs: ");
+  if(scanf("%d", &repeats) != 1 || repeats < 1) repeats = 1;
+  printf("Simulating...\n");
+
+  for(i = 0; i < repeats; i++){
+    fill_lanes(&scalar, cars_per_lane);
+    fill_lanes(&pair, cars_per_lane);
+
+    /* The fastest run is kept, the others are only there to warm up */
+    elapsed = run_car_updates(&scalar, ticks, 0, &scalar_updates);
+    if(i == 0 || elapsed < scalar_time) scalar_time = elapsed;
+    elapsed = run_car_updates(&pair, ticks, 1, &pair_updates);
+    if(i == 0 || elapsed < pair_time) pair_time = elapsed;
+
+    if(scalar_updates != pair_updates || !compare_lanes(&scalar, &pair)){
+      printf("\nThe lane pair kernel differs from the scalar update in run %d\n", i + 1);
+      return 1;
+    }
+
+    discard_simulation(&scalar);
+    discard_simulation(&pair);
+  }
+
+  printf("\n%d cars per lane, %d ticks, %ld car updates per run\n", cars_per_lane, ticks, scalar_updates);
+  printf("Scalar updates : %0.1f million car updates per second\n", scalar_updates / scalar_time / 1e6);
+  printf("Lane pairs     : %0.1f million car updates per second\n", pair_updates / pair_time / 1e6);
+  printf("Speedup: %0.2fx, every car is bit identical\n", scalar_time / pair_time);
+
+  /* The acceleration pass on its own, over every speed a car can have */
+  count = cars_per_lane * AMOUNT_OF_STREETS * LANES_PER_STREET;
+  speed = (double *) malloc(count * sizeof(double));
+  acceleration = (double *) malloc(count * sizeof(double));
+  seed_random_stream(&random, RAND_SEED, 0, KERNEL_RANDOM_STREAM);
+  for(i = 0; i < count; i++)
+    speed[i] = random_uniform(&random) * MAX_SPEED;
+
+  printf("\nFree road accelerations of %d cars, %s:\n", count, CAR_MODEL_NAME);
+  for(method = 0; method < 3; method++){
+    for(i = 0; i < repeats; i++){
+      elapsed = time_accelerations(speed, acceleration, count, method);
+      if(i == 0 || elapsed < best[method]) best[method] = elapsed;
+    }
+    printf("  %-30s: %0.1f million per second\n", methods[method], 100.0 * count / best[method] / 1e6);
+  }
+
+  free(speed);
+  free(acceleration);
+  return 0;
+}
+
+/* Makes a simulation with cars_per_lane cars in every lane, the cars are
+   queued one behind the other at random speeds */
+void fill_lanes(simulation_state *sim_state, int cars_per_lane){
+  random_stream random;
+  int i, j, k;
+
+  *sim_state = make_simulation_state();
+  sim_state->render_simulation = 0;
+  seed_random_stream(&random, RAND_SEED, 0, KERNEL_RANDOM_STREAM);
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      lane *l = &(sim_state->streets[i].lanes[j]);
+
+      for(k = 0; k < cars_per_lane; k++)
+        add_car(sim_state, l, &(sim_state->spawn_random[i]));
+      for(k = 0; k < l->amount_of_cars; k++)
+        l->speed[k] = random_uniform(&random) * MAX_SPEED;
+    }
+  }
+}
+
+/* Updates the cars of every lane for the given amount of ticks without
+   spawning or changing the signal, with update_lane() on every lane (0) or
+   with update_lanes() (1). Returns the wall time */
+double run_car_updates(simulation_state *sim_state, int ticks, int kernel, long *car_updates){
+  int t;
+  double start = wall_time();
+
+  *car_updates = 0;
+  for(t = 0; t < ticks; t++){
+    *car_updates += sim_state->total_cars;
+
+    if(kernel)
+      update_lanes(sim_state);
+    else
+      update_every_lane(sim_state);
+    sim_state->time_since_change += 1.0 / TICK_RATE;
+  }
+
+  return wall_time() - start;
+}
+
+/* Returns true (1) if every car of both simulations is bit for bit the same */
+int compare_lanes(const simulation_state *a, const simulation_state *b){
+  int i, j, k, index;
+
+  if(a->total_cars != b->total_cars || a->stats[0].total_wait_time != b->stats[0].total_wait_time)
+    return 0;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      const lane *la = &(a->streets[i].lanes[j]), *lb = &(b->streets[i].lanes[j]);
+
+      if(la->amount_of_cars != lb->amount_of_cars || la->index_front_car != lb->index_front_car)
+        return 0;
+
+      for(k = 0; k < la->amount_of_cars; k++){
+        index = (la->index_front_car + k) % la->capacity;
+        if(memcmp(&(la->position[index]), &(lb->position[index]), sizeof(double)) != 0 ||
+           memcmp(&(la->speed[index]), &(lb->speed[index]), sizeof(double)) != 0 ||
+           memcmp(&(la->wait_time[index]), &(lb->wait_time[index]), sizeof(double)) != 0)
+          return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/* Computes the accelerations of count speeds 100 times with the formula of
+   the model (0), the table (1) or the lane kernel (2). Returns the wall time */
+double time_accelerations(const double *speed, double *acceleration, int count, int method){
+  double start = wall_time();
+  int r, k;
+
+  for(r = 0; r < 100; r++){
+    if(method == 2){
+      get_free_accelerations(speed, acceleration, count);
+    }else if(method == 1){
+      for(k = 0; k < count; k++)
+        acceleration[k] = get_acceleration(speed[k]);
+    }else{
+      for(k = 0; k < count; k++)
+        acceleration[k] = get_model_free_acceleration(speed[k]);
+    }
+  }
+
+  return wall_time() - start;
+}
@@ -0,0 +1,191 @@
+#include "..\Headers\Simulation.h"
+#include "..\Headers\Simulation_Evaluation.h"
+#include "..\Headers\Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Measures how fast the simulator runs headless. The intersection is driven by
+   a fixed cycle like the time based controller, so every run simulates exactly
+   the same traffic and the wait times can be compared between versions.
+   The demand can be multiplied to stress the simulator with saturated
+   queues. The run can be repeated with per car telemetry, to measure what
+   the telemetry costs the simulation, and with the meso engine, to compare
+   its wait times and speed with the car model */
+
+#define BENCHMARK_GREEN_TIME 20.0
+#define BENCHMARK_TELEMETRY_FILE "benchmark telemetry.bin"
+#define SETUP_RUNS 10000 /* Simulations made or reset to time the setup of a run */
+
+typedef struct benchmark_result benchmark_result;
+
+struct benchmark_result{
+  double wall_time, total_wait_time, avg_wait;
+  int cars_passed, cars_turned_away, car_slots;
+  long telemetry_events;
+};
+
+void run_benchmark(benchmark_result *result, int days, int repeats, int demand, int telemetry, int engine);
+void run_fixed_cycle(simulation_state *sim_state, int days);
+void print_result(const char *name, const benchmark_result *result, int days);
+void print_setup_cost(double run_time);
+
+int main() {
+  int days, repeats, demand, measureTelemetry, compareMeso;
+  benchmark_result micro, telemetry, meso;
+
+  printf("Days to simulate per run (1 - %d): ", MAX_SIM_DAYS - 1);
+  if(scanf("%d", &days) != 1 || days < 1 || days >= MAX_SIM_DAYS) days = 1;
+
+  printf("\nAmount of runs: ");
+  if(scanf("%d", &repeats) != 1 || repeats < 1) repeats = 1;
+
+  printf("\nDemand factor (1 = measured traffic): ");
+  if(scanf("%d", &demand) != 1 || demand < 1) demand = 1;
+
+  printf("\nMeasure the telemetry overhead NO(0) or YES(1): ");
+  if(scanf("%d", &measureTelemetry) != 1) measureTelemetry = 0;
+
+  printf("\nCompare with the meso engine NO(0) or YES(1): ");
+  if(scanf("%d", &compareMeso) != 1) compareMeso = 0;
+  printf("Simulating...\n");
+
+  run_benchmark(&micro, days, repeats, demand, 0, micro_engine);
+
+  printf("\nSimulated days: %d, demand x%d, %s\n", days, demand, CAR_MODEL_NAME);
+  print_result("Car model", &micro, days);
+
+  print_setup_cost(micro.wall_time / days);
+
+  if(measureTelemetry){
+    run_benchmark(&telemetry, days, repeats, demand, 1, micro_engine);
+    print_result("Car model with telemetry", &telemetry, days);
+    printf("  Events written to %s: %ld\n", BENCHMARK_TELEMETRY_FILE, telemetry.telemetry_events);
+    printf("  Overhead against the car model: %0.2f%%\n", 100.0 * (telemetry.wall_time - micro.wall_time) / micro.wall_time);
+  }
+
+  if(compareMeso){
+    run_benchmark(&meso, days, repeats, demand, 0, meso_engine);
+    print_result("Meso engine", &meso, days);
+
+    printf("\nMeso against the car model:\n");
+    printf("  Average wait time of all days: %f against %f (%+0.2f%%)\n", meso.total_wait_time / meso.cars_passed,
+           micro.total_wait_time / micro.cars_passed, 100.0 * (meso.total_wait_time / meso.cars_passed - micro.total_wait_time / micro.cars_passed) / (micro.total_wait_time / micro.cars_passed));
+    printf("  Cars passed: %d against %d\n", meso.cars_passed, micro.cars_passed);
+    printf("  Speedup: %0.1fx\n", micro.wall_time / meso.wall_time);
+  }
+
+  return 0;
+}
+
+/* Simulates the given amount of days. The fastest run is kept, the others are
+   only there to warm up */
+void run_benchmark(benchmark_result *result, int days, int repeats, int demand, int telemetry, int engine){
+  simulation_state sim_state;
+  telemetry_stream stream;
+  double start, elapsed;
+  int i, day, street, lane_type;
+
+  for(i = 0; i < repeats; i++){
+    sim_state = make_simulation_state();
+    sim_state.render_simulation = 0;
+    sim_state.engine = engine;
+    sim_state.demand_factor = demand;
+
+    /* The writer is emptied and joined within the time */
+    start = wall_time();
+    if(telemetry && !start_telemetry(&sim_state, &stream, BENCHMARK_TELEMETRY_FILE))
+      printf("Unable to open %s\n", BENCHMARK_TELEMETRY_FILE);
+    run_fixed_cycle(&sim_state, days);
+    result->telemetry_events = stop_telemetry(&sim_state);
+    elapsed = wall_time() - start;
+
+    if(i == 0 || elapsed < result->wall_time)
+      result->wall_time = elapsed;
+
+    result->total_wait_time = 0;
+    result->cars_passed = 0;
+    result->cars_turned_away = 0;
+    for(day = 0; day < days; day++){
+      result->total_wait_time += sim_state.stats[day].total_wait_time;
+      result->cars_passed += sim_state.stats[day].total_cars_passed;
+      result->cars_turned_away += sim_state.stats[day].cars_turned_away;
+    }
+
+    /* Lanes never shrink, so this is the storage of the longest queues */
+    result->car_slots = 0;
+    for(street = 0; street < AMOUNT_OF_STREETS; street++)
+      for(lane_type = 0; lane_type < LANES_PER_STREET; lane_type++)
+        result->car_slots += sim_state.streets[street].lanes[lane_type].capacity;
+
+    result->avg_wait = get_avg_wait_time(&sim_state, 0);
+    discard_simulation(&sim_state);
+  }
+}
+
+/* Alternates the signal with the same green time in both directions */
+void run_fixed_cycle(simulation_state *sim_state, int days){
+  while(sim_state->days_simulated < days){
+    update_simulation(sim_state, BENCHMARK_GREEN_TIME + MAX_YELLOW_TIME * 2, 1);
+  }
+}
+
+/* Times making a simulation against resetting a used one, and forking
+   into new storage against forking into the storage of an earlier fork,
+   with the wall time of a simulated day to compare with */
+void print_setup_cost(double run_time){
+  simulation_state sim_state, fork;
+  double start, make_time, reset_time, fork_time, refork_time;
+  int i;
+
+  start = wall_time();
+  for(i = 0; i < SETUP_RUNS; i++){
+    sim_state = make_simulation_state();
+    discard_simulation(&sim_state);
+  }
+  make_time = (wall_time() - start) / SETUP_RUNS;
+
+  /* Used for a busy hour first, so lanes and statistics have been written */
+  sim_state = make_simulation_state();
+  sim_state.render_simulation = 0;
+  sim_state.current_time = 8 * 3600.0;
+  update_simulation(&sim_state, 3600.0, 0);
+
+  start = wall_time();
+  for(i = 0; i < SETUP_RUNS; i++){
+    fork_simulation(&fork, &sim_state, i);
+    discard_simulation(&fork);
+  }
+  fork_time = (wall_time() - start) / SETUP_RUNS;
+
+  fork_simulation(&fork, &sim_state, 0);
+  start = wall_time();
+  for(i = 0; i < SETUP_RUNS; i++)
+    fork_simulation_into(&fork, &sim_state, i);
+  refork_time = (wall_time() - start) / SETUP_RUNS;
+  discard_simulation(&fork);
+
+  start = wall_time();
+  for(i = 0; i < SETUP_RUNS; i++)
+    reset_simulation(&sim_state, RAND_SEED, i, 0);
+  reset_time = (wall_time() - start) / SETUP_RUNS;
+  discard_simulation(&sim_state);
+
+  printf("\nSetup of a run:\n");
+  printf("  make_simulation_state() and discard_simulation(): %0.2f us (%0.4f%% of a simulated day)\n", make_time * 1e6, 100.0 * make_time / run_time);
+  printf("  reset_simulation(): %0.2f us (%0.4f%% of a simulated day)\n", reset_time * 1e6, 100.0 * reset_time / run_time);
+  printf("  fork_simulation() and discard_simulation(): %0.2f us\n", fork_time * 1e6);
+  printf("  fork_simulation_into() a used fork: %0.2f us\n", refork_time * 1e6);
+}
+
+void print_result(const char *name, const benchmark_result *result, int days){
+  double simulated_seconds = 3600.0 * 24.0 * days;
+
+  printf("\n%s:\n", name);
+  printf("  Wall time: %0.3f s\n", result->wall_time);
+  printf("  Ticks per second: %0.0f\n", simulated_seconds * TICK_RATE / result->wall_time);
+  printf("  Simulated hours per wall second: %0.1f\n", simulated_seconds / 3600.0 / result->wall_time);
+  printf("  Average wait time on day 1: %f\n", result->avg_wait);
+  printf("  Car slots allocated: %d, cars turned away: %d\n", result->car_slots, result->cars_turned_away);
+}
@@ -0,0 +1,552 @@
+#include "../Headers/AgentConstants.h"
+#include "../Headers/Simulation.h"
+#include "../Headers/SMDP_Solver.h"
+#include "../Headers/Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Searches for car and time interval edges for the RL agent. Every candidate is
+   trained with the semi-MDP solver and its policy is simulated, and the
+   candidates that are not beaten on wait time, state count and decision cost
+   at once are reported */
+
+#define MAX_CAR_BINS 10
+#define MAX_TIME_BINS 6
+#define MAX_CANDIDATES 512
+#define MAX_THREADS 64
+#define MAX_QUEUE 126 /* Cars in the last car interval of the agent */
+#define MAX_EDGE_PROPOSAL 60 /* Largest upper edge proposed for an inner car interval */
+#define MIN_GREEN_SECONDS 16 /* First decision second, see timeInterval */
+#define MAX_GREEN_SECONDS 120 /* Signal is forced to change from here on */
+#define DECISION_SAMPLES 2000000
+#define RESULT_FILE "bin_search_results.txt"
+
+typedef struct bin_candidate bin_candidate;
+typedef struct evaluation_queue evaluation_queue;
+
+struct bin_candidate{
+  int car_bins, time_bins, state_count, pareto, replicas_done;
+  int car_upper[MAX_CAR_BINS]; /* Last car count in each car interval */
+  int time_upper[MAX_TIME_BINS]; /* Last second in each time interval */
+  unsigned char car_bin_of[MAX_QUEUE + 1];
+  double wait_sum, avg_wait, decision_ns;
+  smdp_model model;
+};
+
+struct evaluation_queue{
+  bin_candidate *candidates;
+  int first_candidate, candidate_count, replicas, next_task;
+  platform_mutex lock;
+};
+
+int propose_random(bin_candidate *c, int max_states);
+int propose_mutation(bin_candidate *c, const bin_candidate *parent, int max_states);
+int finish_candidate(bin_candidate *c, int max_states);
+int is_duplicate(const bin_candidate *candidates, int count, const bin_candidate *c);
+void sort_edges(int *edges, int count);
+
+int train_candidate(bin_candidate *c, double discount, int horizon);
+void build_lane_transition(bin_candidate *c, double *matrix, int dir, int open);
+double poisson_pmf(int k, double lambda);
+
+void evaluate_candidates(bin_candidate *candidates, int first, int count, int replicas, int threads);
+void evaluation_worker(void *argument);
+void run_candidate_day(const bin_candidate *c, simulation_state *sim_state);
+int decide(const bin_candidate *c, const simulation_state *sim_state);
+void measure_decision_cost(bin_candidate *c);
+
+void mark_pareto_front(bin_candidate *candidates, int count);
+void print_results(bin_candidate *candidates, int count);
+int random_int(int low, int high);
+
+random_stream proposal_random; /* Draws for the candidate proposals */
+int candidate_engine = micro_engine; /* Engine the candidate days are simulated with */
+
+
+int main() {
+  bin_candidate *candidates;
+  int max_states, budget, replicas, threads, horizon, count = 0, first, i, attempts;
+  double discount, start;
+
+  printf("Maximum amount of states (the current agent has 23328): ");
+  if(scanf("%d", &max_states) != 1) return 1;
+
+  printf("\nAmount of candidates to evaluate (max %d): ", MAX_CANDIDATES);
+  if(scanf("%d", &budget) != 1) return 1;
+
+  printf("\nSimulated days per candidate: ");
+  if(scanf("%d", &replicas) != 1) return 1;
+
+  printf("\nSimulate the candidates with the car model(0) or the meso engine(1): ");
+  if(scanf("%d", &candidate_engine) != 1) return 1;
+
+  printf("\nThreads (0 = all processors): ");
+  if(scanf("%d", &threads) != 1) return 1;
+
+  printf("\nWhich discount value (0 < x > 1): ");
+  if(scanf("%lf", &discount) != 1) return 1;
+
+  printf("\nTime horizon: ");
+  if(scanf("%d", &horizon) != 1) return 1;
+
+  if(budget > MAX_CANDIDATES) budget = MAX_CANDIDATES;
+  if(budget < 1) budget = 1;
+  if(replicas < 1) replicas = 1;
+  if(threads <= 0) threads = processor_count();
+  if(threads > MAX_THREADS) threads = MAX_THREADS;
+
+  candidates = (bin_candidate *) calloc(budget, sizeof(bin_candidate));
+  if(candidates == NULL){
+    printf("Unable to allocate %d candidates\n", budget);
+    return 1;
+  }
+  seed_random_stream(&proposal_random, RAND_SEED, 0, 0);
+  start = wall_time();
+
+  /* Round 1: the hand picked intervals and random proposals */
+  candidates[0].car_bins = TOTAL_CAR_STATES;
+  candidates[0].time_bins = TOTAL_TIME_STATES;
+  for(i = 0; i < TOTAL_CAR_STATES; i++)
+    candidates[0].car_upper[i] = CarInterval[i][1];
+  for(i = 0; i < TOTAL_TIME_STATES; i++)
+    candidates[0].time_upper[i] = timeInterval[i][1];
+  if(finish_candidate(&candidates[0], max_states))
+    count++;
+
+  for(attempts = 0; count < (budget + 1) / 2 && attempts < 100000; attempts++){
+    if(propose_random(&candidates[count], max_states) && !is_duplicate(candidates, count, &candidates[count]))
+      count++;
+  }
+
+  /* Round 2: small changes to the candidates on the pareto front */
+  first = 0;
+  while(count < budget){
+    int round_start = count;
+
+    for(i = first; i < round_start; i++)
+      if(!train_candidate(&candidates[i], discount, horizon)){
+        printf("Unable to allocate the model of candidate %d\n", i);
+        return 1;
+      }
+    evaluate_candidates(candidates, first, round_start - first, replicas, threads);
+    mark_pareto_front(candidates, round_start);
+
+    for(attempts = 0; count < budget && attempts < 100000; attempts++){
+      const bin_candidate *parent = &candidates[random_int(0, round_start - 1)];
+      if(parent->pareto && propose_mutation(&candidates[count], parent, max_states) && !is_duplicate(candidates, count, &candidates[count]))
+        count++;
+    }
+
+    first = round_start;
+    if(count == round_start) break;
+  }
+
+  for(i = first; i < count; i++)
+    if(!train_candidate(&candidates[i], discount, horizon)){
+      printf("Unable to allocate the model of candidate %d\n", i);
+      return 1;
+    }
+  evaluate_candidates(candidates, first, count - first, replicas, threads);
+  mark_pareto_front(candidates, count);
+
+  print_results(candidates, count);
+  printf("\nEvaluated %d candidates in %0.1f seconds\n", count, wall_time() - start);
+
+  for(i = 0; i < count; i++)
+    free_smdp_model(&(candidates[i].model));
+  free(candidates);
+
+  system("pause");
+  return 0;
+}
+
+/* Proposes random car and time intervals. Returns true (1) if within budget */
+int propose_random(bin_candidate *c, int max_states){
+  int i, j, edge, max_car_bins = MAX_CAR_BINS, used;
+
+  memset(c, 0, sizeof(bin_candidate));
+  c->time_bins = random_int(3, MAX_TIME_BINS);
+
+  /* Largest amount of car intervals allowed by the budget */
+  while(max_car_bins > 2 && pow(max_car_bins, 4) * AMOUNT_OF_SIGNAL_STATES * c->time_bins > max_states)
+    max_car_bins--;
+  c->car_bins = random_int(2, max_car_bins);
+
+  /* The first car interval only holds empty lanes and the last ends at MAX_QUEUE */
+  c->car_upper[0] = 0;
+  for(i = 1; i < c->car_bins - 1; i++){
+    do{
+      edge = random_int(1, MAX_EDGE_PROPOSAL);
+      used = 0;
+      for(j = 1; j < i; j++)
+        used |= (c->car_upper[j] == edge);
+    }while(used);
+    c->car_upper[i] = edge;
+  }
+  c->car_upper[c->car_bins - 1] = MAX_QUEUE;
+  sort_edges(c->car_upper + 1, c->car_bins - 2);
+
+  /* Inner time intervals split the time between minimum and maximum green */
+  c->time_upper[0] = MIN_GREEN_SECONDS - 1;
+  for(i = 1; i < c->time_bins - 2; i++){
+    do{
+      edge = random_int(MIN_GREEN_SECONDS, MAX_GREEN_SECONDS - 2);
+      used = 0;
+      for(j = 1; j < i; j++)
+        used |= (c->time_upper[j] == edge);
+    }while(used);
+    c->time_upper[i] = edge;
+  }
+  c->time_upper[c->time_bins - 2] = MAX_GREEN_SECONDS - 1;
+  c->time_upper[c->time_bins - 1] = timeInterval[TOTAL_TIME_STATES - 1][1];
+  sort_edges(c->time_upper + 1, c->time_bins - 3);
+
+  return finish_candidate(c, max_states);
+}
+
+/* Moves one edge of a parent candidate or splits one of its car intervals */
+int propose_mutation(bin_candidate *c, const bin_candidate *parent, int max_states){
+  int move = random_int(0, 2), i;
+
+  memcpy(c->car_upper, parent->car_upper, sizeof(c->car_upper));
+  memcpy(c->time_upper, parent->time_upper, sizeof(c->time_upper));
+  memset(&(c->model), 0, sizeof(smdp_model));
+  c->car_bins = parent->car_bins;
+  c->time_bins = parent->time_bins;
+
+  if(move == 0 && c->car_bins > 2){
+    /* Shift an inner car edge */
+    i = random_int(1, c->car_bins - 2);
+    c->car_upper[i] += random_int(-5, 5);
+
+  }else if(move == 1 && c->car_bins < MAX_CAR_BINS){
+    /* Split a car interval */
+    i = random_int(1, c->car_bins - 1);
+    if(c->car_upper[i] - c->car_upper[i - 1] < 2) return 0;
+    memmove(&(c->car_upper[i + 1]), &(c->car_upper[i]), (c->car_bins - i) * sizeof(int));
+    c->car_upper[i] = random_int(c->car_upper[i - 1] + 1, c->car_upper[i + 1] - 1);
+    c->car_bins++;
+
+  }else if(c->time_bins > 3){
+    /* Shift an inner time edge */
+    i = random_int(1, c->time_bins - 3);
+    c->time_upper[i] += random_int(-10, 10);
+
+  }else{
+    return 0;
+  }
+
+  return finish_candidate(c, max_states);
+}
+
+/* Validates the intervals and precomputes lookups. Returns true (1) if usable */
+int finish_candidate(bin_candidate *c, int max_states){
+  int i, count, bin = 0;
+
+  for(i = 1; i < c->car_bins; i++)
+    if(c->car_upper[i] <= c->car_upper[i - 1]) return 0;
+  for(i = 1; i < c->time_bins; i++)
+    if(c->time_upper[i] <= c->time_upper[i - 1]) return 0;
+  if(c->car_upper[0] != 0 || c->car_upper[c->car_bins - 1] != MAX_QUEUE) return 0;
+  if(c->time_upper[0] != MIN_GREEN_SECONDS - 1 || c->time_upper[c->time_bins - 2] != MAX_GREEN_SECONDS - 1) return 0;
+
+  c->state_count = c->car_bins * c->car_bins * c->car_bins * c->car_bins * AMOUNT_OF_SIGNAL_STATES * c->time_bins;
+  if(c->state_count > max_states) return 0;
+
+  for(count = 0; count <= MAX_QUEUE; count++){
+    while(count > c->car_upper[bin]) bin++;
+    c->car_bin_of[count] = (unsigned char) bin;
+  }
+
+  return 1;
+}
+
+/* Returns true (1) if the intervals of c are already among the candidates */
+int is_duplicate(const bin_candidate *candidates, int count, const bin_candidate *c){
+  int i;
+  for(i = 0; i < count; i++){
+    if(candidates[i].car_bins == c->car_bins && candidates[i].time_bins == c->time_bins &&
+       memcmp(candidates[i].car_upper, c->car_upper, c->car_bins * sizeof(int)) == 0 &&
+       memcmp(candidates[i].time_upper, c->time_upper, c->time_bins * sizeof(int)) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* Sorts interval edges in increasing order */
+void sort_edges(int *edges, int count){
+  int i, j, edge;
+  for(i = 1; i < count; i++){
+    edge = edges[i];
+    for(j = i; j > 0 && edges[j - 1] > edge; j--)
+      edges[j] = edges[j - 1];
+    edges[j] = edge;
+  }
+}
+
+/* Builds the semi-MDP model of a candidate and runs value iteration.
+   Returns false (0) if the model could not be allocated */
+int train_candidate(bin_candidate *c, double discount, int horizon){
+  int dir, open, bin, h, low;
+
+  if(!init_smdp_model(&(c->model), c->car_bins, c->time_bins, discount))
+    return 0;
+
+  for(dir = 0; dir < SMDP_DIRECTIONS; dir++)
+    for(open = 0; open < 2; open++)
+      build_lane_transition(c, c->model.transition[dir][open], dir, open);
+
+  /* The reward of an interval is the average amount of cars in it,
+     which is how the hand picked rewards of the agent were chosen */
+  for(bin = 0; bin < c->car_bins; bin++){
+    low = (bin == 0) ? 0 : c->car_upper[bin - 1] + 1;
+    c->model.lane_reward[1][bin] = (bin == 0) ? reward[0] : (low + c->car_upper[bin]) / 2.0;
+    c->model.lane_reward[0][bin] = -c->model.lane_reward[1][bin];
+  }
+
+  for(bin = 0; bin < c->time_bins; bin++){
+    low = (bin == 0) ? 0 : c->time_upper[bin - 1] + 1;
+    c->model.time_advance[bin] = 1.0 / (c->time_upper[bin] - low + 1);
+  }
+
+  set_smdp_macro(&(c->model), YELLOW_TIME_LIMIT, MIN_GREEN_SECONDS);
+  finish_smdp_model(&(c->model));
+
+  for(h = 1; h <= horizon; h++){
+    smdp_backup(&(c->model));
+    smdp_swap_values(&(c->model));
+  }
+
+  /* Policy with respect to the final values */
+  smdp_backup(&(c->model));
+  return 1;
+}
+
+/* Interval transition matrix of one direction. Within an interval every car
+   count is assumed equally likely, up to SPAWNLIMIT cars arrive per second
+   and up to LAMDA cars leave per second when the lane is open */
+void build_lane_transition(bin_candidate *c, double *matrix, int dir, int open){
+  int bin, cars, arrived, resolved, low, next, n = c->car_bins;
+  double arrival, resolve_sum = 0, resolve;
+
+  for(resolved = 0; resolved <= LAMDA; resolved++)
+    resolve_sum += poisson_pmf(resolved, 1);
+
+  memset(matrix, 0, n * n * sizeof(double));
+
+  for(bin = 0; bin < n; bin++){
+    low = (bin == 0) ? 0 : c->car_upper[bin - 1] + 1;
+
+    for(cars = low; cars <= c->car_upper[bin]; cars++){
+      for(arrived = 0; arrived <= SPAWNLIMIT; arrived++){
+        arrival = poisson_pmf(arrived, spawnRate[dir] / SEC_PER_HOUR) / (c->car_upper[bin] - low + 1);
+
+        for(resolved = 0; resolved <= (open ? LAMDA : 0); resolved++){
+          resolve = open ? poisson_pmf(resolved, 1) / resolve_sum : 1.0;
+
+          /* More cars than available can not be resolved */
+          next = cars + arrived - resolved;
+          if(next < 0) next = 0;
+          if(next > MAX_QUEUE) next = MAX_QUEUE;
+
+          matrix[bin * n + c->car_bin_of[next]] += arrival * resolve;
+        }
+      }
+    }
+  }
+}
+
+/* Returns the probability of k events in a Poisson distribution */
+double poisson_pmf(int k, double lambda){
+  double result = exp(-lambda);
+  int i;
+  for(i = 1; i <= k; i++)
+    result *= lambda / i;
+  return result;
+}
+
+/* Simulates every candidate in [first, first + count) on all threads */
+void evaluate_candidates(bin_candidate *candidates, int first, int count, int replicas, int threads){
+  platform_thread workers[MAX_THREADS];
+  evaluation_queue queue;
+  int i, started = 0;
+
+  queue.candidates = candidates;
+  queue.first_candidate = first;
+  queue.candidate_count = count;
+  queue.replicas = replicas;
+  queue.next_task = 0;
+  init_mutex(&queue.lock);
+
+  for(i = 0; i < threads; i++){
+    if(!start_thread(&workers[started], evaluation_worker, &queue)) break;
+    started++;
+  }
+
+  /* The threads that started empty the queue, without any it is emptied here */
+  if(started == 0)
+    evaluation_worker(&queue);
+  for(i = 0; i < started; i++)
+    join_thread(&workers[i]);
+
+  destroy_mutex(&queue.lock);
+
+  for(i = first; i < first + count; i++){
+    candidates[i].avg_wait = candidates[i].wait_sum / candidates[i].replicas_done;
+    measure_decision_cost(&candidates[i]);
+    printf("Candidate %3d: %6d states, average wait %0.3f\n", i, candidates[i].state_count, candidates[i].avg_wait);
+  }
+}
+
+/* Takes simulated days from the queue until it is empty. The worker
+   resets a single simulation for all of its days */
+void evaluation_worker(void *argument){
+  evaluation_queue *queue = (evaluation_queue *) argument;
+  simulation_state sim_state = make_simulation_state();
+  int task;
+
+  while(1){
+    bin_candidate *c;
+    double avg_wait;
+
+    lock_mutex(&queue->lock);
+    task = queue->next_task++;
+    unlock_mutex(&queue->lock);
+
+    if(task >= queue->candidate_count * queue->replicas) break;
+    c = &(queue->candidates[queue->first_candidate + task / queue->replicas]);
+
+    /* Replica r of every candidate sees the same traffic, which makes the
+       candidates easier to compare and the results independent of threads */
+    reset_simulation(&sim_state, RAND_SEED, task % queue->replicas, 0);
+    sim_state.render_simulation = 0;
+    sim_state.engine = candidate_engine == meso_engine ? meso_engine : micro_engine;
+    run_candidate_day(c, &sim_state);
+    avg_wait = sim_state.stats[0].total_wait_time / (double) sim_state.stats[0].total_cars_passed;
+
+    lock_mutex(&queue->lock);
+    c->wait_sum += avg_wait;
+    c->replicas_done++;
+    unlock_mutex(&queue->lock);
+  }
+
+  discard_simulation(&sim_state);
+}
+
+/* Controls the intersection for one day with the policy of a candidate */
+void run_candidate_day(const bin_candidate *c, simulation_state *sim_state){
+  int action;
+
+  while(sim_state->days_simulated < 1){
+    action = decide(c, sim_state);
+    update_simulation(sim_state, 1, action);
+
+    /* Skip through the forced yellow and minimum green phases */
+    if(action)
+      update_simulation(sim_state, c->model.macro_length - 1, 0);
+  }
+}
+
+/* Returns the action of the candidate policy in the current simulation state */
+int decide(const bin_candidate *c, const simulation_state *sim_state){
+  int signal = sim_state->current_signal_state, seconds = (int) sim_state->time_since_change, time_bin = 0, cars[SMDP_DIRECTIONS], i;
+  const int street_of_direction[SMDP_DIRECTIONS] = {north, south, east, west};
+
+  if(signal != g_r && signal != r_g) return 0;
+
+  while(time_bin < c->time_bins - 1 && seconds > c->time_upper[time_bin])
+    time_bin++;
+  if(time_bin == 0) return 0;
+
+  for(i = 0; i < SMDP_DIRECTIONS; i++){
+    int count = sim_state->streets[street_of_direction[i]].lanes[straight_right_lane].amount_of_cars;
+    cars[i] = c->car_bin_of[count > MAX_QUEUE ? MAX_QUEUE : count];
+  }
+
+  return smdp_policy(&(c->model), signal == g_r ? 0 : 1, time_bin, cars);
+}
+
+/* Average time of a decision in nanoseconds, over randomly filled intersections */
+void measure_decision_cost(bin_candidate *c){
+  simulation_state sim_state;
+  int i, j, actions = 0;
+  double start;
+
+  memset(&sim_state, 0, sizeof(sim_state));
+  start = wall_time();
+
+  for(i = 0; i < DECISION_SAMPLES; i++){
+    for(j = 0; j < AMOUNT_OF_STREETS; j++)
+      sim_state.streets[j].lanes[straight_right_lane].amount_of_cars = (i * 7 + j * 13) % 40;
+    sim_state.current_signal_state = (i & 1) ? g_r : r_g;
+    sim_state.time_since_change = (i * 3) % 140;
+    actions += decide(c, &sim_state);
+  }
+
+  c->decision_ns = (wall_time() - start) * 1e9 / DECISION_SAMPLES;
+
+  /* Keeps the loop from being optimized away */
+  if(actions < 0) printf("%d", actions);
+}
+
+/* Marks candidates not dominated on wait time, state count and decision cost */
+void mark_pareto_front(bin_candidate *candidates, int count){
+  int i, j;
+
+  for(i = 0; i < count; i++){
+    candidates[i].pareto = 1;
+    for(j = 0; j < count && candidates[i].pareto; j++){
+      const bin_candidate *a = &candidates[j], *b = &candidates[i];
+      if(i == j) continue;
+
+      if(a->avg_wait <= b->avg_wait && a->state_count <= b->state_count && a->decision_ns <= b->decision_ns &&
+         (a->avg_wait < b->avg_wait || a->state_count < b->state_count || a->decision_ns < b->decision_ns))
+        candidates[i].pareto = 0;
+    }
+  }
+}
+
+/* Prints the pareto front and writes every candidate to RESULT_FILE */
+void print_results(bin_candidate *candidates, int count){
+  FILE *fp = fopen(RESULT_FILE, "w");
+  int i, j;
+
+  if(fp != NULL)
+    fprintf(fp, "states,average wait,decision ns,pareto,car intervals,time intervals\n");
+
+  printf("\nPareto front:\n%8s %12s %12s  %s\n", "States", "Avg. wait", "Decision ns", "Car intervals | time intervals");
+
+  for(i = 0; i < count; i++){
+    bin_candidate *c = &candidates[i];
+
+    if(fp != NULL){
+      fprintf(fp, "%d,%f,%f,%d,", c->state_count, c->avg_wait, c->decision_ns, c->pareto);
+      for(j = 0; j < c->car_bins; j++)
+        fprintf(fp, "%d%s", c->car_upper[j], j + 1 < c->car_bins ? " " : ",");
+      for(j = 0; j < c->time_bins; j++)
+        fprintf(fp, "%d%s", c->time_upper[j], j + 1 < c->time_bins ? " " : "\n");
+    }
+
+    if(!c->pareto) continue;
+
+    printf("%8d %12.3f %12.1f  ", c->state_count, c->avg_wait, c->decision_ns);
+    for(j = 0; j < c->car_bins; j++)
+      printf("{%d-%d}", j == 0 ? 0 : c->car_upper[j - 1] + 1, c->car_upper[j]);
+    printf(" |");
+    for(j = 0; j < c->time_bins; j++)
+      printf(" %d", c->time_upper[j]);
+    printf("\n");
+  }
+
+  if(fp != NULL)
+    fclose(fp);
+}
+
+/* Returns a random integer in [low, high] */
+int random_int(int low, int high){
+  if(high <= low) return low;
+  return low + random_below(&proposal_random, high - low + 1);
+}
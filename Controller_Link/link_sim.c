@@ -0,0 +1,175 @@
+#include "../Headers/Simulation.h"
+#include "../Headers/Controller_Link.h"
+#include "../Headers/Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Runs the intersection for a controller in another process, see
+   Headers/Controller_Link.h. Start this first and the controller, for
+   example Controller_Link/stand_in_controller.c, with the same link name */
+
+#define LINK_ATTACH_TIMEOUT 60.0 /* Seconds to wait for a controller */
+#define LINK_ANSWER_TIMEOUT 10.0 /* Seconds to wait for an answer in lockstep */
+
+typedef struct link_run link_run;
+
+struct link_run{
+  controller_link *link;
+  double decision_interval, time_scale;
+  long decisions, steps, late, dropped, changes;
+  latency_histogram latency;
+};
+
+void run_lockstep(simulation_state *sim_state, link_run *run);
+void run_real_time(simulation_state *sim_state, link_run *run);
+
+
+int main() {
+  char name[MAX_LINK_NAME];
+  int mode = link_lockstep, day, carsPassed = 0;
+  double startTime, hours, waitStart, totalWait = 0;
+  simulation_state sim_state = make_simulation_state();
+  link_endpoint endpoint;
+  link_run run;
+
+  memset(&run, 0, sizeof(link_run));
+  run.time_scale = 1;
+
+  printf("Link name (default %s): ", DEFAULT_LINK_NAME);
+  if(scanf("%63s", name) != 1) strcpy(name, DEFAULT_LINK_NAME);
+
+  printf("\nLockstep(0) or real time(1): ");
+  if(scanf("%d", &mode) != 1 || mode != link_real_time) mode = link_lockstep;
+
+  if(mode == link_real_time){
+    printf("\nSimulation timescale (1.0 = realtime and 2.5 = 1 sec in real life is 2.5 sec in the simulation): ");
+    if(scanf("%lf", &run.time_scale) != 1 || run.time_scale <= 0) run.time_scale = 1;
+  }
+
+  printf("\nSeconds between decisions (default 1): ");
+  if(scanf("%lf", &run.decision_interval) != 1 || run.decision_interval * TICK_RATE < 1) run.decision_interval = 1;
+
+  printf("\nStart time in seconds (0 = 00:00 and 28800 = 08:00): ");
+  if(scanf("%lf", &startTime) != 1) startTime = 0;
+
+  printf("\nHours to simulate (max 24): ");
+  if(scanf("%lf", &hours) != 1 || hours <= 0 || hours > 24) hours = 1;
+
+  if(!create_controller_link(&endpoint, name, mode, run.decision_interval)){
+    printf("Unable to make the shared memory %s\n", name);
+    return 1;
+  }
+  run.link = endpoint.link;
+  run.steps = (long) (hours * 3600.0 / run.decision_interval + 0.5);
+
+  printf("Waiting for a controller on %s...\n", name);
+  waitStart = wall_time();
+  while(!load_acquire(&(run.link->controller_attached))){
+    if(wall_time() - waitStart > LINK_ATTACH_TIMEOUT){
+      printf("No controller attached within %0.0f seconds\n", LINK_ATTACH_TIMEOUT);
+      close_controller_link(&endpoint);
+      discard_simulation(&sim_state);
+      return 1;
+    }
+    sleep_milliseconds(10);
+  }
+  printf("Simulating...\n");
+
+  sim_state.current_time = startTime;
+  sim_state.render_simulation = 0;
+
+  if(mode == link_real_time)
+    run_real_time(&sim_state, &run);
+  else
+    run_lockstep(&sim_state, &run);
+
+  /* The run may end in the middle of a day */
+  for(day = 0; day <= sim_state.days_simulated && day < sim_state.stat_days; day++){
+    carsPassed += sim_state.stats[day].total_cars_passed;
+    totalWait += sim_state.stats[day].total_wait_time;
+  }
+  printf("\nCars passed: %d\n", carsPassed);
+  printf("Average wait time per car: %0.6f\n", carsPassed > 0 ? totalWait / carsPassed : 0);
+  printf("Cars still waiting: %d\n", get_total_car_count(&sim_state));
+
+  printf("\n--------------- Controller link ---------------\n");
+  printf("Decisions             : %ld of %ld\n", run.decisions, run.steps);
+  printf("Signal changes asked  : %ld\n", run.changes);
+  if(mode == link_real_time){
+    printf("Answered too late     : %ld\n", run.late);
+    printf("Requests dropped      : %ld\n", run.dropped);
+  }
+  print_latency_histogram(&run.latency);
+
+  close_controller_link(&endpoint);
+  discard_simulation(&sim_state);
+  return 0;
+}
+
+/* Sends every decision and simulates on once it is answered */
+void run_lockstep(simulation_state *sim_state, link_run *run){
+  link_request request;
+  link_response response;
+  double sent;
+  int polls;
+
+  while(run->decisions < run->steps){
+    make_link_request(&request, sim_state, (unsigned int) run->decisions, run->decisions == run->steps - 1);
+    sent = wall_time();
+    push_link_request(run->link, &request);
+
+    /* Answers to anything else are left over from an earlier controller */
+    polls = 0;
+    while(!pop_link_response(run->link, &response) || response.sequence != request.sequence){
+      if(wall_time() - sent > LINK_ANSWER_TIMEOUT){
+        printf("The controller did not answer within %0.0f seconds\n", LINK_ANSWER_TIMEOUT);
+        return;
+      }
+      back_off(&polls);
+    }
+
+    add_latency(&(run->latency), wall_time() - sent);
+    run->changes += response.new_signal != 0;
+    update_simulation(sim_state, run->decision_interval, response.new_signal != 0);
+    run->decisions++;
+  }
+}
+
+/* Sends a decision every interval of the wall clock and applies the last
+   answer that arrived in the interval before it */
+void run_real_time(simulation_state *sim_state, link_run *run){
+  link_request request;
+  link_response response;
+  double sent[LINK_RING_SIZE], start = wall_time(), deadline, now;
+  int polls, new_signal = 0, answered;
+
+  while(run->decisions < run->steps){
+    make_link_request(&request, sim_state, (unsigned int) run->decisions, run->decisions == run->steps - 1);
+    if(push_link_request(run->link, &request))
+      sent[request.sequence & (LINK_RING_SIZE - 1)] = wall_time();
+    else
+      run->dropped++;
+
+    run->changes += new_signal != 0;
+    update_simulation(sim_state, run->decision_interval, new_signal);
+    run->decisions++;
+
+    /* Collect the answers until the next decision is due */
+    new_signal = 0;
+    answered = 0;
+    polls = 0;
+    deadline = start + run->decisions * run->decision_interval / run->time_scale;
+    while((now = wall_time()) < deadline){
+      while(pop_link_response(run->link, &response)){
+        if(request.sequence - response.sequence < LINK_RING_SIZE)
+          add_latency(&(run->latency), now - sent[response.sequence & (LINK_RING_SIZE - 1)]);
+        answered |= response.sequence == request.sequence;
+        new_signal = response.new_signal != 0;
+      }
+      back_off(&polls);
+    }
+    run->late += !answered;
+  }
+}
@@ -0,0 +1,95 @@
+#include "../Headers/Simulation_Constants.h"
+#include "../Headers/Controller_Link.h"
+#include "../Headers/Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A controller process for Controller_Link/link_sim.c. It answers every
+   request with the actuated rule of Network_Simulation/network_sim.c: keep
+   the green for at least the minimum green time, and change when the green
+   lanes are empty while others wait or the maximum green time is reached.
+   Thinking time per decision can be added to try the real time mode */
+
+#define STAND_IN_MAX_GREEN 40.0
+#define STAND_IN_ATTACH_TIMEOUT 60.0
+
+int decide(const link_request *request, double max_green);
+
+
+int main() {
+  char name[MAX_LINK_NAME];
+  int thinkTime, polls, received;
+  long answered = 0, changes = 0, skipped = 0;
+  double waitStart;
+  link_endpoint endpoint;
+  link_request request;
+  link_response response;
+
+  printf("Link name (default %s): ", DEFAULT_LINK_NAME);
+  if(scanf("%63s", name) != 1) strcpy(name, DEFAULT_LINK_NAME);
+
+  printf("\nMilliseconds to think per decision (0 = answer at once): ");
+  if(scanf("%d", &thinkTime) != 1 || thinkTime < 0) thinkTime = 0;
+
+  /* The simulator may not have made the link yet */
+  printf("Attaching to %s...\n", name);
+  waitStart = wall_time();
+  while(!attach_controller_link(&endpoint, name)){
+    if(wall_time() - waitStart > STAND_IN_ATTACH_TIMEOUT){
+      printf("No simulator on %s within %0.0f seconds\n", name, STAND_IN_ATTACH_TIMEOUT);
+      return 1;
+    }
+    sleep_milliseconds(10);
+  }
+  printf("Controlling...\n");
+
+  while(1){
+    /* The simulator stops early when it gives up on an answer */
+    polls = 0;
+    while(!(received = pop_link_request(endpoint.link, &request)) && !load_acquire(&(endpoint.link->stopping)))
+      back_off(&polls);
+    if(!received) break;
+
+    /* A controller that fell behind the wall clock answers the newest state only */
+    while(!request.last_request && pop_link_request(endpoint.link, &request))
+      skipped++;
+
+    response.sequence = request.sequence;
+    response.new_signal = decide(&request, STAND_IN_MAX_GREEN);
+    if(thinkTime > 0)
+      sleep_milliseconds(thinkTime);
+
+    polls = 0;
+    while(!push_link_response(endpoint.link, &response) && !load_acquire(&(endpoint.link->stopping)))
+      back_off(&polls);
+
+    answered++;
+    changes += response.new_signal;
+    if(request.last_request) break;
+  }
+
+  printf("Answered %ld requests, skipped %ld and asked for %ld signal changes\n", answered, skipped, changes);
+  close_controller_link(&endpoint);
+  return 0;
+}
+
+/* Returns 1 to change the signal and 0 to keep it */
+int decide(const link_request *request, double max_green){
+  int i, green_cars = 0, waiting_cars = 0;
+
+  if(is_yellow(request->signal_state) || request->time_since_change < MIN_GREEN_TIME)
+    return 0;
+  if(request->time_since_change >= max_green)
+    return 1;
+
+  for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++){
+    if(get_signal_color(request->signal_state, i) == green)
+      green_cars += request->signal_group_cars[i];
+    else
+      waiting_cars += request->signal_group_cars[i];
+  }
+
+  return green_cars == 0 && waiting_cars > 0;
+}
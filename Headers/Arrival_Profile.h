@@ -0,0 +1,331 @@
+#ifndef ArrivalProfile /* Include guard */
+#define ArrivalProfile
+
+/* ------------- Arrival rates from traffic counts ------------- */
+/* A count file holds the cars counted in every lane in every quarter of an
+   hour of one or more real days, and the arrivals of a simulation can be
+   drawn from it instead of from the curves fitted to a single day. It is a
+   text file with a line per count:
+
+     day, day type, street, lane, quarter, cars
+
+   day counts the days of the dataset from 0, the day type is weekday or
+   weekend, the street is its name or index in the scenario, the lane is
+   left or straight (or its lane_type) and the quarter counts the quarters of
+   the day from 0 to 95. Lines starting with # are comments and counts that
+   are missing are 0. No signal phase serves the left lanes and their cars
+   would never leave, so left counts are added to the straight lane of their
+   street, where every spawned car goes, and a warning says how many.
+
+   Loading a count file compiles it into a dense table of Poisson rates for
+   every minute of every day, interpolated linearly between the middles of
+   the quarters, followed by a typical weekday and a typical weekend day
+   that average the days of their type. A spawn then looks up its rate and
+   draws from it without evaluating any curve. save_arrival_profile()
+   writes the table to a file that is mapped into memory when it is loaded
+   again, so a dataset of many weeks costs no parsing and is shared by every
+   simulation using it. That file starts with an arrival_profile_header,
+   followed by the day type of every table day and the arrival_rates of
+   every minute, street and lane of every table day */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Platform.h"
+
+#define ARRIVAL_PROFILE_MAGIC "TLAP"
+#define ARRIVAL_PROFILE_VERSION 1
+#define QUARTERS_PER_DAY 96
+#define ARRIVAL_SLOTS_PER_DAY 1440 /* Minutes */
+#define ARRIVAL_LANES (AMOUNT_OF_STREETS * LANES_PER_STREET)
+#define MAX_PROFILE_DAYS 3660
+#define MAX_COUNT_LINE 256
+#define MAX_PROFILE_PATH 200
+
+typedef struct arrival_profile_header arrival_profile_header;
+typedef struct arrival_rate arrival_rate;
+
+enum day_type{
+  weekday, weekend
+};
+
+/* Days that are not in the dataset, for select_arrival_day() */
+enum typical_day{
+  typical_weekday = -1, typical_weekend = -2
+};
+
+/* First 32 bytes of a compiled profile */
+struct arrival_profile_header{
+  char magic[4];
+  unsigned int version, rate_size, lanes, slots_per_day;
+  unsigned int day_count; /* Days of the dataset */
+  unsigned int table_days; /* day_count and the two typical days */
+  unsigned int types_size; /* Bytes of day types, a multiple of 8 */
+};
+
+/* The arrivals of a lane in a spawn interval during one minute */
+struct arrival_rate{
+  float p_zero; /* Probability that no car arrives, exp(-lambda) */
+  float lambda; /* Mean cars per spawn interval */
+};
+
+struct arrival_profile{
+  mapped_file map; /* Holds the table when it was compiled before */
+  void *table; /* Holds it when it was compiled from counts */
+  const arrival_profile_header *header;
+  const unsigned char *day_types;
+  const arrival_rate *rates;
+  int day_count, first_day;
+};
+
+int load_arrival_profile(arrival_profile *profile, const char *path);
+int compile_count_file(arrival_profile *profile, const char *path);
+int read_count_line(char *line, int *day, int *type, int *street_index, int *lane_type, int *quarter, double *cars);
+void fill_rate_day(arrival_rate *rates, const double *counts);
+int save_arrival_profile(const arrival_profile *profile, const char *path);
+void close_arrival_profile(arrival_profile *profile);
+int select_arrival_day(arrival_profile *profile, int day);
+int get_profile_day(const arrival_profile *profile, int replica, int days_simulated);
+const arrival_rate *get_arrival_rates(const arrival_profile *profile, int table_day, double current_time);
+int draw_arrivals(const arrival_rate *rate, random_stream *random);
+
+
+/* Loads a compiled profile or compiles a count file. The profile starts at
+   its first day. Returns true (1) on success */
+int load_arrival_profile(arrival_profile *profile, const char *path){
+  const arrival_profile_header *header;
+
+  memset(profile, 0, sizeof(arrival_profile));
+  if(!map_file_readonly(&(profile->map), path))
+    return 0;
+
+  header = (const arrival_profile_header *) profile->map.data;
+  if(profile->map.size < sizeof(arrival_profile_header) || memcmp(header->magic, ARRIVAL_PROFILE_MAGIC, 4) != 0){
+    unmap_file(&(profile->map));
+    return compile_count_file(profile, path);
+  }
+
+  if(header->version != ARRIVAL_PROFILE_VERSION || header->rate_size != sizeof(arrival_rate) ||
+     header->lanes != ARRIVAL_LANES || header->slots_per_day != ARRIVAL_SLOTS_PER_DAY ||
+     header->table_days != header->day_count + 2 || header->types_size < header->table_days ||
+     profile->map.size != sizeof(arrival_profile_header) + header->types_size +
+                          (size_t) header->table_days * ARRIVAL_SLOTS_PER_DAY * ARRIVAL_LANES * sizeof(arrival_rate)){
+    unmap_file(&(profile->map));
+    return 0;
+  }
+
+  profile->header = header;
+  profile->day_types = (const unsigned char *) profile->map.data + sizeof(arrival_profile_header);
+  profile->rates = (const arrival_rate *) (profile->day_types + header->types_size);
+  profile->day_count = header->day_count;
+  return 1;
+}
+
+/* Reads a count file into a table in memory. Returns true (1) on success */
+int compile_count_file(arrival_profile *profile, const char *path){
+  char line[MAX_COUNT_LINE];
+  FILE *fp = fopen(path, "r");
+  double *counts, *typical;
+  int day, type, street_index, lane_type, quarter, day_count = 0, table_days, types_size, i, j, ok = 1;
+  int typical_days[2] = {0, 0};
+  double cars, left_cars = 0;
+  size_t day_size = QUARTERS_PER_DAY * ARRIVAL_LANES, table_size;
+  arrival_profile_header *header;
+  unsigned char *day_types;
+
+  memset(profile, 0, sizeof(arrival_profile));
+  if(fp == NULL) return 0;
+
+  /* The first pass finds the days */
+  while(ok && fgets(line, MAX_COUNT_LINE, fp) != NULL){
+    ok = read_count_line(line, &day, &type, &street_index, &lane_type, &quarter, &cars);
+    if(ok > 0 && day >= day_count) day_count = day + 1;
+  }
+  if(!ok || day_count == 0){
+    fclose(fp);
+    return 0;
+  }
+
+  table_days = day_count + 2;
+  types_size = (table_days + 7) / 8 * 8;
+  table_size = sizeof(arrival_profile_header) + types_size + (size_t) table_days * ARRIVAL_SLOTS_PER_DAY * ARRIVAL_LANES * sizeof(arrival_rate);
+  counts = (double *) calloc((size_t) table_days * day_size, sizeof(double));
+  profile->table = calloc(table_size, 1);
+  if(counts == NULL || profile->table == NULL){
+    free(counts);
+    free(profile->table);
+    profile->table = NULL;
+    fclose(fp);
+    return 0;
+  }
+
+  header = (arrival_profile_header *) profile->table;
+  day_types = (unsigned char *) profile->table + sizeof(arrival_profile_header);
+
+  /* The second pass adds up the counts, the last day type given for a day counts */
+  rewind(fp);
+  while(fgets(line, MAX_COUNT_LINE, fp) != NULL){
+    if(read_count_line(line, &day, &type, &street_index, &lane_type, &quarter, &cars) <= 0) continue;
+    counts[day * day_size + quarter * ARRIVAL_LANES + street_index * LANES_PER_STREET + straight_right_lane] += cars;
+    if(lane_type == left_lane) left_cars += cars;
+    day_types[day] = (unsigned char) type;
+  }
+  fclose(fp);
+
+  if(left_cars > 0)
+    printf("The left lanes are not served, %0.0f cars counted in them are added to the straight lanes\n", left_cars);
+
+  /* The typical days average the days of their type, or all days if there are none */
+  for(day = 0; day < day_count; day++)
+    typical_days[day_types[day]]++;
+  for(i = 0; i < 2; i++){
+    typical = counts + (size_t) (day_count + i) * day_size;
+    day_types[day_count + i] = (unsigned char) i;
+
+    for(day = 0; day < day_count; day++){
+      if(typical_days[i] > 0 && day_types[day] != i) continue;
+      for(j = 0; j < (int) day_size; j++)
+        typical[j] += counts[day * day_size + j] / (typical_days[i] > 0 ? typical_days[i] : day_count);
+    }
+  }
+
+  for(day = 0; day < table_days; day++)
+    fill_rate_day((arrival_rate *) ((unsigned char *) profile->table + sizeof(arrival_profile_header) + types_size) +
+                  (size_t) day * ARRIVAL_SLOTS_PER_DAY * ARRIVAL_LANES, counts + (size_t) day * day_size);
+  free(counts);
+
+  memcpy(header->magic, ARRIVAL_PROFILE_MAGIC, 4);
+  header->version = ARRIVAL_PROFILE_VERSION;
+  header->rate_size = sizeof(arrival_rate);
+  header->lanes = ARRIVAL_LANES;
+  header->slots_per_day = ARRIVAL_SLOTS_PER_DAY;
+  header->day_count = day_count;
+  header->table_days = table_days;
+  header->types_size = types_size;
+
+  profile->header = header;
+  profile->day_types = day_types;
+  profile->rates = (const arrival_rate *) (day_types + types_size);
+  profile->day_count = day_count;
+  return 1;
+}
+
+/* Reads a line of a count file. Returns 1 for a count, -1 for a comment or
+   an empty line and 0 if the line is not understood */
+int read_count_line(char *line, int *day, int *type, int *street_index, int *lane_type, int *quarter, double *cars){
+  char day_type[16], street_name[MAX_NAME_LENGTH + 1], lane_name[16];
+  int i;
+
+  for(i = 0; line[i] == ' ' || line[i] == '\t'; i++);
+  if(line[i] == '#' || line[i] == '\n' || line[i] == '\r' || line[i] == '\0')
+    return -1;
+
+  if(sscanf(line, " %d , %15[^, ] , %20[^, ] , %15[^, ] , %d , %lf", day, day_type, street_name, lane_name, quarter, cars) != 6 ||
+     *day < 0 || *day >= MAX_PROFILE_DAYS || *quarter < 0 || *quarter >= QUARTERS_PER_DAY || *cars < 0)
+    return 0;
+
+  if(strcmp(day_type, "weekday") == 0) *type = weekday;
+  else if(strcmp(day_type, "weekend") == 0) *type = weekend;
+  else return 0;
+
+  if(sscanf(street_name, "%d", street_index) != 1)
+    *street_index = get_street_index(street_name);
+  if(*street_index < 0 || *street_index >= AMOUNT_OF_STREETS) return 0;
+
+  if(strcmp(lane_name, "left") == 0 || strcmp(lane_name, "0") == 0) *lane_type = left_lane;
+  else if(strcmp(lane_name, "straight") == 0 || strcmp(lane_name, "1") == 0) *lane_type = straight_right_lane;
+  else return 0;
+
+  return 1;
+}
+
+/* Turns the counts of a day into the rates of each of its minutes */
+void fill_rate_day(arrival_rate *rates, const double *counts){
+  int minute, i, first, second;
+  double quarter, fraction, cars_per_hour, lambda;
+
+  for(minute = 0; minute < ARRIVAL_SLOTS_PER_DAY; minute++){
+    /* Between the middles of two quarters, the first and last half quarter keep their count */
+    quarter = (minute * 60.0 + 30.0 - 450.0) / 900.0;
+    if(quarter < 0) quarter = 0;
+    first = (int) quarter;
+    second = first + 1 < QUARTERS_PER_DAY ? first + 1 : first;
+    fraction = quarter - first;
+
+    for(i = 0; i < ARRIVAL_LANES; i++){
+      cars_per_hour = 4 * (counts[first * ARRIVAL_LANES + i] * (1 - fraction) + counts[second * ARRIVAL_LANES + i] * fraction);
+      lambda = cars_per_hour / SEC_PER_HOUR * SPAWN_INTERVAL;
+      rates[minute * ARRIVAL_LANES + i].lambda = (float) lambda;
+      rates[minute * ARRIVAL_LANES + i].p_zero = (float) exp(-lambda);
+    }
+  }
+}
+
+/* Writes the compiled table, which load_arrival_profile() maps. Returns
+   true (1) on success */
+int save_arrival_profile(const arrival_profile *profile, const char *path){
+  FILE *fp = fopen(path, "wb");
+  size_t size = sizeof(arrival_profile_header) + profile->header->types_size +
+                (size_t) profile->header->table_days * ARRIVAL_SLOTS_PER_DAY * ARRIVAL_LANES * sizeof(arrival_rate);
+  int ok;
+
+  if(fp == NULL) return 0;
+  ok = fwrite(profile->header, 1, size, fp) == size;
+  if(fclose(fp) != 0) ok = 0;
+  return ok;
+}
+
+void close_arrival_profile(arrival_profile *profile){
+  unmap_file(&(profile->map));
+  free(profile->table);
+  memset(profile, 0, sizeof(arrival_profile));
+}
+
+/* Picks the day of the dataset the simulations start at, or one of the
+   typical days. Returns false (0) if there is no such day */
+int select_arrival_day(arrival_profile *profile, int day){
+  if(day >= profile->day_count || day < typical_weekend) return 0;
+  profile->first_day = day;
+  return 1;
+}
+
+/* Returns the table day of a simulated day. Replica r starts r days into
+   the dataset, so the replicas of a multi-week dataset go through its days.
+   The typical days are simulated every day */
+int get_profile_day(const arrival_profile *profile, int replica, int days_simulated){
+  if(profile->first_day < 0)
+    return profile->day_count - 1 - profile->first_day;
+  return (int) (((long) profile->first_day + replica + days_simulated) % profile->day_count);
+}
+
+/* Returns the rates of every lane, street * LANES_PER_STREET + lane type, at a time of day */
+const arrival_rate *get_arrival_rates(const arrival_profile *profile, int table_day, double current_time){
+  int minute = (int) (current_time / 60.0);
+
+  if(minute < 0) minute = 0;
+  if(minute >= ARRIVAL_SLOTS_PER_DAY) minute = ARRIVAL_SLOTS_PER_DAY - 1;
+  return profile->rates + ((size_t) table_day * ARRIVAL_SLOTS_PER_DAY + minute) * ARRIVAL_LANES;
+}
+
+/* Draws the cars that arrive in a lane in a spawn interval, at most
+   MAX_SPAWNED_CARS - 1 as get_car_spawn_count() does */
+int draw_arrivals(const arrival_rate *rate, random_stream *random){
+  double rand_num = random_uniform(random), probability = rate->p_zero, sum_probability = probability;
+  int k;
+
+  if(rand_num < sum_probability)
+    return 0;
+
+  for(k = 1; k < MAX_SPAWNED_CARS; k++){
+    probability *= rate->lambda / k;
+    sum_probability += probability;
+    if(rand_num < sum_probability)
+      return k;
+  }
+
+  return 0;
+}
+
+
+#endif /* ArrivalProfile */
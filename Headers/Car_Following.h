@@ -0,0 +1,187 @@
+#ifndef CarFollowing /* Include guard */
+#define CarFollowing
+
+/* ------------- Car following models ------------- */
+/* A car following model gives the speed of a car after a tick from its own
+   speed and the car in front of it. A single model is compiled in, chosen
+   with CAR_FOLLOWING_MODEL (for example -DCAR_FOLLOWING_MODEL=1), so the tick
+   loop calls it directly and the compiler can inline it. Every model has:
+   - get_model_free_acceleration(): the acceleration on an empty road. It is
+     tabulated over 0 - MAX_SPEED by init_car_model(), which tick() and
+     fast_forward() call, and read through get_acceleration(), so exp()
+     and sqrt() are not called per car
+   - get_following_speed(): the speed after a tick, given the free road
+     acceleration, the gap to the rear of the car in front and its speed.
+     Without a car in front the gap is NO_CAR_IN_FRONT
+   - get_blocked_speed(): the speed of a car that move_car() stops right
+     behind the car in front
+   Needs MAX_SPEED, TICK_RATE and SAFTETY_DISTANCE from Simulation.h */
+#include <math.h>
+
+#define CAR_MODEL_REPORT 0 /* The exponential acceleration used in the report */
+#define CAR_MODEL_IDM 1 /* Intelligent driver model */
+#define CAR_MODEL_GIPPS 2 /* Gipps' safe speed model */
+
+#ifndef CAR_FOLLOWING_MODEL
+#define CAR_FOLLOWING_MODEL CAR_MODEL_REPORT
+#endif
+
+#define FREE_ACCELERATION_STEPS 1400 /* Table entries over 0 - MAX_SPEED, 0.01 m/s apart */
+#define NO_CAR_IN_FRONT 1e9 /* Gap to a car in front that is not there */
+
+double get_model_free_acceleration(double speed);
+double get_following_speed(double speed, double free_acceleration, double gap, double front_speed);
+double get_blocked_speed(double front_speed);
+double clamp_speed(double speed);
+
+void init_car_model();
+void fill_car_model();
+double get_acceleration(double current_speed);
+
+/* Free road acceleration at every FREE_ACCELERATION_STEPS'th of MAX_SPEED,
+   the last entry repeats MAX_SPEED. Filled by init_car_model() */
+double free_acceleration_table[FREE_ACCELERATION_STEPS + 2];
+platform_once car_model_once = PLATFORM_ONCE_INIT;
+
+
+#if CAR_FOLLOWING_MODEL == CAR_MODEL_IDM
+/* Intelligent driver model. The car brakes harder the further it is within
+   its desired gap, which grows with its speed and the speed difference */
+#define CAR_MODEL_NAME "Intelligent driver model"
+
+/* The acceleration and headway are calibrated so that a day at the measured
+   demand has the average wait of the report model in sim_benchmark */
+#define IDM_MAX_ACCELERATION 2.5
+#define IDM_COMFORTABLE_DECELERATION 3.0
+#define IDM_TIME_HEADWAY 0.6 /* Seconds kept to the car in front */
+#define IDM_MINIMUM_GAP SAFTETY_DISTANCE /* Where move_car() stops a blocked car */
+
+double get_model_free_acceleration(double speed){
+  double ratio = speed / MAX_SPEED;
+
+  ratio *= ratio;
+  return IDM_MAX_ACCELERATION * (1 - ratio * ratio);
+}
+
+double get_following_speed(double speed, double free_acceleration, double gap, double front_speed){
+  double desired_gap, interaction;
+
+  desired_gap = IDM_MINIMUM_GAP + speed * IDM_TIME_HEADWAY + speed * (speed - front_speed) / (2 * sqrt(IDM_MAX_ACCELERATION * IDM_COMFORTABLE_DECELERATION));
+  if(desired_gap < IDM_MINIMUM_GAP) desired_gap = IDM_MINIMUM_GAP;
+  if(gap < 0.1) gap = 0.1;
+
+  interaction = desired_gap / gap;
+  return clamp_speed(speed + (free_acceleration - IDM_MAX_ACCELERATION * interaction * interaction) / TICK_RATE);
+}
+
+double get_blocked_speed(double front_speed){
+  return front_speed;
+}
+
+#elif CAR_FOLLOWING_MODEL == CAR_MODEL_GIPPS
+/* Gipps' model. The car takes the lower of its free road speed and the
+   fastest speed from which it can still stop behind the car in front, if that
+   car were to brake. The reaction time is a tick */
+#define CAR_MODEL_NAME "Gipps model"
+
+#define GIPPS_MAX_ACCELERATION 1.9625
+#define GIPPS_DECELERATION 3.0 /* Braking the driver is willing to use */
+#define GIPPS_FRONT_DECELERATION 3.5 /* Braking the driver expects from the car in front */
+#define GIPPS_MINIMUM_GAP (SAFTETY_DISTANCE + 1.0)
+
+double get_model_free_acceleration(double speed){
+  double ratio = speed / MAX_SPEED;
+
+  return 2.5 * GIPPS_MAX_ACCELERATION * (1 - ratio) * sqrt(0.025 + ratio);
+}
+
+double get_following_speed(double speed, double free_acceleration, double gap, double front_speed){
+  double reaction_time = 1.0 / TICK_RATE, free_speed, safe_speed = 0, radicand;
+
+  free_speed = speed + free_acceleration * reaction_time;
+
+  radicand = GIPPS_DECELERATION * GIPPS_DECELERATION * reaction_time * reaction_time
+             + GIPPS_DECELERATION * (2 * (gap - GIPPS_MINIMUM_GAP) - speed * reaction_time + front_speed * front_speed / GIPPS_FRONT_DECELERATION);
+  if(radicand > 0)
+    safe_speed = sqrt(radicand) - GIPPS_DECELERATION * reaction_time;
+
+  return clamp_speed(free_speed < safe_speed ? free_speed : safe_speed);
+}
+
+double get_blocked_speed(double front_speed){
+  return front_speed;
+}
+
+#else
+/* The model of the report. A car accelerates as on a free road unless it is
+   within a meter of its safety distance, and it is slowed to 80% of the
+   speed of the car in front when it is stopped right behind it */
+#define CAR_MODEL_NAME "Report model"
+
+double get_model_free_acceleration(double speed){
+  return (1.9625 * exp(0.093*(speed / 3.6)));
+}
+
+double get_following_speed(double speed, double free_acceleration, double gap, double front_speed){
+  double acceleration = 0.0;
+  (void) front_speed;
+
+  if(gap > SAFTETY_DISTANCE + 1.0)
+    acceleration = free_acceleration;
+
+  /* Match acceleration to the simulated time step */
+  acceleration /= TICK_RATE;
+
+  /* Make sure car does not accelerate above max speed */
+  if((speed + acceleration) >= MAX_SPEED){
+    acceleration = MAX_SPEED - speed;
+  }else if(speed + acceleration < 0.0){
+    acceleration = 0 - speed;
+  }
+
+  return speed + acceleration;
+}
+
+double get_blocked_speed(double front_speed){
+  return front_speed * 0.8;
+}
+#endif
+
+
+/* Keeps a speed within 0 - MAX_SPEED */
+double clamp_speed(double speed){
+  if(speed < 0) return 0;
+  if(speed > MAX_SPEED) return MAX_SPEED;
+  return speed;
+}
+
+/* Tabulates the free road acceleration of the model the first time it is
+   called, threads that call it meanwhile wait for the table */
+void init_car_model(){
+  run_once(&car_model_once, fill_car_model);
+}
+
+void fill_car_model(){
+  int i;
+
+  for(i = 0; i <= FREE_ACCELERATION_STEPS; i++)
+    free_acceleration_table[i] = get_model_free_acceleration((double) i * MAX_SPEED / FREE_ACCELERATION_STEPS);
+  free_acceleration_table[FREE_ACCELERATION_STEPS + 1] = free_acceleration_table[FREE_ACCELERATION_STEPS];
+}
+
+/* Returns the free road acceleration in m/s^2, interpolated in the table.
+   get_free_accelerations() does the same operations two cars at a time */
+double get_acceleration(double current_speed){
+  double step = current_speed * ((double) FREE_ACCELERATION_STEPS / MAX_SPEED), fraction;
+  int i;
+
+  if(step < 0) step = 0;
+  else if(step > FREE_ACCELERATION_STEPS) step = FREE_ACCELERATION_STEPS;
+
+  i = (int) step;
+  fraction = step - i;
+  return free_acceleration_table[i] + (free_acceleration_table[i + 1] - free_acceleration_table[i]) * fraction;
+}
+
+
+#endif /* CarFollowing */
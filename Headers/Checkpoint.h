@@ -0,0 +1,273 @@
+#ifndef Checkpoint /* Include guard */
+#define Checkpoint
+
+/* ------------- Checkpoints of a whole simulation ------------- */
+/* A checkpoint holds everything a run goes on from: the clock and the signal,
+   every car of every lane, the random streams and the statistics of the days
+   simulated so far. Loading it and running on gives exactly the run that
+   followed the save, so a warmed up rush hour can be started from again and
+   again without simulating the morning first. Forking the loaded simulation
+   with another stream, as the replicas of Monte_Carlo.h do, branches it into
+   different days. What is attached to a run, the graphics, traces,
+   telemetry, arrival profile and scheduled checkpoints, is not part of it.
+   A checkpoint only loads into a build with the same CAR_FOLLOWING_MODEL
+   that runs the same scenario, the header records both. The file starts with a checkpoint_header. Every lane follows with a
+   checkpoint_lane and the positions, speeds, wait times, accelerations and
+   spawn ticks of its cars from the front, one array after the other. Last
+   come the random stream of every street and the statistics of every day up
+   to days_simulated */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECKPOINT_MAGIC "TLCP"
+#define CHECKPOINT_VERSION 3
+#define MAX_CHECKPOINT_PATH 200
+
+typedef struct checkpoint_header checkpoint_header;
+typedef struct checkpoint_lane checkpoint_lane;
+
+/* What a controller does with its checkpoint file, see open_checkpoint() */
+enum checkpoint_mode{
+  checkpoint_off, checkpoint_save, checkpoint_start
+};
+
+/* First 160 bytes of every checkpoint */
+struct checkpoint_header{
+  char magic[4];
+  unsigned int version, header_size, statistics_size, random_size;
+  unsigned int lane_count, day_count, car_count; /* What follows the header */
+  unsigned int tick_count, car_model; /* CAR_FOLLOWING_MODEL of the build */
+  double current_time, time_since_change, last_spawn_time;
+  unsigned long long seed, scenario_digest; /* get_scenario_digest() of current_scenario */
+  int current_signal_state, resolved_cars, days_simulated, sim_car_count, engine, total_cars, replica, demand_factor;
+  int signal_group_cars[AMOUNT_OF_SIGNAL_DIRECTIONS], fed_streets[AMOUNT_OF_STREETS], cars_left[AMOUNT_OF_STREETS];
+};
+
+struct checkpoint_lane{
+  int amount_of_cars, was_open;
+  unsigned int first_car_number, next_departure;
+};
+
+int save_checkpoint(const simulation_state *sim_state, const char *path);
+int write_lane_field(FILE *fp, const lane *l, const void *field, size_t size);
+int load_checkpoint(simulation_state *sim_state, const char *path);
+long get_checkpoint_size(const checkpoint_header *header);
+void schedule_checkpoint(simulation_state *sim_state, double time_of_day, const char *path);
+void save_due_checkpoint(simulation_state *sim_state);
+int open_checkpoint(simulation_state *sim_state, int mode, const char *path, double time_of_day);
+
+
+/* Writes the whole simulation to path. Returns true (1) on success */
+int save_checkpoint(const simulation_state *sim_state, const char *path){
+  checkpoint_header header;
+  checkpoint_lane saved;
+  FILE *fp = fopen(path, "wb");
+  int i, j, ok;
+
+  if(fp == NULL) return 0;
+
+  /* Zeroed first, the padding is written too */
+  memset(&header, 0, sizeof(checkpoint_header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, 4);
+  header.version = CHECKPOINT_VERSION;
+  header.header_size = sizeof(checkpoint_header);
+  header.statistics_size = sizeof(statistics);
+  header.random_size = sizeof(random_stream);
+  header.lane_count = AMOUNT_OF_STREETS * LANES_PER_STREET;
+  header.day_count = sim_state->days_simulated + 1;
+  header.car_count = sim_state->total_cars;
+  header.tick_count = sim_state->tick_count;
+  header.car_model = CAR_FOLLOWING_MODEL;
+  header.scenario_digest = get_scenario_digest(&current_scenario);
+  header.current_time = sim_state->current_time;
+  header.time_since_change = sim_state->time_since_change;
+  header.last_spawn_time = sim_state->last_spawn_time;
+  header.seed = sim_state->seed;
+  header.current_signal_state = sim_state->current_signal_state;
+  header.resolved_cars = sim_state->resolved_cars;
+  header.days_simulated = sim_state->days_simulated;
+  header.sim_car_count = sim_state->sim_car_count;
+  header.engine = sim_state->engine;
+  header.total_cars = sim_state->total_cars;
+  header.replica = sim_state->replica;
+  header.demand_factor = sim_state->demand_factor;
+  for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++)
+    header.signal_group_cars[i] = sim_state->signal_group_cars[i];
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    header.fed_streets[i] = sim_state->fed_streets[i];
+    header.cars_left[i] = sim_state->cars_left[i];
+  }
+  if(header.day_count > (unsigned int) sim_state->stat_days)
+    header.day_count = sim_state->stat_days;
+
+  ok = fwrite(&header, sizeof(checkpoint_header), 1, fp) == 1;
+
+  for(i = 0; i < AMOUNT_OF_STREETS && ok; i++){
+    for(j = 0; j < LANES_PER_STREET && ok; j++){
+      const lane *l = &(sim_state->streets[i].lanes[j]);
+
+      saved.amount_of_cars = l->amount_of_cars;
+      saved.was_open = l->was_open;
+      saved.first_car_number = l->first_car_number;
+      saved.next_departure = l->next_departure;
+
+      ok = fwrite(&saved, sizeof(checkpoint_lane), 1, fp) == 1 &&
+           write_lane_field(fp, l, l->position, sizeof(double)) &&
+           write_lane_field(fp, l, l->speed, sizeof(double)) &&
+           write_lane_field(fp, l, l->wait_time, sizeof(double)) &&
+           write_lane_field(fp, l, l->acceleration, sizeof(double)) &&
+           write_lane_field(fp, l, l->spawn_tick, sizeof(int));
+    }
+  }
+
+  ok = ok && fwrite(sim_state->spawn_random, sizeof(random_stream), AMOUNT_OF_STREETS, fp) == AMOUNT_OF_STREETS;
+  ok = ok && fwrite(sim_state->stats, sizeof(statistics), header.day_count, fp) == header.day_count;
+
+  if(fclose(fp) != 0) ok = 0;
+  return ok;
+}
+
+/* Writes one field of the cars of a lane from the front car back, the ring
+   takes at most two writes. Returns true (1) on success */
+int write_lane_field(FILE *fp, const lane *l, const void *field, size_t size){
+  int count = l->amount_of_cars, first = l->capacity - l->index_front_car;
+
+  if(count == 0) return 1;
+  if(first > count) first = count;
+
+  if((int) fwrite((const char *) field + l->index_front_car * size, size, first, fp) != first)
+    return 0;
+  return count == first || (int) fwrite(field, size, count - first, fp) == count - first;
+}
+
+/* Loads a checkpoint into a simulation made by make_simulation_state() or
+   taken from a simulation_pool, which keeps its graphics settings and what
+   is attached to it. The lanes grow to hold the cars of the checkpoint.
+   Returns false (0) if the file is no checkpoint of this version, car model
+   and scenario, which leaves the simulation as it was, or if memory runs out, which
+   leaves it to be reset */
+int load_checkpoint(simulation_state *sim_state, const char *path){
+  checkpoint_header header;
+  checkpoint_lane saved;
+  FILE *fp = fopen(path, "rb");
+  long size;
+  int i, j, day, ok = 1;
+
+  if(fp == NULL) return 0;
+
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  if(fread(&header, sizeof(checkpoint_header), 1, fp) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, 4) != 0 ||
+     header.version != CHECKPOINT_VERSION || header.header_size != sizeof(checkpoint_header) ||
+     header.statistics_size != sizeof(statistics) || header.random_size != sizeof(random_stream) ||
+     header.lane_count != AMOUNT_OF_STREETS * LANES_PER_STREET || header.car_model != CAR_FOLLOWING_MODEL ||
+     header.scenario_digest != get_scenario_digest(&current_scenario) || header.day_count < 1 ||
+     header.day_count > (unsigned int) sim_state->stat_days || size != get_checkpoint_size(&header) ||
+     header.current_signal_state < 0 || header.current_signal_state >= current_scenario.phase_count){
+    fclose(fp);
+    return 0;
+  }
+
+  for(i = 0; i < AMOUNT_OF_STREETS && ok; i++){
+    for(j = 0; j < LANES_PER_STREET && ok; j++){
+      lane *l = &(sim_state->streets[i].lanes[j]);
+      int count;
+
+      ok = fread(&saved, sizeof(checkpoint_lane), 1, fp) == 1 && saved.amount_of_cars >= 0 && reserve_lane(l, saved.amount_of_cars);
+      if(!ok) break;
+
+      /* The cars are stored from the front */
+      count = saved.amount_of_cars;
+      ok = (int) fread(l->position, sizeof(double), count, fp) == count &&
+           (int) fread(l->speed, sizeof(double), count, fp) == count &&
+           (int) fread(l->wait_time, sizeof(double), count, fp) == count &&
+           (int) fread(l->acceleration, sizeof(double), count, fp) == count &&
+           (int) fread(l->spawn_tick, sizeof(int), count, fp) == count;
+
+      l->index_front_car = 0;
+      l->amount_of_cars = count;
+      l->was_open = saved.was_open;
+      l->first_car_number = saved.first_car_number;
+      l->next_departure = saved.next_departure;
+    }
+  }
+
+  /* Days the simulation was used for beyond the checkpoint are cleared */
+  for(day = header.day_count; day <= sim_state->days_simulated && day < sim_state->stat_days; day++)
+    init_statistics(&(sim_state->stats[day]));
+
+  ok = ok && fread(sim_state->spawn_random, sizeof(random_stream), AMOUNT_OF_STREETS, fp) == AMOUNT_OF_STREETS;
+  ok = ok && fread(sim_state->stats, sizeof(statistics), header.day_count, fp) == header.day_count;
+  fclose(fp);
+  if(!ok) return 0;
+
+  sim_state->tick_count = header.tick_count;
+  sim_state->current_time = header.current_time;
+  sim_state->time_since_change = header.time_since_change;
+  sim_state->last_spawn_time = header.last_spawn_time;
+  sim_state->seed = header.seed;
+  sim_state->current_signal_state = header.current_signal_state;
+  sim_state->resolved_cars = header.resolved_cars;
+  sim_state->days_simulated = header.days_simulated;
+  sim_state->sim_car_count = header.sim_car_count;
+  sim_state->engine = header.engine;
+  sim_state->total_cars = header.total_cars;
+  sim_state->replica = header.replica;
+  sim_state->demand_factor = header.demand_factor;
+  for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++)
+    sim_state->signal_group_cars[i] = header.signal_group_cars[i];
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    sim_state->fed_streets[i] = header.fed_streets[i];
+    sim_state->cars_left[i] = header.cars_left[i];
+  }
+
+  return 1;
+}
+
+/* Returns the size in bytes of the checkpoint the header starts */
+long get_checkpoint_size(const checkpoint_header *header){
+  return (long) sizeof(checkpoint_header) + (long) header->lane_count * sizeof(checkpoint_lane) +
+         (long) header->car_count * (4 * sizeof(double) + sizeof(int)) + AMOUNT_OF_STREETS * (long) sizeof(random_stream) +
+         (long) header->day_count * sizeof(statistics);
+}
+
+/* Saves a checkpoint to path at the first step of update_simulation() that
+   starts at or after time_of_day, which is up to a day ahead */
+void schedule_checkpoint(simulation_state *sim_state, double time_of_day, const char *path){
+  double seconds = time_of_day - sim_state->current_time;
+
+  if(seconds < 0) seconds += 3600.0 * 24.0;
+  sim_state->checkpoint_tick = sim_state->tick_count + (unsigned int) (seconds * TICK_RATE + 0.5);
+  sim_state->checkpoint_path = path;
+}
+
+/* Saves the scheduled checkpoint once its tick has come */
+void save_due_checkpoint(simulation_state *sim_state){
+  int sim_seconds = (int) (sim_state->current_time + 0.5);
+
+  if(sim_state->checkpoint_path == NULL || sim_state->tick_count < sim_state->checkpoint_tick)
+    return;
+
+  if(!save_checkpoint(sim_state, sim_state->checkpoint_path))
+    printf("\nUnable to save the checkpoint %s\n", sim_state->checkpoint_path);
+  else if(!sim_state->quiet)
+    printf("\nCheckpoint saved to %s at %02d:%02d:%02d\n", sim_state->checkpoint_path, sim_seconds / 3600, (sim_seconds / 60) % 60, sim_seconds % 60);
+
+  sim_state->checkpoint_path = NULL;
+}
+
+/* Schedules a checkpoint at time_of_day (checkpoint_save) or loads one
+   (checkpoint_start) for a controller. Returns true (1) on success */
+int open_checkpoint(simulation_state *sim_state, int mode, const char *path, double time_of_day){
+  if(mode == checkpoint_save)
+    schedule_checkpoint(sim_state, time_of_day, path);
+  else if(mode == checkpoint_start)
+    return load_checkpoint(sim_state, path);
+  return 1;
+}
+
+
+#endif /* Checkpoint */
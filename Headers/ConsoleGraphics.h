@@ -38,15 +38,15 @@ void draw_square(int x, int y, int width, int height, char c);
 void draw_dotted_square(int x, int y, int width, int height, char c);
 void draw_line(int x, int y, int length, int dir, int dotted);
 
-void draw_car(char *road_name, double position, int lane);
+void draw_car(int street_index, double position, int lane);
 void draw_car_shape(int x, int y, int facing_dir);
-void draw_car_counts(street *streets);
+void draw_car_counts(const street *streets);
 void insert_number(int number, int x, int y, int offset);
 
-void print_pixels(simulation_state sim_state);
+void print_pixels(const simulation_state *sim_state);
 void print_colored_pixels(char *string, const char *color, int x1, int x2, int str_len);
 void print_colored_line(char *string, const char *color1, int x1, int x2, const char *color2, int x3, int x4);
-const char *get_lane_color_code(int current_signal, lane l);
+const char *get_lane_color_code(int current_signal, const lane *l);
 
 void clear_console();
 
@@ -127,21 +127,21 @@ void draw_line(int x, int y, int length, int dir, int dotted){
 }
 
 
-/* Draw a car given its position and lane */
-void draw_car(char *road_name, double position, int lane){
+/* Draw a car given its position and lane, the streets are drawn clockwise from the north */
+void draw_car(int street_index, double position, int lane){
   int distance = (int) (position / METERS_PER_PIXEL);
   int lane_offset = 2 + ((lane == left_lane) ? LANE_WIDTH : 0);
 
-  if(strcmp(road_name, street_names[0]) == 0)
+  if(street_index == 0)
   draw_car_shape(LANE_LENGTH + lane_offset, LANE_LENGTH - distance, south);
 
-  else if(strcmp(road_name, street_names[1]) == 0)
+  else if(street_index == 1)
   draw_car_shape(LANE_LENGTH + (LANE_COUNT * LANE_WIDTH) + distance + 1, LANE_LENGTH + lane_offset, west);
 
-  else if(strcmp(road_name, street_names[2]) == 0)
+  else if(street_index == 2)
   draw_car_shape(LANE_LENGTH + (4 * LANE_WIDTH) - lane_offset - 1, LANE_LENGTH + (LANE_COUNT * LANE_WIDTH) + distance + 1, north);
 
-  else if(strcmp(road_name, street_names[3]) == 0)
+  else if(street_index == 3)
   draw_car_shape(LANE_LENGTH - distance, LANE_LENGTH + (4 * LANE_WIDTH) - lane_offset - 1, east);
 
 }
@@ -165,7 +165,7 @@ void draw_car_shape(int x, int y, int facing_dir){
 }
 
 /* Inserts number of cars next to each lane */
-void draw_car_counts(street *streets){
+void draw_car_counts(const street *streets){
   insert_number(streets[0].lanes[straight_right_lane].amount_of_cars, LANE_LENGTH - 4, 0, 0);
   insert_number(streets[0].lanes[left_lane].amount_of_cars, LANE_LENGTH + 2 * LANE_WIDTH + 1, 0, 1);
 
@@ -194,35 +194,35 @@ void insert_number(int number, int x, int y, int offset){
 
 
 /* Prints the array of pixels with colored stop lines indicating signal colors */
-void print_pixels(simulation_state sim_state){
+void print_pixels(const simulation_state *sim_state){
   int i;
   const char *col1, *col2;
   for(i = 0; i < SCREEN_HEIGHT; i++){
     /* Print lines with colors according to current signal color */
     if(i == LANE_LENGTH){
       /* North stop lines */
-      col1 = get_lane_color_code(sim_state.current_signal_state, sim_state.streets[0].lanes[1]);
-      col2 = get_lane_color_code(sim_state.current_signal_state, sim_state.streets[0].lanes[0]);
+      col1 = get_lane_color_code(sim_state->current_signal_state, &(sim_state->streets[0].lanes[1]));
+      col2 = get_lane_color_code(sim_state->current_signal_state, &(sim_state->streets[0].lanes[0]));
       print_colored_line(pixels[i], col1, LANE_LENGTH, LANE_LENGTH + LANE_WIDTH, col2, LANE_LENGTH + LANE_WIDTH, LANE_LENGTH + 2 * LANE_WIDTH);
 
     }else if(i > LANE_LENGTH && i < LANE_LENGTH + 2 * LANE_WIDTH){
       /* East stop lines */
       int lane_num = (((i - LANE_LENGTH) / LANE_WIDTH) + 1) % 2;
-      col1 = get_lane_color_code(sim_state.current_signal_state, sim_state.streets[1].lanes[lane_num]);
+      col1 = get_lane_color_code(sim_state->current_signal_state, &(sim_state->streets[1].lanes[lane_num]));
       print_colored_pixels(pixels[i], col1, LANE_LENGTH + 4 * LANE_WIDTH, LANE_LENGTH + 4 * LANE_WIDTH + 1, SCREEN_WIDTH);
       printf("\n");
 
     }else if(i > LANE_LENGTH + 2 * LANE_WIDTH && i < LANE_LENGTH + 4 * LANE_WIDTH){
       /* West stop lines */
       int lane_num = (i - (LANE_LENGTH + LANE_WIDTH * 2)) / LANE_WIDTH;
-      col1 = get_lane_color_code(sim_state.current_signal_state, sim_state.streets[3].lanes[lane_num]);
+      col1 = get_lane_color_code(sim_state->current_signal_state, &(sim_state->streets[3].lanes[lane_num]));
       print_colored_pixels(pixels[i], col1, LANE_LENGTH, LANE_LENGTH + 1, SCREEN_WIDTH);
       printf("\n");
 
     }else if(i == LANE_LENGTH + LANE_WIDTH * 4){
       /* South stop lines */
-      col1 = get_lane_color_code(sim_state.current_signal_state, sim_state.streets[2].lanes[0]);
-      col2 = get_lane_color_code(sim_state.current_signal_state, sim_state.streets[2].lanes[1]);
+      col1 = get_lane_color_code(sim_state->current_signal_state, &(sim_state->streets[2].lanes[0]));
+      col2 = get_lane_color_code(sim_state->current_signal_state, &(sim_state->streets[2].lanes[1]));
       print_colored_line(pixels[i], col1, LANE_LENGTH + 2 * LANE_WIDTH, LANE_LENGTH + 3 * LANE_WIDTH, col2, LANE_LENGTH + 3 * LANE_WIDTH, LANE_LENGTH + 4 * LANE_WIDTH);
 
     }else{
@@ -245,8 +245,8 @@ void print_colored_line(char *string, const char *color1, int x1, int x2, const
 }
 
 /* Returns a color code corresponding to the current signal color in a given lane */
-const char *get_lane_color_code(int current_signal, lane l){
-  return signal_color_code[get_signal_color(current_signal, l.lane_direction)];
+const char *get_lane_color_code(int current_signal, const lane *l){
+  return signal_color_code[get_signal_color(current_signal, l->lane_direction)];
 }
 
 
@@ -0,0 +1,299 @@
+#ifndef ControllerLink /* Include guard */
+#define ControllerLink
+
+/* ------------- A controller in another process over shared memory ------------- */
+/* The simulator makes a named shared memory segment, and a controller
+   process on the same machine maps it by that name. At every decision the
+   simulator pushes a link_request with what the controller can observe into
+   one ring, and the controller answers with a link_response holding the
+   signal command in the other. Each ring has one writer and one reader and
+   neither takes a lock, the writer publishes how many entries it pushed
+   (head) and the reader how many it took (tail), as in Telemetry.h.
+
+   In lockstep the simulator waits for the answer to every request before it
+   simulates on, so the controller can take as long as it likes. In real
+   time the simulator keeps to the wall clock: an answer is applied at the
+   first decision after it arrived and a controller that is late keeps the
+   signal as it is. Every round trip is timed by the simulator.
+
+   The segment starts with a link_header, so a controller built from another
+   version of this file refuses to attach */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Simulation_Constants.h"
+#include "Platform.h"
+
+#define LINK_MAGIC "TLCL"
+#define LINK_VERSION 1
+#define LINK_RING_SIZE 64 /* Entries of each ring, a power of two */
+#define LINK_CACHE_LINE 64
+#define LINK_SPINS 1000 /* Polls before a waiting side starts to yield */
+#define LINK_YIELDS 10000 /* Yields before it starts to sleep */
+#define LINK_HISTOGRAM_BUCKETS 24 /* Powers of two of microseconds */
+#define DEFAULT_LINK_NAME "traffic_link"
+#define MAX_LINK_NAME 64
+
+typedef struct link_header link_header;
+typedef struct link_request link_request;
+typedef struct link_response link_response;
+typedef struct controller_link controller_link;
+typedef struct link_endpoint link_endpoint;
+typedef struct latency_histogram latency_histogram;
+
+enum link_mode{
+  link_lockstep, link_real_time
+};
+
+/* First 32 bytes of the segment */
+struct link_header{
+  char magic[4];
+  unsigned int version, request_size, response_size, ring_size;
+  int mode;
+  double decision_interval; /* Simulated seconds between two requests */
+};
+
+/* What the controller sees at a decision (80 bytes) */
+struct link_request{
+  unsigned int sequence; /* Counts the requests from 0 */
+  unsigned int tick; /* tick_count of the simulation */
+  double time_of_day, time_since_change;
+  int signal_state;
+  int lane_cars[AMOUNT_OF_STREETS * LANES_PER_STREET]; /* Indexed street * LANES_PER_STREET + lane type */
+  int signal_group_cars[AMOUNT_OF_SIGNAL_DIRECTIONS];
+  int last_request; /* The simulation ends after this one */
+};
+
+/* The answer to a request (8 bytes) */
+struct link_response{
+  unsigned int sequence; /* Of the request it answers */
+  int new_signal; /* 0 keeps the signal, 1 changes it as update_simulation() does */
+};
+
+/* A ring of each kind and the counters, laid out in the segment */
+struct controller_link{
+  link_header header;
+  volatile long simulator_ready, controller_attached, stopping;
+  char header_padding[LINK_CACHE_LINE];
+
+  volatile long request_head; /* Written by the simulator */
+  char request_head_padding[LINK_CACHE_LINE];
+  volatile long request_tail; /* Written by the controller */
+  char request_tail_padding[LINK_CACHE_LINE];
+  volatile long response_head; /* Written by the controller */
+  char response_head_padding[LINK_CACHE_LINE];
+  volatile long response_tail; /* Written by the simulator */
+  char response_tail_padding[LINK_CACHE_LINE];
+
+  link_request requests[LINK_RING_SIZE];
+  link_response responses[LINK_RING_SIZE];
+};
+
+/* One side of the link in one process */
+struct link_endpoint{
+  mapped_file map;
+  controller_link *link;
+  char name[MAX_LINK_NAME];
+  int owner; /* The simulator made the segment and removes it */
+};
+
+struct latency_histogram{
+  long counts[LINK_HISTOGRAM_BUCKETS]; /* Bucket b holds the round trips from 2^(b-1) up to 2^b microseconds, the last one the rest */
+  long samples;
+  double total, max; /* Seconds */
+};
+
+int create_controller_link(link_endpoint *endpoint, const char *name, int mode, double decision_interval);
+int attach_controller_link(link_endpoint *endpoint, const char *name);
+void close_controller_link(link_endpoint *endpoint);
+
+int push_link_request(controller_link *link, const link_request *request);
+int pop_link_request(controller_link *link, link_request *request);
+int push_link_response(controller_link *link, const link_response *response);
+int pop_link_response(controller_link *link, link_response *response);
+void back_off(int *polls);
+
+void make_link_request(link_request *request, const simulation_state *sim_state, unsigned int sequence, int last_request);
+void add_latency(latency_histogram *histogram, double seconds);
+void print_latency_histogram(const latency_histogram *histogram);
+
+
+/* Makes the segment as the simulator. Returns true (1) on success */
+int create_controller_link(link_endpoint *endpoint, const char *name, int mode, double decision_interval){
+  controller_link *link;
+
+  memset(endpoint, 0, sizeof(link_endpoint));
+  sprintf(endpoint->name, "%.*s", MAX_LINK_NAME - 1, name);
+  if(!map_shared_memory(&(endpoint->map), endpoint->name, sizeof(controller_link), 1))
+    return 0;
+
+  link = (controller_link *) endpoint->map.data;
+  memset(link, 0, sizeof(controller_link));
+  link->header.version = LINK_VERSION;
+  link->header.request_size = sizeof(link_request);
+  link->header.response_size = sizeof(link_response);
+  link->header.ring_size = LINK_RING_SIZE;
+  link->header.mode = mode;
+  link->header.decision_interval = decision_interval;
+  memcpy(link->header.magic, LINK_MAGIC, 4);
+
+  /* A controller only reads the header once it is complete */
+  store_release(&(link->simulator_ready), 1);
+
+  endpoint->link = link;
+  endpoint->owner = 1;
+  return 1;
+}
+
+/* Maps the segment of a running simulator as the controller. Returns
+   false (0) if there is none yet or it was made by another version */
+int attach_controller_link(link_endpoint *endpoint, const char *name){
+  controller_link *link;
+
+  memset(endpoint, 0, sizeof(link_endpoint));
+  sprintf(endpoint->name, "%.*s", MAX_LINK_NAME - 1, name);
+  if(!map_shared_memory(&(endpoint->map), endpoint->name, sizeof(controller_link), 0))
+    return 0;
+
+  link = (controller_link *) endpoint->map.data;
+  if(!load_acquire(&(link->simulator_ready)) || memcmp(link->header.magic, LINK_MAGIC, 4) != 0 || link->header.version != LINK_VERSION ||
+     link->header.request_size != sizeof(link_request) || link->header.response_size != sizeof(link_response) ||
+     link->header.ring_size != LINK_RING_SIZE){
+    unmap_file(&(endpoint->map));
+    return 0;
+  }
+
+  endpoint->link = link;
+  store_release(&(link->controller_attached), 1);
+  return 1;
+}
+
+/* The simulator tells the controller to stop before it lets go of the segment */
+void close_controller_link(link_endpoint *endpoint){
+  if(endpoint->link == NULL) return;
+
+  if(endpoint->owner){
+    store_release(&(endpoint->link->stopping), 1);
+    remove_shared_memory(endpoint->name);
+  }
+  unmap_file(&(endpoint->map));
+  endpoint->link = NULL;
+}
+
+/* Returns false (0) if the ring is full. Only called by the simulator */
+int push_link_request(controller_link *link, const link_request *request){
+  long head = link->request_head;
+
+  if(head - load_acquire(&(link->request_tail)) >= LINK_RING_SIZE) return 0;
+  link->requests[head & (LINK_RING_SIZE - 1)] = *request;
+  store_release(&(link->request_head), head + 1);
+  return 1;
+}
+
+/* Returns false (0) if there is no request. Only called by the controller */
+int pop_link_request(controller_link *link, link_request *request){
+  long tail = link->request_tail;
+
+  if(load_acquire(&(link->request_head)) == tail) return 0;
+  *request = link->requests[tail & (LINK_RING_SIZE - 1)];
+  store_release(&(link->request_tail), tail + 1);
+  return 1;
+}
+
+/* Returns false (0) if the ring is full. Only called by the controller */
+int push_link_response(controller_link *link, const link_response *response){
+  long head = link->response_head;
+
+  if(head - load_acquire(&(link->response_tail)) >= LINK_RING_SIZE) return 0;
+  link->responses[head & (LINK_RING_SIZE - 1)] = *response;
+  store_release(&(link->response_head), head + 1);
+  return 1;
+}
+
+/* Returns false (0) if there is no response. Only called by the simulator */
+int pop_link_response(controller_link *link, link_response *response){
+  long tail = link->response_tail;
+
+  if(load_acquire(&(link->response_head)) == tail) return 0;
+  *response = link->responses[tail & (LINK_RING_SIZE - 1)];
+  store_release(&(link->response_tail), tail + 1);
+  return 1;
+}
+
+/* Waits a little longer every time a side polls in vain: it spins first,
+   so a quick answer is seen at once, then yields and then sleeps */
+void back_off(int *polls){
+  if(*polls < LINK_SPINS){
+    (*polls)++;
+  }else if(*polls < LINK_SPINS + LINK_YIELDS){
+    (*polls)++;
+    yield_thread();
+  }else{
+    sleep_milliseconds(1);
+  }
+}
+
+/* Fills in a request with the observable part of the simulation */
+void make_link_request(link_request *request, const simulation_state *sim_state, unsigned int sequence, int last_request){
+  int i, j;
+
+  memset(request, 0, sizeof(link_request));
+  request->sequence = sequence;
+  request->tick = sim_state->tick_count;
+  request->time_of_day = sim_state->current_time;
+  request->time_since_change = sim_state->time_since_change;
+  request->signal_state = sim_state->current_signal_state;
+  request->last_request = last_request;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    for(j = 0; j < LANES_PER_STREET; j++)
+      request->lane_cars[i * LANES_PER_STREET + j] = sim_state->streets[i].lanes[j].amount_of_cars;
+  for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++)
+    request->signal_group_cars[i] = sim_state->signal_group_cars[i];
+}
+
+void add_latency(latency_histogram *histogram, double seconds){
+  double microseconds = seconds * 1e6;
+  int bucket = 0;
+
+  while(bucket < LINK_HISTOGRAM_BUCKETS - 1 && microseconds >= (double) (1L << bucket))
+    bucket++;
+
+  histogram->counts[bucket]++;
+  histogram->samples++;
+  histogram->total += seconds;
+  if(seconds > histogram->max)
+    histogram->max = seconds;
+}
+
+/* Prints the buckets from the first to the last one that is used */
+void print_latency_histogram(const latency_histogram *histogram){
+  int i, first = -1, last = -1, bar;
+  long most = 0;
+
+  printf("\n--------------- Round trips ---------------\n");
+  printf("Round trips           : %ld\n", histogram->samples);
+  if(histogram->samples == 0) return;
+
+  printf("Latency mean / max    : %0.1f / %0.1f us\n", 1e6 * histogram->total / histogram->samples, 1e6 * histogram->max);
+  for(i = 0; i < LINK_HISTOGRAM_BUCKETS; i++){
+    if(histogram->counts[i] == 0) continue;
+    if(first < 0) first = i;
+    last = i;
+    if(histogram->counts[i] > most) most = histogram->counts[i];
+  }
+
+  for(i = first; i <= last; i++){
+    if(i == LINK_HISTOGRAM_BUCKETS - 1)
+      printf(">= %8ld us : %8ld ", 1L << (i - 1), histogram->counts[i]);
+    else
+      printf(" < %8ld us : %8ld ", 1L << i, histogram->counts[i]);
+    for(bar = 0; bar < (int) (40 * histogram->counts[i] / most); bar++)
+      printf("#");
+    printf("\n");
+  }
+}
+
+
+#endif /* ControllerLink */
@@ -0,0 +1,156 @@
+#ifndef ExperienceDataset /* Include guard */
+#define ExperienceDataset
+
+/* ----------- Append-only binary storage of simulated transitions ----------- */
+/* A dataset is a directory of shard files (shard_000.bin, shard_001.bin ...).
+   Every shard starts with an experience_header followed by fixed size
+   experience_records. Each writer owns a single shard, so several simulations
+   can record at once. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Simulation_Constants.h"
+#include "Platform.h"
+
+#define EXPERIENCE_MAGIC "TLXP"
+#define EXPERIENCE_VERSION 1
+#define MAX_EXPERIENCE_SHARDS 256
+#define EXPERIENCE_LANES (AMOUNT_OF_STREETS * LANES_PER_STREET)
+#define MAX_EXPERIENCE_PATH 200
+
+typedef struct experience_header experience_header;
+typedef struct experience_observation experience_observation;
+typedef struct experience_record experience_record;
+typedef struct experience_writer experience_writer;
+
+/* First 32 bytes of every shard */
+struct experience_header{
+  char magic[4];
+  unsigned int version, record_size, shard_id, reserved[4];
+};
+
+/* What a controller can observe in the intersection (24 bytes) */
+struct experience_observation{
+  unsigned short lane_cars[EXPERIENCE_LANES]; /* Cars in each lane, indexed street * LANES_PER_STREET + lane type */
+  unsigned char signal_state;
+  unsigned char reserved[3];
+  float time_since_change;
+};
+
+/* A single transition (64 bytes) */
+struct experience_record{
+  experience_observation state, next_state;
+  float reward;
+  float time_of_day; /* Seconds past 00:00:00 when the action was taken */
+  unsigned int day; /* Simulated day the transition belongs to */
+  unsigned char action;
+  unsigned char reserved[3];
+};
+
+struct experience_writer{
+  FILE *fp;
+  long records_written;
+};
+
+void set_shard_file_name(char *file_name, const char *directory, int shard_id);
+void make_experience_observation(experience_observation *observation, const simulation_state *sim_state);
+
+int open_experience_writer(experience_writer *writer, const char *directory, int shard_id);
+int append_experience(experience_writer *writer, const experience_record *record);
+void close_experience_writer(experience_writer *writer);
+
+
+/* Combines directory and shard id to the path of a shard */
+void set_shard_file_name(char *file_name, const char *directory, int shard_id){
+  sprintf(file_name, "%s" PATH_SEPARATOR "shard_%03d.bin", directory, shard_id);
+}
+
+/* Copies the observable part of a simulation into an observation */
+void make_experience_observation(experience_observation *observation, const simulation_state *sim_state){
+  int i, j, cars;
+  memset(observation, 0, sizeof(experience_observation));
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      cars = sim_state->streets[i].lanes[j].amount_of_cars;
+      observation->lane_cars[i * LANES_PER_STREET + j] = (unsigned short) (cars > 0xFFFF ? 0xFFFF : cars);
+    }
+  }
+
+  observation->signal_state = (unsigned char) sim_state->current_signal_state;
+  observation->time_since_change = (float) sim_state->time_since_change;
+}
+
+/* Opens (or creates) a shard for appending. Writing goes on after the last
+   complete record, so a record cut off by a crash is overwritten instead of
+   shifting every record after it. Returns true (1) on success */
+int open_experience_writer(experience_writer *writer, const char *directory, int shard_id){
+  char file_name[MAX_EXPERIENCE_PATH];
+  experience_header header;
+  long size;
+
+  writer->fp = NULL;
+  writer->records_written = 0;
+
+  if(shard_id < 0 || shard_id >= MAX_EXPERIENCE_SHARDS || !make_directory(directory))
+    return 0;
+
+  set_shard_file_name(file_name, directory, shard_id);
+  writer->fp = fopen(file_name, "rb+");
+  if(writer->fp == NULL)
+    writer->fp = fopen(file_name, "wb+");
+  if(writer->fp == NULL) return 0;
+
+  fseek(writer->fp, 0, SEEK_END);
+  size = ftell(writer->fp);
+
+  if(size == 0){
+    /* New shard, write the header */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EXPERIENCE_MAGIC, 4);
+    header.version = EXPERIENCE_VERSION;
+    header.record_size = sizeof(experience_record);
+    header.shard_id = shard_id;
+    if(fwrite(&header, sizeof(header), 1, writer->fp) != 1){
+      fclose(writer->fp);
+      writer->fp = NULL;
+      return 0;
+    }
+
+  }else{
+    /* Existing shard, make sure the records have the same layout */
+    fseek(writer->fp, 0, SEEK_SET);
+    if(fread(&header, sizeof(header), 1, writer->fp) != 1 || memcmp(header.magic, EXPERIENCE_MAGIC, 4) != 0 ||
+       header.version != EXPERIENCE_VERSION || header.record_size != sizeof(experience_record)){
+      fclose(writer->fp);
+      writer->fp = NULL;
+      return 0;
+    }
+
+    /* A partial record at the end is less than a record long, so the next
+       record covers it */
+    size = (size - (long) sizeof(header)) / (long) sizeof(experience_record);
+    fseek(writer->fp, (long) sizeof(header) + size * (long) sizeof(experience_record), SEEK_SET);
+  }
+
+  return 1;
+}
+
+/* Appends a record to the end of the shard. Returns false (0) if the record
+   could not be written */
+int append_experience(experience_writer *writer, const experience_record *record){
+  if(writer->fp == NULL || fwrite(record, sizeof(experience_record), 1, writer->fp) != 1)
+    return 0;
+  writer->records_written++;
+  return 1;
+}
+
+void close_experience_writer(experience_writer *writer){
+  if(writer->fp != NULL)
+    fclose(writer->fp);
+  writer->fp = NULL;
+}
+
+
+#endif /* ExperienceDataset */
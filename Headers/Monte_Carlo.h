@@ -0,0 +1,275 @@
+#ifndef MonteCarlo /* Include guard */
+#define MonteCarlo
+
+/* ------------- Independent replica days of a controller ------------- */
+/* A single simulated day is one draw of the traffic, so its average wait
+   time says little about how two controllers compare. Replica r is a day
+   with its own random streams (seed, r), replica 0 is the day the controllers
+   simulate on their own. Replicas run on all processors and are summarised
+   as means with 95% confidence intervals.
+
+   With a target width the runner stops at the first replica count whose
+   interval on the average wait time is narrow enough. Only the first n
+   replicas in replica order are counted, so the result does not depend on
+   the amount of threads or on which replica finished first. A branch that
+   runs out of memory is not simulated and only the replicas before it are
+   counted.
+
+   Every thread takes a simulation from a pool and resets it for each of its
+   replicas, so a replica allocates nothing once the lanes have grown.
+   Given a start state, such as a loaded checkpoint, every replica is a fork
+   of it instead and runs from its time of day to midnight. Given an arrival
+   profile, replica r takes its arrivals from the day r days after the first
+   day of the profile, or after the day of the start state. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Simulation.h"
+#include "Simulation_Pool.h"
+#include "Platform.h"
+
+#define MIN_ADAPTIVE_REPLICAS 5 /* Replicas run before the interval width is trusted */
+#define REPLICA_STAT_DAYS 2 /* A replica ends on the first tick of its day 1 */
+
+typedef struct replica_result replica_result;
+typedef struct confidence_interval confidence_interval;
+typedef struct monte_carlo_summary monte_carlo_summary;
+typedef struct monte_carlo_run monte_carlo_run;
+
+/* Runs a simulation until days_simulated reaches 1 */
+typedef void (*day_controller)(simulation_state *sim_state, void *context);
+
+struct replica_result{
+  double avg_wait_time, max_wait_time;
+  int cars_passed, max_queue_length;
+};
+
+struct confidence_interval{
+  double mean, half_width; /* The 95% interval is mean +- half_width */
+};
+
+struct monte_carlo_summary{
+  int replicas, replicas_run, threads;
+  double wall_time, replicas_per_second, target_width;
+  confidence_interval avg_wait_time, max_wait_time, cars_passed, max_queue_length;
+};
+
+struct monte_carlo_run{
+  day_controller controller;
+  void *context;
+  const simulation_state *start_state; /* Forked by every replica when set */
+  const arrival_profile *arrivals; /* Replaces the spawn tables of every replica when set */
+  double start_time, target_width;
+  int max_replicas, replicas_done, counted;
+  replica_result *results;
+  char *finished;
+  platform_mutex lock;
+  simulation_pool pool; /* A simulation for every thread */
+};
+
+int run_monte_carlo(monte_carlo_summary *summary, day_controller controller, void *context, double start_time, const simulation_state *start_state, const arrival_profile *arrivals, int max_replicas, double target_width, int threads);
+int run_replica(void *context, int replica);
+int is_interval_narrow(const monte_carlo_run *run, int count);
+
+confidence_interval get_confidence_interval(const double *values, int count);
+double student_t_95(int degrees_of_freedom);
+void print_monte_carlo_summary(const monte_carlo_summary *summary);
+
+
+/* Runs up to max_replicas replica days of a controller starting at start_time,
+   or branching from start_state if it is not NULL, with the arrivals of an
+   arrival profile if it is not NULL. A target_width above 0
+   stops early once the 95% interval on the average wait time is at most that
+   wide. Returns the amount of replicas counted */
+int run_monte_carlo(monte_carlo_summary *summary, day_controller controller, void *context, double start_time, const simulation_state *start_state, const arrival_profile *arrivals, int max_replicas, double target_width, int threads){
+  monte_carlo_run run;
+  double *values, start;
+  int i;
+
+  memset(summary, 0, sizeof(monte_carlo_summary));
+  if(max_replicas < 1) return 0;
+
+  run.controller = controller;
+  run.context = context;
+  run.start_time = start_time;
+  run.start_state = start_state;
+  run.arrivals = arrivals;
+  run.target_width = target_width;
+  run.max_replicas = max_replicas;
+  run.replicas_done = 0;
+  run.counted = max_replicas;
+  run.results = (replica_result *) calloc(max_replicas, sizeof(replica_result));
+  run.finished = (char *) calloc(max_replicas, sizeof(char));
+  values = (double *) calloc(max_replicas, sizeof(double));
+  if(run.results == NULL || run.finished == NULL || values == NULL){
+    free(run.results);
+    free(run.finished);
+    free(values);
+    return 0;
+  }
+  init_mutex(&run.lock);
+
+  if(threads <= 0) threads = processor_count();
+  if(!make_simulation_pool(&run.pool, threads, REPLICA_STAT_DAYS)){
+    destroy_mutex(&run.lock);
+    free(run.results);
+    free(run.finished);
+    free(values);
+    return 0;
+  }
+
+  start = wall_time();
+  summary->replicas_run = run_parallel_tasks(run_replica, &run, max_replicas, threads);
+  summary->wall_time = wall_time() - start;
+
+  summary->replicas = run.counted;
+  summary->threads = threads;
+  summary->target_width = target_width;
+  summary->replicas_per_second = summary->wall_time > 0 ? summary->replicas_run / summary->wall_time : 0;
+
+  for(i = 0; i < run.counted; i++) values[i] = run.results[i].avg_wait_time;
+  summary->avg_wait_time = get_confidence_interval(values, run.counted);
+  for(i = 0; i < run.counted; i++) values[i] = run.results[i].max_wait_time;
+  summary->max_wait_time = get_confidence_interval(values, run.counted);
+  for(i = 0; i < run.counted; i++) values[i] = run.results[i].cars_passed;
+  summary->cars_passed = get_confidence_interval(values, run.counted);
+  for(i = 0; i < run.counted; i++) values[i] = run.results[i].max_queue_length;
+  summary->max_queue_length = get_confidence_interval(values, run.counted);
+
+  discard_simulation_pool(&run.pool);
+  destroy_mutex(&run.lock);
+  free(run.results);
+  free(run.finished);
+  free(values);
+  return summary->replicas;
+}
+
+/* Simulates one replica day. Returns false (0) when no more replicas are needed */
+int run_replica(void *context, int replica){
+  monte_carlo_run *run = (monte_carlo_run *) context;
+  simulation_state *sim_state = take_simulation(&run->pool);
+  replica_result result;
+  int more = 1, count, branched = 1;
+
+  /* Every thread holds at most one simulation. A branch keeps the cars of the
+     start state and draws its arrivals from streams forked by the replica */
+  if(run->start_state == NULL){
+    reset_simulation(sim_state, RAND_SEED, replica, run->start_time);
+  }else{
+    branched = fork_simulation_into(sim_state, run->start_state, replica);
+
+    /* The profile day of a branch goes on from the start state, r days later */
+    sim_state->replica = run->start_state->replica + replica;
+  }
+  sim_state->render_simulation = 0;
+  sim_state->arrivals = run->arrivals;
+
+  memset(&result, 0, sizeof(replica_result));
+  if(branched){
+    run->controller(sim_state, run->context);
+
+    result.cars_passed = sim_state->stats[0].total_cars_passed;
+    result.avg_wait_time = result.cars_passed > 0 ? sim_state->stats[0].total_wait_time / result.cars_passed : 0;
+    result.max_wait_time = sim_state->stats[0].max_wait_time;
+    result.max_queue_length = sim_state->stats[0].max_queue_length;
+  }
+  return_simulation(&run->pool, sim_state);
+
+  lock_mutex(&run->lock);
+  run->results[replica] = result;
+  run->finished[replica] = 1;
+
+  /* A branch missing some of its cars would bias the result, so only the
+     replicas before it are counted */
+  if(!branched){
+    printf("\nNot enough memory to branch replica %d, the replicas before it are counted\n", replica);
+    if(replica < run->counted) run->counted = replica;
+  }
+
+  /* Check every replica count that has become complete in replica order */
+  while(run->replicas_done < run->max_replicas && run->finished[run->replicas_done]){
+    run->replicas_done++;
+    count = run->replicas_done;
+
+    if(run->target_width > 0 && count < run->counted && is_interval_narrow(run, count))
+      run->counted = count;
+  }
+  more = run->replicas_done < run->counted;
+  unlock_mutex(&run->lock);
+
+  return more;
+}
+
+/* Returns true (1) if the first count replicas give a narrow enough interval */
+int is_interval_narrow(const monte_carlo_run *run, int count){
+  double sum = 0, square_sum = 0, mean, variance;
+  int i;
+
+  if(count < MIN_ADAPTIVE_REPLICAS) return 0;
+
+  for(i = 0; i < count; i++){
+    sum += run->results[i].avg_wait_time;
+    square_sum += run->results[i].avg_wait_time * run->results[i].avg_wait_time;
+  }
+  mean = sum / count;
+  variance = (square_sum - count * mean * mean) / (count - 1);
+  if(variance < 0) variance = 0;
+
+  return 2 * student_t_95(count - 1) * sqrt(variance / count) <= run->target_width;
+}
+
+/* Mean and 95% Student t interval of the values */
+confidence_interval get_confidence_interval(const double *values, int count){
+  confidence_interval interval = {0, 0};
+  double sum = 0, variance = 0;
+  int i;
+
+  if(count < 1) return interval;
+
+  for(i = 0; i < count; i++)
+    sum += values[i];
+  interval.mean = sum / count;
+
+  if(count < 2) return interval;
+
+  for(i = 0; i < count; i++)
+    variance += (values[i] - interval.mean) * (values[i] - interval.mean);
+  variance /= (count - 1);
+
+  interval.half_width = student_t_95(count - 1) * sqrt(variance / count);
+  return interval;
+}
+
+/* Two sided 95% quantile of the Student t distribution */
+double student_t_95(int degrees_of_freedom){
+  const double table[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+  if(degrees_of_freedom < 1) return 0;
+  if(degrees_of_freedom <= 30) return table[degrees_of_freedom - 1];
+  if(degrees_of_freedom <= 60) return 2.042 - (degrees_of_freedom - 30) * (2.042 - 2.000) / 30.0;
+  if(degrees_of_freedom <= 120) return 2.000 - (degrees_of_freedom - 60) * (2.000 - 1.980) / 60.0;
+  return 1.960;
+}
+
+void print_monte_carlo_summary(const monte_carlo_summary *summary){
+  printf("\n--------------- %d replica days ---------------\n", summary->replicas);
+  if(summary->target_width > 0){
+    if(summary->avg_wait_time.half_width * 2 <= summary->target_width)
+      printf("Target interval width %0.3f s reached\n", summary->target_width);
+    else
+      printf("Target interval width %0.3f s not reached, increase the amount of replicas\n", summary->target_width);
+  }
+  printf("Average wait time     : %0.4f +- %0.4f\n", summary->avg_wait_time.mean, summary->avg_wait_time.half_width);
+  printf("Max wait time         : %0.2f +- %0.2f\n", summary->max_wait_time.mean, summary->max_wait_time.half_width);
+  printf("Cars passed per day   : %0.1f +- %0.1f\n", summary->cars_passed.mean, summary->cars_passed.half_width);
+  printf("Max queue length      : %0.2f +- %0.2f\n", summary->max_queue_length.mean, summary->max_queue_length.half_width);
+  printf("(95%% confidence intervals)\n");
+  printf("\n%d replicas on %d threads in %0.2f s, %0.2f replicas per second\n", summary->replicas_run, summary->threads, summary->wall_time, summary->replicas_per_second);
+}
+
+
+#endif /* MonteCarlo */
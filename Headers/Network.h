@@ -0,0 +1,320 @@
+#ifndef Network /* Include guard */
+#define Network
+
+/* ------------- Networks of intersections ------------- */
+/* A network is a grid of intersections, a corridor is a grid with a single
+   row. Every intersection is a full simulation_state, so its lanes stay
+   together in memory. Cars drive straight through, so a car leaving an
+   intersection from its north street heads south and enters the south
+   neighbour through that neighbour's north street. The time this takes is
+   the travel time of the link between the two. Streets with an upstream
+   neighbour get their cars from the link, the others spawn them as usual.
+
+   The network moves one second at a time. Threads own contiguous ranges of
+   intersections. Each second has two phases separated by a barrier:
+   1. every intersection simulates the second and writes its departures to
+      its outgoing links, which have no other writer
+   2. every intersection takes the cars that have arrived from its incoming
+      links, which have no other reader
+   The second is the same whatever the amount of threads. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Simulation.h"
+#include "Platform.h"
+
+#define NETWORK_STEP 1.0 /* Seconds simulated between exchanges over the links */
+#define DEFAULT_LINK_LENGTH 300.0 /* Meters between the stop lines of two neighbours */
+
+typedef struct network_link network_link;
+typedef struct network_state network_state;
+typedef struct network_worker network_worker;
+
+/* Returns the signal input (0 or 1) for the next second of an intersection */
+typedef int (*network_controller)(const simulation_state *sim_state, int intersection, void *context);
+
+/* Cars on their way from one intersection to the next, first in first out */
+struct network_link{
+  int from, to, street; /* The cars enter street 'street' of intersection 'to' */
+  double travel_time;
+  double *arrivals; /* Network time each car reaches the next intersection */
+  int head, count, capacity;
+};
+
+struct network_state{
+  int rows, columns, intersection_count, link_count;
+  double elapsed_time; /* Seconds simulated by the network */
+  simulation_state *intersections;
+
+  network_link *links;
+  int *outgoing; /* Link leaving each street of each intersection, -1 if the cars leave the network */
+  int *incoming; /* Link feeding each street of each intersection, -1 if the cars are spawned */
+  int *departed; /* cars_left of each street at the last exchange */
+  int failed; /* Set when a link could not grow, the run stops at the next exchange */
+};
+
+struct network_worker{
+  network_state *network;
+  network_controller controller;
+  void *context;
+  int first, last, steps;
+  double start_time;
+  platform_barrier *barrier;
+  platform_mutex *start_lock;
+  platform_thread thread;
+};
+
+int make_network(network_state *network, int rows, int columns, double link_length, double start_time);
+void discard_network(network_state *network);
+int get_neighbour(const network_state *network, int intersection, int direction);
+
+int run_network(network_state *network, double duration, network_controller controller, void *context, int threads);
+void network_worker_run(void *argument);
+void step_intersection(network_state *network, int intersection, double time, network_controller controller, void *context);
+void receive_arrivals(network_state *network, int intersection, double time);
+int push_arrival(network_link *link, double time);
+
+
+/* Builds a grid of rows x columns intersections starting at start_time.
+   Returns true (1) on success */
+int make_network(network_state *network, int rows, int columns, double link_length, double start_time){
+  int i, s, neighbour, n = rows * columns;
+
+  memset(network, 0, sizeof(network_state));
+  if(rows < 1 || columns < 1) return 0;
+
+  network->rows = rows;
+  network->columns = columns;
+  network->intersection_count = n;
+
+  network->intersections = (simulation_state *) malloc(n * sizeof(simulation_state));
+  network->links = (network_link *) calloc(n * AMOUNT_OF_STREETS, sizeof(network_link));
+  network->outgoing = (int *) malloc(n * AMOUNT_OF_STREETS * sizeof(int));
+  network->incoming = (int *) malloc(n * AMOUNT_OF_STREETS * sizeof(int));
+  network->departed = (int *) calloc(n * AMOUNT_OF_STREETS, sizeof(int));
+  if(network->intersections == NULL || network->links == NULL || network->outgoing == NULL || network->incoming == NULL || network->departed == NULL){
+    free(network->intersections);
+    free(network->links);
+    free(network->outgoing);
+    free(network->incoming);
+    free(network->departed);
+    memset(network, 0, sizeof(network_state));
+    return 0;
+  }
+
+  /* The intersection number keys the random streams, like a replica */
+  for(i = 0; i < n; i++){
+    network->intersections[i] = make_simulation_state();
+    seed_simulation_state(&(network->intersections[i]), RAND_SEED, i);
+    network->intersections[i].render_simulation = 0;
+    network->intersections[i].current_time = start_time;
+  }
+
+  for(i = 0; i < n * AMOUNT_OF_STREETS; i++){
+    network->outgoing[i] = -1;
+    network->incoming[i] = -1;
+  }
+
+  /* Cars from street s drive towards the neighbour opposite of s */
+  for(i = 0; i < n; i++){
+    for(s = 0; s < AMOUNT_OF_STREETS; s++){
+      network_link *link;
+
+      neighbour = get_neighbour(network, i, (s + 2) % 4);
+      if(neighbour < 0) continue;
+
+      link = &(network->links[network->link_count]);
+      link->from = i;
+      link->to = neighbour;
+      link->street = s;
+      link->travel_time = (link_length - (CAR_SPAWN_POSITION - DESPAWN_POSITION)) / MAX_SPEED;
+      if(link->travel_time < NETWORK_STEP)
+        link->travel_time = NETWORK_STEP;
+
+      network->outgoing[i * AMOUNT_OF_STREETS + s] = network->link_count;
+      network->incoming[neighbour * AMOUNT_OF_STREETS + s] = network->link_count;
+      network->intersections[neighbour].fed_streets[s] = 1;
+      network->link_count++;
+    }
+  }
+
+  return 1;
+}
+
+void discard_network(network_state *network){
+  int i;
+
+  for(i = 0; i < network->intersection_count; i++)
+    discard_simulation(&(network->intersections[i]));
+  for(i = 0; i < network->link_count; i++)
+    free(network->links[i].arrivals);
+
+  free(network->intersections);
+  free(network->links);
+  free(network->outgoing);
+  free(network->incoming);
+  free(network->departed);
+  memset(network, 0, sizeof(network_state));
+}
+
+/* Returns the intersection next to the given one in a cardinal direction, -1 at the edge */
+int get_neighbour(const network_state *network, int intersection, int direction){
+  int row = intersection / network->columns, column = intersection % network->columns;
+
+  if(direction == north) row--;
+  else if(direction == south) row++;
+  else if(direction == east) column++;
+  else if(direction == west) column--;
+
+  if(row < 0 || row >= network->rows || column < 0 || column >= network->columns)
+    return -1;
+  return row * network->columns + column;
+}
+
+
+/* Simulates the network for duration seconds on up to threads threads.
+   Returns false (0) if the memory ran out, the network is then stopped
+   part way */
+int run_network(network_state *network, double duration, network_controller controller, void *context, int threads){
+  network_worker *workers;
+  platform_barrier barrier;
+  platform_mutex start_lock;
+  int i, started = 1, steps = (int) (duration / NETWORK_STEP + 0.5);
+
+  if(threads <= 0) threads = processor_count();
+  if(threads > network->intersection_count) threads = network->intersection_count;
+
+  workers = (network_worker *) malloc(threads * sizeof(network_worker));
+  if(workers == NULL) return 0;
+  init_mutex(&start_lock);
+
+  /* The workers wait for the start lock, so the ranges can be handed out
+     once it is known how many threads actually started */
+  lock_mutex(&start_lock);
+  for(i = 0; i < threads; i++){
+    workers[i].network = network;
+    workers[i].controller = controller;
+    workers[i].context = context;
+    workers[i].steps = steps;
+    workers[i].start_time = network->elapsed_time;
+    workers[i].barrier = &barrier;
+    workers[i].start_lock = &start_lock;
+  }
+  for(i = 1; i < threads; i++){
+    if(!start_thread(&(workers[i].thread), network_worker_run, &workers[i])) break;
+    started++;
+  }
+
+  for(i = 0; i < started; i++){
+    workers[i].first = (int) ((long) network->intersection_count * i / started);
+    workers[i].last = (int) ((long) network->intersection_count * (i + 1) / started);
+  }
+  init_barrier(&barrier, started);
+  unlock_mutex(&start_lock);
+
+  network_worker_run(&workers[0]);
+
+  for(i = 1; i < started; i++)
+    join_thread(&(workers[i].thread));
+
+  destroy_barrier(&barrier);
+  destroy_mutex(&start_lock);
+  free(workers);
+  network->elapsed_time += steps * NETWORK_STEP;
+  return !network->failed;
+}
+
+/* Runs the range of intersections of one thread in step with the others */
+void network_worker_run(void *argument){
+  network_worker *worker = (network_worker *) argument;
+  int step, i;
+  double time;
+
+  lock_mutex(worker->start_lock);
+  unlock_mutex(worker->start_lock);
+
+  for(step = 0; step < worker->steps; step++){
+    time = worker->start_time + step * NETWORK_STEP;
+
+    for(i = worker->first; i < worker->last; i++)
+      step_intersection(worker->network, i, time, worker->controller, worker->context);
+    wait_barrier(worker->barrier);
+
+    for(i = worker->first; i < worker->last; i++)
+      receive_arrivals(worker->network, i, time);
+    wait_barrier(worker->barrier);
+
+    /* Only set in phase 1, so every thread sees the same value here */
+    if(worker->network->failed) return;
+  }
+}
+
+/* Phase 1: simulates a second and sends the cars that left to the next intersection */
+void step_intersection(network_state *network, int intersection, double time, network_controller controller, void *context){
+  simulation_state *sim_state = &(network->intersections[intersection]);
+  network_link *link;
+  int s, k, index, new_cars;
+
+  update_simulation(sim_state, NETWORK_STEP, controller(sim_state, intersection, context));
+
+  for(s = 0; s < AMOUNT_OF_STREETS; s++){
+    index = intersection * AMOUNT_OF_STREETS + s;
+    new_cars = sim_state->cars_left[s] - network->departed[index];
+    network->departed[index] = sim_state->cars_left[s];
+
+    if(new_cars == 0 || network->outgoing[index] < 0) continue;
+
+    /* The cars left some time during the second, taken as its end */
+    link = &(network->links[network->outgoing[index]]);
+    for(k = 0; k < new_cars; k++)
+      if(!push_arrival(link, time + NETWORK_STEP + link->travel_time)){
+        network->failed = 1;
+        return;
+      }
+  }
+}
+
+/* Phase 2: adds the cars that have reached the intersection */
+void receive_arrivals(network_state *network, int intersection, double time){
+  simulation_state *sim_state = &(network->intersections[intersection]);
+  double now = time + NETWORK_STEP;
+  network_link *link;
+  int s;
+
+  for(s = 0; s < AMOUNT_OF_STREETS; s++){
+    if(network->incoming[intersection * AMOUNT_OF_STREETS + s] < 0) continue;
+    link = &(network->links[network->incoming[intersection * AMOUNT_OF_STREETS + s]]);
+
+    while(link->count > 0 && link->arrivals[link->head] <= now){
+      add_car(sim_state, &(sim_state->streets[s].lanes[straight_right_lane]), &(sim_state->spawn_random[s]));
+      link->head = (link->head + 1) % link->capacity;
+      link->count--;
+    }
+  }
+}
+
+/* Queues a car on a link, the queue grows when full. Returns false (0) if
+   it could not grow */
+int push_arrival(network_link *link, double time){
+  if(link->count == link->capacity){
+    int i, capacity = link->capacity ? link->capacity * 2 : 16;
+    double *arrivals = (double *) malloc(capacity * sizeof(double));
+
+    if(arrivals == NULL) return 0;
+    for(i = 0; i < link->count; i++)
+      arrivals[i] = link->arrivals[(link->head + i) % link->capacity];
+
+    free(link->arrivals);
+    link->arrivals = arrivals;
+    link->capacity = capacity;
+    link->head = 0;
+  }
+
+  link->arrivals[(link->head + link->count) % link->capacity] = time;
+  link->count++;
+  return 1;
+}
+
+
+#endif /* Network */
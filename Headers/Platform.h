@@ -0,0 +1,654 @@
+#ifndef Platform /* Include guard */
+#define Platform
+
+/* ------------- Thin wrappers around operating system services ------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #define PATH_SEPARATOR "\\"
+#else
+  #include <pthread.h>
+  #include <sched.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/types.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <time.h>
+  #define PATH_SEPARATOR "/"
+#endif
+
+typedef struct mapped_file mapped_file;
+typedef struct platform_thread platform_thread;
+typedef struct platform_mutex platform_mutex;
+typedef struct platform_barrier platform_barrier;
+typedef struct platform_once platform_once;
+typedef struct task_queue task_queue;
+typedef struct thread_pool thread_pool;
+typedef void (*thread_function)(void *argument);
+typedef int (*task_function)(void *context, int task);
+typedef void (*once_function)(void);
+
+/* A view of a whole file, or of a shared memory segment made by map_shared_memory() */
+struct mapped_file{
+  void *data; /* Read only unless it is shared memory */
+  size_t size;
+#ifdef _WIN32
+  HANDLE file, mapping;
+#else
+  int descriptor;
+#endif
+};
+
+struct platform_thread{
+  thread_function function;
+  void *argument;
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  pthread_t handle;
+#endif
+};
+
+struct platform_mutex{
+#ifdef _WIN32
+  CRITICAL_SECTION section;
+#else
+  pthread_mutex_t mutex;
+#endif
+};
+
+/* Runs a function a single time however many threads reach it, declared
+   as platform_once name = PLATFORM_ONCE_INIT */
+struct platform_once{
+#ifdef _WIN32
+  INIT_ONCE once;
+#else
+  pthread_once_t once;
+#endif
+};
+
+#ifdef _WIN32
+#define PLATFORM_ONCE_INIT {INIT_ONCE_STATIC_INIT}
+#else
+#define PLATFORM_ONCE_INIT {PTHREAD_ONCE_INIT}
+#endif
+
+/* Blocks threads until all of them have reached it, then opens for the next round */
+struct platform_barrier{
+  int thread_count, waiting, round;
+#ifdef _WIN32
+  CRITICAL_SECTION section;
+  CONDITION_VARIABLE condition;
+#else
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+#endif
+};
+
+int make_directory(const char *path);
+int map_file_readonly(mapped_file *map, const char *path);
+void unmap_file(mapped_file *map);
+int replace_file(const char *source, const char *destination);
+int map_shared_memory(mapped_file *map, const char *name, size_t size, int create);
+void remove_shared_memory(const char *name);
+
+int start_thread(platform_thread *thread, thread_function function, void *argument);
+void join_thread(platform_thread *thread);
+int processor_count();
+
+void init_mutex(platform_mutex *mutex);
+void lock_mutex(platform_mutex *mutex);
+void unlock_mutex(platform_mutex *mutex);
+void destroy_mutex(platform_mutex *mutex);
+
+void run_once(platform_once *once, once_function function);
+#ifdef _WIN32
+BOOL CALLBACK run_once_callback(PINIT_ONCE once, PVOID function, PVOID *context);
+#endif
+
+void init_barrier(platform_barrier *barrier, int thread_count);
+void wait_barrier(platform_barrier *barrier);
+void destroy_barrier(platform_barrier *barrier);
+
+int run_parallel_tasks(task_function function, void *context, int task_count, int threads);
+void task_worker(void *argument);
+
+int start_thread_pool(thread_pool *pool, int threads);
+int run_pool_tasks(thread_pool *pool, task_function function, void *context, int task_count);
+void stop_thread_pool(thread_pool *pool);
+void pool_worker(void *argument);
+
+double wall_time();
+void sleep_milliseconds(int milliseconds);
+void yield_thread();
+
+/* Counters shared by exactly one writing and one reading thread */
+long load_acquire(volatile long *value);
+void store_release(volatile long *value, long new_value);
+
+
+/* Creates a directory, returns true (1) if it exists afterwards */
+int make_directory(const char *path){
+#ifdef _WIN32
+  return CreateDirectory(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+  struct stat info;
+  mkdir(path, 0777);
+  return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+/* Maps an entire file into memory. Returns true (1) on success */
+int map_file_readonly(mapped_file *map, const char *path){
+  memset(map, 0, sizeof(mapped_file));
+
+#ifdef _WIN32
+  {
+    LARGE_INTEGER size;
+    map->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(map->file == INVALID_HANDLE_VALUE) return 0;
+
+    if(!GetFileSizeEx(map->file, &size) || size.QuadPart == 0){
+      CloseHandle(map->file);
+      return 0;
+    }
+    map->size = (size_t) size.QuadPart;
+
+    map->mapping = CreateFileMapping(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(map->mapping == NULL){
+      CloseHandle(map->file);
+      return 0;
+    }
+    map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if(map->data == NULL){
+      CloseHandle(map->mapping);
+      CloseHandle(map->file);
+      return 0;
+    }
+  }
+#else
+  {
+    struct stat info;
+    void *data;
+    map->descriptor = open(path, O_RDONLY);
+    if(map->descriptor < 0) return 0;
+
+    if(fstat(map->descriptor, &info) != 0 || info.st_size == 0){
+      close(map->descriptor);
+      return 0;
+    }
+    map->size = (size_t) info.st_size;
+
+    data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, map->descriptor, 0);
+    if(data == MAP_FAILED){
+      close(map->descriptor);
+      return 0;
+    }
+    map->data = data;
+  }
+#endif
+
+  return 1;
+}
+
+/* Releases a mapping created by map_file_readonly() or map_shared_memory() */
+void unmap_file(mapped_file *map){
+  if(map->data == NULL) return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(map->data);
+  CloseHandle(map->mapping);
+  if(map->file != INVALID_HANDLE_VALUE)
+    CloseHandle(map->file);
+#else
+  munmap((void *) map->data, map->size);
+  close(map->descriptor);
+#endif
+
+  map->data = NULL;
+  map->size = 0;
+}
+
+/* Renames source to destination, replacing destination in a single step so
+   readers see either the old or the new file. Returns true (1) on success */
+int replace_file(const char *source, const char *destination){
+#ifdef _WIN32
+  return MoveFileEx(source, destination, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return rename(source, destination) == 0;
+#endif
+}
+
+
+/* Maps a named shared memory segment of size bytes that other processes on
+   the machine can map by the same name. create makes it, zeroed, and
+   otherwise it must exist already and be at least that large. Returns true
+   (1) on success */
+int map_shared_memory(mapped_file *map, const char *name, size_t size, int create){
+  char path[128];
+  memset(map, 0, sizeof(mapped_file));
+
+#ifdef _WIN32
+  sprintf(path, "Local\\%.100s", name);
+  map->file = INVALID_HANDLE_VALUE;
+  if(create)
+    map->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD) ((unsigned long long) size >> 32), (DWORD) size, path);
+  else
+    map->mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, path);
+  if(map->mapping == NULL) return 0;
+
+  map->data = MapViewOfFile(map->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if(map->data == NULL){
+    CloseHandle(map->mapping);
+    return 0;
+  }
+#else
+  {
+    struct stat info;
+    void *data;
+    sprintf(path, "/%.100s", name);
+    map->descriptor = shm_open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+    if(map->descriptor < 0) return 0;
+
+    if((create && ftruncate(map->descriptor, (off_t) size) != 0) || fstat(map->descriptor, &info) != 0 || (size_t) info.st_size < size){
+      close(map->descriptor);
+      return 0;
+    }
+
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, map->descriptor, 0);
+    if(data == MAP_FAILED){
+      close(map->descriptor);
+      return 0;
+    }
+    map->data = data;
+  }
+#endif
+
+  map->size = size;
+  return 1;
+}
+
+/* Removes the name of a shared memory segment, the processes that mapped it
+   keep it until they unmap it. Windows removes it with the last mapping */
+void remove_shared_memory(const char *name){
+#ifndef _WIN32
+  char path[128];
+  sprintf(path, "/%.100s", name);
+  shm_unlink(path);
+#endif
+}
+
+/* Entry point handed to the operating system */
+#ifdef _WIN32
+DWORD WINAPI platform_thread_entry(LPVOID thread){
+  ((platform_thread *) thread)->function(((platform_thread *) thread)->argument);
+  return 0;
+}
+#else
+void *platform_thread_entry(void *thread){
+  ((platform_thread *) thread)->function(((platform_thread *) thread)->argument);
+  return NULL;
+}
+#endif
+
+/* Runs function(argument) on a new thread. Returns true (1) on success */
+int start_thread(platform_thread *thread, thread_function function, void *argument){
+  thread->function = function;
+  thread->argument = argument;
+#ifdef _WIN32
+  thread->handle = CreateThread(NULL, 0, platform_thread_entry, thread, 0, NULL);
+  return thread->handle != NULL;
+#else
+  return pthread_create(&(thread->handle), NULL, platform_thread_entry, thread) == 0;
+#endif
+}
+
+/* Waits for a thread to finish */
+void join_thread(platform_thread *thread){
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(thread->handle, NULL);
+#endif
+}
+
+/* Returns the amount of logical processors */
+int processor_count(){
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int) info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int) count : 1;
+#endif
+}
+
+void init_mutex(platform_mutex *mutex){
+#ifdef _WIN32
+  InitializeCriticalSection(&(mutex->section));
+#else
+  pthread_mutex_init(&(mutex->mutex), NULL);
+#endif
+}
+
+void lock_mutex(platform_mutex *mutex){
+#ifdef _WIN32
+  EnterCriticalSection(&(mutex->section));
+#else
+  pthread_mutex_lock(&(mutex->mutex));
+#endif
+}
+
+void unlock_mutex(platform_mutex *mutex){
+#ifdef _WIN32
+  LeaveCriticalSection(&(mutex->section));
+#else
+  pthread_mutex_unlock(&(mutex->mutex));
+#endif
+}
+
+void destroy_mutex(platform_mutex *mutex){
+#ifdef _WIN32
+  DeleteCriticalSection(&(mutex->section));
+#else
+  pthread_mutex_destroy(&(mutex->mutex));
+#endif
+}
+
+/* Calls function unless it has been called through once before. Threads
+   that reach it meanwhile wait until the call has finished */
+void run_once(platform_once *once, once_function function){
+#ifdef _WIN32
+  /* A function pointer cannot be passed as a PVOID, a pointer to it can */
+  InitOnceExecuteOnce(&(once->once), run_once_callback, &function, NULL);
+#else
+  pthread_once(&(once->once), function);
+#endif
+}
+
+#ifdef _WIN32
+BOOL CALLBACK run_once_callback(PINIT_ONCE once, PVOID function, PVOID *context){
+  (void) once;
+  (void) context;
+  (*((once_function *) function))();
+  return TRUE;
+}
+#endif
+
+void init_barrier(platform_barrier *barrier, int thread_count){
+  barrier->thread_count = thread_count;
+  barrier->waiting = 0;
+  barrier->round = 0;
+#ifdef _WIN32
+  InitializeCriticalSection(&(barrier->section));
+  InitializeConditionVariable(&(barrier->condition));
+#else
+  pthread_mutex_init(&(barrier->mutex), NULL);
+  pthread_cond_init(&(barrier->condition), NULL);
+#endif
+}
+
+/* Returns when thread_count threads have called it in this round. Memory
+   written before the barrier is visible to every thread after it */
+void wait_barrier(platform_barrier *barrier){
+  int round;
+#ifdef _WIN32
+  EnterCriticalSection(&(barrier->section));
+  round = barrier->round;
+  if(++barrier->waiting == barrier->thread_count){
+    barrier->waiting = 0;
+    barrier->round++;
+    WakeAllConditionVariable(&(barrier->condition));
+  }else{
+    while(round == barrier->round)
+      SleepConditionVariableCS(&(barrier->condition), &(barrier->section), INFINITE);
+  }
+  LeaveCriticalSection(&(barrier->section));
+#else
+  pthread_mutex_lock(&(barrier->mutex));
+  round = barrier->round;
+  if(++barrier->waiting == barrier->thread_count){
+    barrier->waiting = 0;
+    barrier->round++;
+    pthread_cond_broadcast(&(barrier->condition));
+  }else{
+    while(round == barrier->round)
+      pthread_cond_wait(&(barrier->condition), &(barrier->mutex));
+  }
+  pthread_mutex_unlock(&(barrier->mutex));
+#endif
+}
+
+void destroy_barrier(platform_barrier *barrier){
+#ifdef _WIN32
+  DeleteCriticalSection(&(barrier->section));
+#else
+  pthread_mutex_destroy(&(barrier->mutex));
+  pthread_cond_destroy(&(barrier->condition));
+#endif
+}
+
+/* Tasks handed out to the workers of run_parallel_tasks() */
+struct task_queue{
+  task_function function;
+  void *context;
+  int task_count, next_task, stopped;
+  platform_mutex lock;
+};
+
+/* Runs function(context, task) for task 0 .. task_count-1 on up to threads
+   threads, lower tasks are started first. A task returning false (0) stops
+   the queue, tasks already started still finish. Returns the amount of
+   tasks started */
+int run_parallel_tasks(task_function function, void *context, int task_count, int threads){
+  task_queue queue;
+  platform_thread *workers;
+  int i, started = 0;
+
+  queue.function = function;
+  queue.context = context;
+  queue.task_count = task_count;
+  queue.next_task = 0;
+  queue.stopped = 0;
+  init_mutex(&queue.lock);
+
+  if(threads <= 0) threads = processor_count();
+  if(threads > task_count) threads = task_count;
+
+  /* The calling thread works as well */
+  workers = (platform_thread *) malloc((threads > 1 ? threads - 1 : 1) * sizeof(platform_thread));
+  for(i = 0; i < threads - 1; i++){
+    if(!start_thread(&workers[started], task_worker, &queue)) break;
+    started++;
+  }
+  task_worker(&queue);
+
+  for(i = 0; i < started; i++)
+    join_thread(&workers[i]);
+
+  free(workers);
+  destroy_mutex(&queue.lock);
+  return queue.next_task < task_count ? queue.next_task : task_count;
+}
+
+void task_worker(void *argument){
+  task_queue *queue = (task_queue *) argument;
+  int task;
+
+  while(1){
+    lock_mutex(&queue->lock);
+    if(queue->stopped || queue->next_task >= queue->task_count){
+      unlock_mutex(&queue->lock);
+      return;
+    }
+    task = queue->next_task++;
+    unlock_mutex(&queue->lock);
+
+    if(!queue->function(queue->context, task)){
+      lock_mutex(&queue->lock);
+      queue->stopped = 1;
+      unlock_mutex(&queue->lock);
+    }
+  }
+}
+
+/* Threads that stay alive between batches of tasks, for callers that run
+   many small batches. The workers wait at the start barrier for a batch and
+   meet the caller at the finish barrier when the queue is empty */
+struct thread_pool{
+  int thread_count, stopping;
+  platform_thread *threads;
+  platform_barrier start, finish;
+  platform_mutex start_lock;
+  task_queue queue;
+};
+
+/* Starts a pool of up to threads threads counting the caller, which works
+   on every batch as well. Returns the amount of threads */
+int start_thread_pool(thread_pool *pool, int threads){
+  int i, started = 0;
+
+  if(threads <= 0) threads = processor_count();
+
+  pool->stopping = 0;
+  pool->threads = (platform_thread *) malloc((threads > 1 ? threads - 1 : 1) * sizeof(platform_thread));
+  init_mutex(&(pool->queue.lock));
+  init_mutex(&(pool->start_lock));
+
+  /* The barriers are made once it is known how many threads started */
+  lock_mutex(&(pool->start_lock));
+  for(i = 0; pool->threads != NULL && i < threads - 1; i++){
+    if(!start_thread(&(pool->threads[started]), pool_worker, pool)) break;
+    started++;
+  }
+
+  pool->thread_count = started + 1;
+  init_barrier(&(pool->start), pool->thread_count);
+  init_barrier(&(pool->finish), pool->thread_count);
+  unlock_mutex(&(pool->start_lock));
+
+  return pool->thread_count;
+}
+
+/* Runs function(context, task) for task 0 .. task_count-1 like
+   run_parallel_tasks() on the threads of the pool. Returns the amount of
+   tasks started */
+int run_pool_tasks(thread_pool *pool, task_function function, void *context, int task_count){
+  task_queue *queue = &(pool->queue);
+
+  /* The workers are all waiting at the start barrier */
+  queue->function = function;
+  queue->context = context;
+  queue->task_count = task_count;
+  queue->next_task = 0;
+  queue->stopped = 0;
+
+  wait_barrier(&(pool->start));
+  task_worker(queue);
+  wait_barrier(&(pool->finish));
+
+  return queue->next_task < task_count ? queue->next_task : task_count;
+}
+
+void stop_thread_pool(thread_pool *pool){
+  int i;
+
+  pool->stopping = 1;
+  wait_barrier(&(pool->start));
+  for(i = 0; i < pool->thread_count - 1; i++)
+    join_thread(&(pool->threads[i]));
+
+  destroy_barrier(&(pool->start));
+  destroy_barrier(&(pool->finish));
+  destroy_mutex(&(pool->start_lock));
+  destroy_mutex(&(pool->queue.lock));
+  free(pool->threads);
+}
+
+void pool_worker(void *argument){
+  thread_pool *pool = (thread_pool *) argument;
+
+  lock_mutex(&(pool->start_lock));
+  unlock_mutex(&(pool->start_lock));
+
+  while(1){
+    wait_barrier(&(pool->start));
+    if(pool->stopping) return;
+
+    task_worker(&(pool->queue));
+    wait_barrier(&(pool->finish));
+  }
+}
+
+/* Returns a monotonic wall clock time in seconds */
+double wall_time(){
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+void sleep_milliseconds(int milliseconds){
+#ifdef _WIN32
+  Sleep(milliseconds);
+#else
+  struct timespec duration;
+  duration.tv_sec = milliseconds / 1000;
+  duration.tv_nsec = (milliseconds % 1000) * 1000000L;
+  nanosleep(&duration, NULL);
+#endif
+}
+
+/* Lets another thread run, for threads that poll */
+void yield_thread(){
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+/* Reads a counter published by store_release() on another thread. Whatever
+   that thread wrote before the store is visible after the load */
+long load_acquire(volatile long *value){
+#if defined(__GNUC__)
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#else
+  long result = *value;
+#if defined(_M_IX86) || defined(_M_X64)
+  _ReadWriteBarrier(); /* x86 does not reorder loads with later memory operations */
+#else
+  MemoryBarrier();
+#endif
+  return result;
+#endif
+}
+
+/* Publishes a counter after everything written before it */
+void store_release(volatile long *value, long new_value){
+#if defined(__GNUC__)
+  __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+#else
+#if defined(_M_IX86) || defined(_M_X64)
+  _ReadWriteBarrier(); /* x86 does not reorder stores with earlier memory operations */
+#else
+  MemoryBarrier();
+#endif
+  *value = new_value;
+#endif
+}
+
+
+#endif /* Platform */
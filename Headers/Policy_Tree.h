@@ -0,0 +1,248 @@
+#ifndef PolicyTree /* Include guard */
+#define PolicyTree
+
+/* ------------- Decision tree distillation of a tabular policy ------------- */
+/* A policy table grows with the product of every state dimension, while the
+   decisions it holds usually depend on a few thresholds. The tree is grown
+   greedily (Gini impurity) over integer features of labelled samples. A split
+   is only tried at the thresholds registered for its feature, so a tree over
+   raw measurements never splits inside one of the intervals the table uses.
+
+   Nodes are stored in one flat array, a node with feature -1 is a leaf. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TREE_FEATURES 8
+#define MAX_TREE_THRESHOLDS 16
+
+typedef struct tree_node tree_node;
+typedef struct policy_tree policy_tree;
+typedef struct tree_samples tree_samples;
+
+struct tree_node{
+  short feature;           /* Feature tested by the node, -1 for a leaf */
+  unsigned char label;     /* Majority action of the samples reaching the node */
+  unsigned char reserved;
+  int threshold;           /* Samples with feature <= threshold go left */
+  int left, right;
+};
+
+struct policy_tree{
+  tree_node *nodes;
+  int node_count, capacity, depth;
+};
+
+struct tree_samples{
+  int feature_count, sample_count, capacity;
+  int *features;           /* sample_count x feature_count */
+  unsigned char *labels;   /* 0 or 1 */
+  double *weights;
+
+  int threshold_count[MAX_TREE_FEATURES];
+  int thresholds[MAX_TREE_FEATURES][MAX_TREE_THRESHOLDS];
+};
+
+int init_tree_samples(tree_samples *samples, int feature_count, int capacity);
+void free_tree_samples(tree_samples *samples);
+void add_tree_threshold(tree_samples *samples, int feature, int threshold);
+void add_tree_sample(tree_samples *samples, const int *features, int label, double weight);
+
+int build_policy_tree(policy_tree *tree, const tree_samples *samples, int max_depth);
+int grow_tree_node(policy_tree *tree, const tree_samples *samples, int *index, int count, int depth, int max_depth);
+void free_policy_tree(policy_tree *tree);
+
+int policy_tree_decide(const policy_tree *tree, const int *features);
+double policy_tree_fidelity(const policy_tree *tree, const tree_samples *samples);
+void write_policy_tree(const policy_tree *tree, FILE *fp, const char **feature_names, const char **label_names, int node, int indent);
+
+
+/* Allocates room for capacity samples. Returns true (1) on success */
+int init_tree_samples(tree_samples *samples, int feature_count, int capacity){
+  memset(samples, 0, sizeof(tree_samples));
+  samples->feature_count = feature_count > MAX_TREE_FEATURES ? MAX_TREE_FEATURES : feature_count;
+  samples->capacity = capacity;
+
+  samples->features = (int *) malloc(capacity * samples->feature_count * sizeof(int));
+  samples->labels = (unsigned char *) malloc(capacity * sizeof(unsigned char));
+  samples->weights = (double *) malloc(capacity * sizeof(double));
+
+  return samples->features != NULL && samples->labels != NULL && samples->weights != NULL;
+}
+
+void free_tree_samples(tree_samples *samples){
+  free(samples->features);
+  free(samples->labels);
+  free(samples->weights);
+  memset(samples, 0, sizeof(tree_samples));
+}
+
+/* Allows splits of the form feature <= threshold */
+void add_tree_threshold(tree_samples *samples, int feature, int threshold){
+  if(samples->threshold_count[feature] < MAX_TREE_THRESHOLDS)
+    samples->thresholds[feature][samples->threshold_count[feature]++] = threshold;
+}
+
+void add_tree_sample(tree_samples *samples, const int *features, int label, double weight){
+  int n = samples->sample_count;
+  if(n >= samples->capacity) return;
+
+  memcpy(samples->features + n * samples->feature_count, features, samples->feature_count * sizeof(int));
+  samples->labels[n] = (unsigned char) (label != 0);
+  samples->weights[n] = weight;
+  samples->sample_count++;
+}
+
+/* Grows a tree of at most max_depth splits. Returns the amount of nodes,
+   or 0 if the memory ran out */
+int build_policy_tree(policy_tree *tree, const tree_samples *samples, int max_depth){
+  int i, *index = (int *) malloc((samples->sample_count + 1) * sizeof(int));
+
+  memset(tree, 0, sizeof(policy_tree));
+  if(index == NULL) return 0;
+  for(i = 0; i < samples->sample_count; i++)
+    index[i] = i;
+
+  if(grow_tree_node(tree, samples, index, samples->sample_count, 0, max_depth) < 0)
+    free_policy_tree(tree);
+
+  free(index);
+  return tree->node_count;
+}
+
+/* Adds a node for the samples in index[0 .. count-1] and splits it further.
+   The index array is reordered. Returns the id of the node, or -1 if the
+   nodes could not grow */
+int grow_tree_node(policy_tree *tree, const tree_samples *samples, int *index, int count, int depth, int max_depth){
+  int i, f, t, id, best_feature = -1, best_threshold = 0, left_count, left, right, swap;
+  double weight[2] = {0, 0}, left_weight[2], right_weight, gini, best_gini, left_total, right_total;
+  const int *x;
+
+  if(tree->node_count == tree->capacity){
+    int capacity = tree->capacity ? tree->capacity * 2 : 64;
+    tree_node *nodes = (tree_node *) realloc(tree->nodes, capacity * sizeof(tree_node));
+
+    if(nodes == NULL) return -1;
+    tree->nodes = nodes;
+    tree->capacity = capacity;
+  }
+  id = tree->node_count++;
+
+  for(i = 0; i < count; i++)
+    weight[samples->labels[index[i]]] += samples->weights[index[i]];
+
+  memset(&(tree->nodes[id]), 0, sizeof(tree_node));
+  tree->nodes[id].feature = -1;
+  tree->nodes[id].label = weight[1] > weight[0];
+  if(depth > tree->depth) tree->depth = depth;
+
+  if(depth >= max_depth || weight[0] == 0 || weight[1] == 0)
+    return id;
+
+  /* Weighted Gini impurity of the two children, 2 p (1 - p) per side */
+  best_gini = 2 * weight[0] * weight[1] / (weight[0] + weight[1]) - 1e-12;
+
+  for(f = 0; f < samples->feature_count; f++){
+    for(t = 0; t < samples->threshold_count[f]; t++){
+      left_weight[0] = left_weight[1] = 0;
+      for(i = 0; i < count; i++){
+        x = samples->features + index[i] * samples->feature_count;
+        if(x[f] <= samples->thresholds[f][t])
+          left_weight[samples->labels[index[i]]] += samples->weights[index[i]];
+      }
+
+      left_total = left_weight[0] + left_weight[1];
+      right_total = weight[0] + weight[1] - left_total;
+      if(left_total <= 0 || right_total <= 0) continue;
+
+      right_weight = weight[1] - left_weight[1];
+      gini = 2 * left_weight[1] * (left_total - left_weight[1]) / left_total
+           + 2 * right_weight * (right_total - right_weight) / right_total;
+
+      if(gini < best_gini){
+        best_gini = gini;
+        best_feature = f;
+        best_threshold = samples->thresholds[f][t];
+      }
+    }
+  }
+
+  if(best_feature < 0)
+    return id;
+
+  /* Partition the samples, left side first */
+  left_count = 0;
+  for(i = 0; i < count; i++){
+    x = samples->features + index[i] * samples->feature_count;
+    if(x[best_feature] <= best_threshold){
+      swap = index[i];
+      index[i] = index[left_count];
+      index[left_count++] = swap;
+    }
+  }
+
+  left = grow_tree_node(tree, samples, index, left_count, depth + 1, max_depth);
+  if(left < 0) return -1;
+  right = grow_tree_node(tree, samples, index + left_count, count - left_count, depth + 1, max_depth);
+  if(right < 0) return -1;
+
+  /* Two leaves with the same action make the split pointless, they are the
+     last two nodes added so they can simply be dropped */
+  if(tree->nodes[left].feature < 0 && tree->nodes[right].feature < 0 && tree->nodes[left].label == tree->nodes[right].label){
+    tree->node_count -= 2;
+    return id;
+  }
+
+  tree->nodes[id].feature = (short) best_feature;
+  tree->nodes[id].threshold = best_threshold;
+  tree->nodes[id].left = left;
+  tree->nodes[id].right = right;
+  return id;
+}
+
+void free_policy_tree(policy_tree *tree){
+  free(tree->nodes);
+  memset(tree, 0, sizeof(policy_tree));
+}
+
+/* Returns the action of the leaf the features lead to */
+int policy_tree_decide(const policy_tree *tree, const int *features){
+  const tree_node *node = tree->nodes;
+
+  while(node->feature >= 0)
+    node = tree->nodes + (features[node->feature] <= node->threshold ? node->left : node->right);
+
+  return node->label;
+}
+
+/* Returns the weighted share of samples where the tree picks the sample label */
+double policy_tree_fidelity(const policy_tree *tree, const tree_samples *samples){
+  double agree = 0, total = 0;
+  int i;
+
+  for(i = 0; i < samples->sample_count; i++){
+    total += samples->weights[i];
+    if(policy_tree_decide(tree, samples->features + i * samples->feature_count) == samples->labels[i])
+      agree += samples->weights[i];
+  }
+
+  return total > 0 ? agree / total : 1;
+}
+
+/* Prints the tree as nested if / else rules, starting from the given node */
+void write_policy_tree(const policy_tree *tree, FILE *fp, const char **feature_names, const char **label_names, int node, int indent){
+  const tree_node *n = tree->nodes + node;
+
+  if(n->feature < 0){
+    fprintf(fp, "%*s%s\n", indent, "", label_names[n->label]);
+    return;
+  }
+
+  fprintf(fp, "%*sif %s <= %d\n", indent, "", feature_names[n->feature], n->threshold);
+  write_policy_tree(tree, fp, feature_names, label_names, n->left, indent + 2);
+  fprintf(fp, "%*selse\n", indent, "");
+  write_policy_tree(tree, fp, feature_names, label_names, n->right, indent + 2);
+}
+
+
+#endif /* PolicyTree */
@@ -0,0 +1,96 @@
+#ifndef Random /* Include guard */
+#define Random
+
+/* ------------- Independent random number streams ------------- */
+/* Every stream is a xoshiro256** generator whose state is filled by splitmix64
+   from a key of (seed, replica, stream). Each simulation owns its streams, so
+   replicas run on separate threads without sharing a generator, and any
+   replica gives the same draws when it is run again on its own. The numbers
+   are the same on every platform, unlike rand() whose RAND_MAX differs. */
+#include <stddef.h>
+
+typedef struct random_stream random_stream;
+
+struct random_stream{
+  unsigned long long s[4];
+};
+
+unsigned long long splitmix64(unsigned long long *state);
+void add_to_digest(unsigned long long *digest, const void *data, size_t size);
+void seed_random_stream(random_stream *random, unsigned long long seed, unsigned long long replica, unsigned long long stream);
+void fork_random_stream(random_stream *fork, const random_stream *parent, unsigned long long stream);
+unsigned long long next_random(random_stream *random);
+double random_uniform(random_stream *random);
+int random_below(random_stream *random, int n);
+
+
+/* Returns the next number of a splitmix64 sequence */
+unsigned long long splitmix64(unsigned long long *state){
+  unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* FNV-1a over the bytes of data, a digest starts at 14695981039346656037 */
+void add_to_digest(unsigned long long *digest, const void *data, size_t size){
+  const unsigned char *bytes = (const unsigned char *) data;
+  size_t i;
+
+  for(i = 0; i < size; i++){
+    *digest ^= bytes[i];
+    *digest *= 1099511628211ULL;
+  }
+}
+
+/* Seeds a stream from its key. Streams with different keys do not overlap in practice */
+void seed_random_stream(random_stream *random, unsigned long long seed, unsigned long long replica, unsigned long long stream){
+  unsigned long long key = seed, mixed;
+  int i;
+
+  /* Mix each part of the key in turn, so (1, 2) and (2, 1) differ */
+  mixed = splitmix64(&key) ^ replica;
+  key = mixed;
+  mixed = splitmix64(&key) ^ stream;
+  key = mixed;
+
+  for(i = 0; i < 4; i++)
+    random->s[i] = splitmix64(&key);
+}
+
+/* Seeds fork from the current state of parent and a stream number. The
+   parent is left as it is, forks with the same stream give the same draws */
+void fork_random_stream(random_stream *fork, const random_stream *parent, unsigned long long stream){
+  seed_random_stream(fork, parent->s[0] ^ parent->s[3], parent->s[1] ^ parent->s[2], stream);
+}
+
+/* xoshiro256** */
+unsigned long long next_random(random_stream *random){
+  unsigned long long *s = random->s;
+  unsigned long long result = s[1] * 5, t = s[1] << 17;
+
+  result = ((result << 7) | (result >> 57)) * 9;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = (s[3] << 45) | (s[3] >> 19);
+
+  return result;
+}
+
+/* Returns a number in [0, 1) */
+double random_uniform(random_stream *random){
+  return (double) (next_random(random) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Returns an integer in [0, n) */
+int random_below(random_stream *random, int n){
+  if(n <= 1) return 0;
+  return (int) ((next_random(random) >> 33) % (unsigned long long) n);
+}
+
+
+#endif /* Random */
@@ -0,0 +1,185 @@
+#ifndef RunOptions /* Include guard */
+#define RunOptions
+
+/* ------------- What a controller run is started with ------------- */
+/* Every controller asks for the same files around its own settings: a
+   checkpoint to save or start from, a scenario, a count file and, for a
+   single day, a trace and per car telemetry. prompt_run_options() asks for
+   them, open_run_options() loads and attaches them to the simulation and
+   close_run_options() prints what they produced and closes them again.
+   A file that cannot be opened is reported and left out of the run */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Simulation.h"
+#include "Simulation_Evaluation.h"
+
+typedef struct run_options run_options;
+
+struct run_options{
+  int checkpoint_mode, scenario_on, counts_on, count_day, trace_mode, telemetry_on;
+  double checkpoint_time;
+  char checkpoint_file[MAX_CHECKPOINT_PATH], scenario_file[MAX_SCENARIO_PATH], count_file[MAX_PROFILE_PATH];
+  char trace_file[MAX_TRACE_PATH], telemetry_file[MAX_TELEMETRY_PATH];
+  arrival_profile arrivals;
+  telemetry_stream telemetry;
+  trace_writer writer;
+  trace_reader reader;
+};
+
+int prompt_run_options(run_options *options, int replicas, int scenarios);
+int open_run_options(run_options *options, simulation_state *sim_state, int replicas);
+void close_run_options(run_options *options, simulation_state *sim_state);
+
+
+/* Asks for the files of a run. Replica days are not traced and have no
+   telemetry, and the scenario is only asked for if scenarios is true (1).
+   Returns false (0) if an input could not be read */
+int prompt_run_options(run_options *options, int replicas, int scenarios){
+  memset(options, 0, sizeof(run_options));
+  options->checkpoint_mode = checkpoint_off;
+  options->trace_mode = trace_off;
+
+  /* A run can save the simulation on the way or go on from a saved one */
+  printf("\nCheckpoint OFF(0), save one at a time of day(1) or start from one(2): ");
+  if(scanf("%d", &(options->checkpoint_mode)) != 1) return 0;
+
+  if(options->checkpoint_mode == checkpoint_save){
+    printf("\nSave at time in seconds: ");
+    if(scanf("%lf", &(options->checkpoint_time)) != 1) return 0;
+  }
+  if(options->checkpoint_mode != checkpoint_off){
+    printf("\nCheckpoint file: ");
+    if(scanf("%199s", options->checkpoint_file) != 1) return 0;
+  }
+
+  /* Another intersection can be described in a scenario file */
+  if(scenarios){
+    printf("\nIntersection built in(0) or from a scenario file(1): ");
+    if(scanf("%d", &(options->scenario_on)) != 1) return 0;
+
+    if(options->scenario_on){
+      printf("\nScenario file: ");
+      if(scanf("%199s", options->scenario_file) != 1) return 0;
+    }
+  }
+
+  /* Real days of traffic counts can replace the fitted curves */
+  printf("\nArrivals from the fitted curves(0) or a count file(1): ");
+  if(scanf("%d", &(options->counts_on)) != 1) return 0;
+
+  if(options->counts_on){
+    printf("\nCount file or a profile compiled from one: ");
+    if(scanf("%199s", options->count_file) != 1) return 0;
+
+    printf("\nDay of the counts to start at (0 = the first, -1 = a typical weekday, -2 = a typical weekend day): ");
+    if(scanf("%d", &(options->count_day)) != 1) return 0;
+  }
+
+  /* A single day can be recorded or face the arrivals of a recording */
+  if(replicas <= 1){
+    printf("\nTrace OFF(0), record to a file(1) or take the arrivals from a file(2): ");
+    if(scanf("%d", &(options->trace_mode)) != 1) return 0;
+
+    if(options->trace_mode != trace_off){
+      printf("\nTrace file: ");
+      if(scanf("%199s", options->trace_file) != 1) return 0;
+    }
+
+    printf("\nPer car telemetry OFF(0) or to a file(1): ");
+    if(scanf("%d", &(options->telemetry_on)) != 1) return 0;
+
+    if(options->telemetry_on){
+      printf("\nTelemetry file: ");
+      if(scanf("%199s", options->telemetry_file) != 1) return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Loads the scenario and the counts and attaches the files of a run to a
+   simulation whose start time is set. Replica days only load the checkpoint
+   they branch from into it. Returns false (0) if a file could not be opened,
+   which is then left out */
+int open_run_options(run_options *options, simulation_state *sim_state, int replicas){
+  int error_line, ok = 1;
+
+  /* The scenario comes first as the counts name its streets */
+  if(options->scenario_on && load_scenario(options->scenario_file, &error_line)){
+    apply_scenario(sim_state);
+  }else if(options->scenario_on){
+    if(error_line > 0)
+      printf("Line %d of the scenario %s is not understood, the built-in intersection is used\n", error_line, options->scenario_file);
+    else
+      printf("Unable to read the scenario %s, the built-in intersection is used\n", options->scenario_file);
+    options->scenario_on = 0;
+    ok = 0;
+  }
+
+  if(options->counts_on && !load_arrival_profile(&(options->arrivals), options->count_file)){
+    printf("Unable to read the counts %s, the fitted curves are used\n", options->count_file);
+    options->counts_on = 0;
+    ok = 0;
+  }else if(options->counts_on && !select_arrival_day(&(options->arrivals), options->count_day)){
+    printf("The counts have no day %d, the first day is used\n", options->count_day);
+  }
+
+  /* Every replica branches from the checkpoint */
+  if(replicas > 1){
+    if(options->checkpoint_mode == checkpoint_save){
+      printf("Checkpoints are only saved by a single day\n");
+      options->checkpoint_mode = checkpoint_off;
+    }
+    if(options->checkpoint_mode == checkpoint_start && !load_checkpoint(sim_state, options->checkpoint_file)){
+      printf("Unable to load the checkpoint %s\n", options->checkpoint_file);
+      options->checkpoint_mode = checkpoint_off;
+      ok = 0;
+    }
+    return ok;
+  }
+
+  if(options->counts_on)
+    sim_state->arrivals = &(options->arrivals);
+  if(!open_checkpoint(sim_state, options->checkpoint_mode, options->checkpoint_file, options->checkpoint_time)){
+    printf("Unable to load the checkpoint %s\n", options->checkpoint_file);
+    options->checkpoint_mode = checkpoint_off;
+    ok = 0;
+  }
+  if(!open_trace(sim_state, options->trace_mode, options->trace_file, &(options->writer), &(options->reader))){
+    printf("Unable to open the trace %s\n", options->trace_file);
+    options->trace_mode = trace_off;
+    ok = 0;
+  }
+  if(options->telemetry_on && !start_telemetry(sim_state, &(options->telemetry), options->telemetry_file)){
+    printf("Unable to open the telemetry file %s\n", options->telemetry_file);
+    options->telemetry_on = 0;
+    ok = 0;
+  }
+
+  return ok;
+}
+
+/* Prints the digest of a traced run and the telemetry written, then closes
+   the files of the run. Called once the run is over and its statistics are
+   printed */
+void close_run_options(run_options *options, simulation_state *sim_state){
+  if(options->trace_mode != trace_off){
+    unsigned long long digest = get_statistics_digest(sim_state);
+    printf("Statistics digest: %08x%08x\n", (unsigned int) (digest >> 32), (unsigned int) digest);
+    close_trace(sim_state);
+  }
+  if(sim_state->telemetry != NULL)
+    printf("Telemetry events written: %ld\n", stop_telemetry(sim_state));
+  if(sim_state->checkpoint_path != NULL)
+    printf("The run ended before the checkpoint was due\n");
+
+  if(options->counts_on){
+    close_arrival_profile(&(options->arrivals));
+    sim_state->arrivals = NULL;
+  }
+}
+
+
+#endif /* RunOptions */
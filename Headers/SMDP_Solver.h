@@ -0,0 +1,272 @@
+#ifndef SMDPSolver /* Include guard */
+#define SMDPSolver
+
+/* ------------- Semi-Markov value iteration over decision states ------------- */
+/* Only states where the controller can choose are stored: a green phase
+   (north/south or east/west) with a time interval above the minimum green time.
+   Yellow phases and the minimum green time are forced waits, so ChangeSignal
+   is folded into one macro step that runs through both yellow phases and the
+   following minimum green time before the next decision.
+
+   The car interval of each direction changes independently of the others
+   given which lanes are open, so expectations over the next car states are
+   computed as one small matrix product per direction instead of a sum over
+   the whole state space. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SMDP_DIRECTIONS 4
+#define SMDP_PHASES 2 /* North/south green and east/west green */
+#define MAX_MACRO_STEPS 512
+#define SMDP_WORK_TENSORS 5
+
+typedef struct smdp_model smdp_model;
+
+struct smdp_model{
+  int car_states, time_states, tensor_size;
+  double discount;
+
+  double *transition[SMDP_DIRECTIONS][2]; /* car_states x car_states per direction, for a closed (0) and open (1) lane */
+  double *lane_reward[2]; /* Reward of each car interval in a closed (0) and open (1) lane */
+  double *time_advance; /* Probability of moving up a time interval when waiting */
+
+  int macro_length; /* Steps from ChangeSignal until the next decision */
+  int macro_phase[SMDP_PHASES][MAX_MACRO_STEPS + 1]; /* Phase whose lanes are open after k steps of the macro */
+
+  double *value, *value_last; /* Indexed [phase][time][car tensor] */
+  unsigned char *policy;
+
+  double *phase_reward[SMDP_PHASES]; /* Reward tensor of each phase */
+  double *work[SMDP_WORK_TENSORS]; /* Scratch tensors of the transitions (0, 1) and the backup (2, 3, 4) */
+};
+
+int init_smdp_model(smdp_model *model, int car_states, int time_states, double discount);
+void free_smdp_model(smdp_model *model);
+void set_smdp_macro(smdp_model *model, int yellow_steps, int min_green_steps);
+void finish_smdp_model(smdp_model *model);
+
+int smdp_car_index(const smdp_model *model, const int *car_states);
+int smdp_value_index(const smdp_model *model, int phase, int time_state, int car_index);
+int is_smdp_open(int phase, int direction);
+
+void smdp_backup(smdp_model *model);
+void smdp_swap_values(smdp_model *model);
+int smdp_policy(const smdp_model *model, int phase, int time_state, const int *car_states);
+
+void apply_smdp_transition(smdp_model *model, int phase, const double *in, double *out);
+
+
+/* Allocates a model. Transitions, rewards and the macro have to be filled in
+   before calling finish_smdp_model(). Returns true (1) on success */
+int init_smdp_model(smdp_model *model, int car_states, int time_states, double discount){
+  int i, j, value_size;
+
+  memset(model, 0, sizeof(smdp_model));
+  model->car_states = car_states;
+  model->time_states = time_states;
+  model->discount = discount;
+  model->tensor_size = car_states * car_states * car_states * car_states;
+
+  value_size = SMDP_PHASES * time_states * model->tensor_size;
+
+  for(i = 0; i < SMDP_DIRECTIONS; i++)
+    for(j = 0; j < 2; j++)
+      model->transition[i][j] = (double *) calloc(car_states * car_states, sizeof(double));
+
+  model->lane_reward[0] = (double *) calloc(car_states, sizeof(double));
+  model->lane_reward[1] = (double *) calloc(car_states, sizeof(double));
+  model->time_advance = (double *) calloc(time_states, sizeof(double));
+
+  model->value = (double *) calloc(value_size, sizeof(double));
+  model->value_last = (double *) calloc(value_size, sizeof(double));
+  model->policy = (unsigned char *) calloc(value_size, sizeof(unsigned char));
+
+  for(i = 0; i < SMDP_PHASES; i++)
+    model->phase_reward[i] = (double *) calloc(model->tensor_size, sizeof(double));
+  for(i = 0; i < SMDP_WORK_TENSORS; i++){
+    model->work[i] = (double *) calloc(model->tensor_size, sizeof(double));
+    if(model->work[i] == NULL) return 0;
+  }
+
+  return model->value != NULL && model->value_last != NULL && model->policy != NULL;
+}
+
+void free_smdp_model(smdp_model *model){
+  int i, j;
+  for(i = 0; i < SMDP_DIRECTIONS; i++)
+    for(j = 0; j < 2; j++)
+      free(model->transition[i][j]);
+
+  free(model->lane_reward[0]);
+  free(model->lane_reward[1]);
+  free(model->time_advance);
+  free(model->value);
+  free(model->value_last);
+  free(model->policy);
+
+  for(i = 0; i < SMDP_PHASES; i++)
+    free(model->phase_reward[i]);
+  for(i = 0; i < SMDP_WORK_TENSORS; i++)
+    free(model->work[i]);
+
+  memset(model, 0, sizeof(smdp_model));
+}
+
+/* Sets up the forced sequence following ChangeSignal:
+   yellow in the current phase, yellow in the next phase, then minimum green */
+void set_smdp_macro(smdp_model *model, int yellow_steps, int min_green_steps){
+  int phase, k;
+
+  model->macro_length = 2 * yellow_steps + min_green_steps;
+  if(model->macro_length > MAX_MACRO_STEPS)
+    model->macro_length = MAX_MACRO_STEPS;
+
+  for(phase = 0; phase < SMDP_PHASES; phase++){
+    for(k = 0; k <= model->macro_length; k++){
+      model->macro_phase[phase][k] = (k <= yellow_steps) ? phase : (phase + 1) % SMDP_PHASES;
+    }
+  }
+}
+
+/* Precomputes the reward of every car tensor entry for each phase */
+void finish_smdp_model(smdp_model *model){
+  int phase, index, dir, rest, n = model->car_states;
+
+  for(phase = 0; phase < SMDP_PHASES; phase++){
+    for(index = 0; index < model->tensor_size; index++){
+      double total = 0;
+      rest = index;
+
+      /* The last direction varies fastest */
+      for(dir = SMDP_DIRECTIONS - 1; dir >= 0; dir--){
+        total += model->lane_reward[is_smdp_open(phase, dir)][rest % n];
+        rest /= n;
+      }
+      model->phase_reward[phase][index] = total;
+    }
+  }
+}
+
+/* Returns the index of a combination of car intervals {N, S, E, W} */
+int smdp_car_index(const smdp_model *model, const int *car_states){
+  int dir, index = 0;
+  for(dir = 0; dir < SMDP_DIRECTIONS; dir++)
+    index = index * model->car_states + car_states[dir];
+  return index;
+}
+
+int smdp_value_index(const smdp_model *model, int phase, int time_state, int car_index){
+  return (phase * model->time_states + time_state) * model->tensor_size + car_index;
+}
+
+/* Returns true (1) if the lanes of the given direction are open in a phase.
+   Directions 0 and 1 are north and south, 2 and 3 are east and west */
+int is_smdp_open(int phase, int direction){
+  return (direction < 2) == (phase == 0);
+}
+
+/* out[c] = sum over c' of the probability of going from c to c' times in[c'] */
+void apply_smdp_transition(smdp_model *model, int phase, const double *in, double *out){
+  int dir, n = model->car_states, stride = 1, outer, inner, from, to, blocks;
+  const double *source = in;
+  double *target, *matrix;
+
+  /* Contract one direction at a time, starting with the fastest varying */
+  for(dir = SMDP_DIRECTIONS - 1; dir >= 0; dir--){
+    target = (dir == 0) ? out : model->work[dir % 2];
+    matrix = model->transition[dir][is_smdp_open(phase, dir)];
+    blocks = model->tensor_size / (stride * n);
+
+    for(outer = 0; outer < blocks; outer++){
+      const double *src_block = source + outer * stride * n;
+      double *dst_block = target + outer * stride * n;
+
+      for(from = 0; from < n; from++){
+        double *dst = dst_block + from * stride;
+        for(inner = 0; inner < stride; inner++)
+          dst[inner] = 0;
+
+        for(to = 0; to < n; to++){
+          double p = matrix[from * n + to];
+          const double *src = src_block + to * stride;
+          if(p == 0) continue;
+          for(inner = 0; inner < stride; inner++)
+            dst[inner] += p * src[inner];
+        }
+      }
+    }
+
+    source = target;
+    stride *= n;
+  }
+}
+
+/* One Bellman backup of every decision state from value_last into value */
+void smdp_backup(smdp_model *model){
+  int phase, time_state, i, size = model->tensor_size, last_time = model->time_states - 1;
+  double *change = model->work[2], *next = model->work[3], *wait_value = model->work[4];
+  double discount = model->discount;
+
+  for(phase = 0; phase < SMDP_PHASES; phase++){
+    int other = (phase + 1) % SMDP_PHASES, k;
+
+    /* ChangeSignal: walk the forced macro backwards from the first decision
+       state of the other phase */
+    memcpy(change, model->value_last + smdp_value_index(model, other, 1, 0), size * sizeof(double));
+    for(k = model->macro_length; k >= 1; k--){
+      const double *reward = model->phase_reward[model->macro_phase[phase][k]];
+      for(i = 0; i < size; i++)
+        next[i] = reward[i] + discount * change[i];
+      apply_smdp_transition(model, model->macro_phase[phase][k - 1], next, change);
+    }
+
+    /* Time state 0 is the minimum green time which is part of the macro */
+    for(time_state = 1; time_state < model->time_states; time_state++){
+      double *value = model->value + smdp_value_index(model, phase, time_state, 0);
+      unsigned char *policy = model->policy + smdp_value_index(model, phase, time_state, 0);
+
+      /* Maximum green time reached, the signal has to change */
+      if(time_state == last_time){
+        memcpy(value, change, size * sizeof(double));
+        memset(policy, 1, size);
+        continue;
+      }
+
+      /* Wait: the phase stays and the time interval might move up */
+      {
+        const double *stay = model->value_last + smdp_value_index(model, phase, time_state, 0);
+        const double *advance = model->value_last + smdp_value_index(model, phase, time_state + 1, 0);
+        const double *reward = model->phase_reward[phase];
+        double up = model->time_advance[time_state];
+
+        for(i = 0; i < size; i++)
+          next[i] = reward[i] + discount * ((1.0 - up) * stay[i] + up * advance[i]);
+        apply_smdp_transition(model, phase, next, wait_value);
+      }
+
+      for(i = 0; i < size; i++){
+        policy[i] = change[i] > wait_value[i];
+        value[i] = policy[i] ? change[i] : wait_value[i];
+      }
+    }
+  }
+
+}
+
+/* The computed values become the values of the previous horizon */
+void smdp_swap_values(smdp_model *model){
+  double *temp = model->value_last;
+  model->value_last = model->value;
+  model->value = temp;
+}
+
+/* Returns the action (0 = wait, 1 = change signal) chosen in a decision state */
+int smdp_policy(const smdp_model *model, int phase, int time_state, const int *car_states){
+  if(time_state <= 0) return 0;
+  if(time_state >= model->time_states - 1) return 1;
+  return model->policy[smdp_value_index(model, phase, time_state, smdp_car_index(model, car_states))];
+}
+
+
+#endif /* SMDPSolver */
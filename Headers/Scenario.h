@@ -0,0 +1,218 @@
+#ifndef Scenario /* Include guard */
+#define Scenario
+
+/* ------------- Intersections described in a scenario file ------------- */
+/* A scenario file describes the intersection the simulations run, so
+   another intersection can be modeled without editing
+   Simulation_Constants.h. It is a text file with a keyword and its values
+   on every line, lines starting with # are comments:
+
+     street <name>                     the streets clockwise from the north arm of the picture
+     group <name>                      the signal groups
+     lane <street> <left|straight> <group>
+     phase <color of every group>      red, green, yellow_to_red or yellow_to_green
+     first_phase <index>               the phase a simulation starts in
+     min_green <seconds>
+     max_green <seconds>
+     yellow_time <seconds>
+
+   The streets and groups come before the lanes and phases that name them.
+   The phases follow each other in the order they are given and a change
+   goes from the last to the first. There are AMOUNT_OF_STREETS streets of
+   LANES_PER_STREET lanes, as the statistics, checkpoints and traces are
+   laid out by them, at most AMOUNT_OF_SIGNAL_DIRECTIONS groups and at most
+   MAX_SIGNAL_STATES phases. The file is compiled into current_scenario, so
+   the simulation looks everything up by index and never compares a name.
+   Scenarios/default.txt describes the built-in intersection */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Simulation_Constants.h"
+
+#define MAX_SCENARIO_PATH 200
+#define MAX_SCENARIO_LINE 256
+
+int load_scenario(const char *path, int *error_line);
+int read_scenario_line(scenario *s, char *line, int *streets);
+int check_scenario(const scenario *s, int streets);
+int find_scenario_name(char names[][MAX_NAME_LENGTH], int count, const char *name);
+int get_color_index(const char *color);
+void apply_scenario(simulation_state *sim_state);
+unsigned long long get_scenario_digest(const scenario *s);
+
+
+/* Compiles a scenario file into current_scenario. Has to be called before
+   the simulations are made, or be followed by apply_scenario(), and before
+   simulations run on several threads. Returns true (1) on success, on
+   failure the current scenario is kept and error_line is the line that was
+   not understood, or 0 if the file is missing or incomplete */
+int load_scenario(const char *path, int *error_line){
+  char line[MAX_SCENARIO_LINE];
+  FILE *fp = fopen(path, "r");
+  scenario s;
+  int streets = 0, line_number = 0, i, j;
+
+  *error_line = 0;
+  if(fp == NULL) return 0;
+
+  /* What is not given stays unset and fails the check */
+  memset(&s, 0, sizeof(scenario));
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    for(j = 0; j < LANES_PER_STREET; j++)
+      s.lane_groups[i][j] = -1;
+  s.first_phase = -1;
+  s.min_green = s.max_green = s.yellow_time = -1;
+
+  while(fgets(line, MAX_SCENARIO_LINE, fp) != NULL){
+    line_number++;
+    if(!read_scenario_line(&s, line, &streets)){
+      *error_line = line_number;
+      fclose(fp);
+      return 0;
+    }
+  }
+  fclose(fp);
+
+  if(!check_scenario(&s, streets))
+    return 0;
+
+  current_scenario = s;
+  return 1;
+}
+
+/* Adds a line of a scenario file to s. Returns false (0) if the line is not
+   understood */
+int read_scenario_line(scenario *s, char *line, int *streets){
+  char keyword[32], name[MAX_NAME_LENGTH + 1], lane_name[16], group_name[MAX_NAME_LENGTH + 1], colors[AMOUNT_OF_SIGNAL_DIRECTIONS + 1][32];
+  int street_index, group, lane_type, count, i;
+
+  if(sscanf(line, "%31s", keyword) != 1 || keyword[0] == '#')
+    return 1;
+
+  if(strcmp(keyword, "street") == 0){
+    if(sscanf(line, "%*s %20s", name) != 1 || strlen(name) >= MAX_NAME_LENGTH || *streets >= AMOUNT_OF_STREETS ||
+       find_scenario_name(s->street_names, *streets, name) >= 0)
+      return 0;
+    strcpy(s->street_names[(*streets)++], name);
+
+  }else if(strcmp(keyword, "group") == 0){
+    if(sscanf(line, "%*s %20s", name) != 1 || strlen(name) >= MAX_NAME_LENGTH || s->group_count >= AMOUNT_OF_SIGNAL_DIRECTIONS ||
+       find_scenario_name(s->group_names, s->group_count, name) >= 0)
+      return 0;
+    strcpy(s->group_names[s->group_count++], name);
+
+  }else if(strcmp(keyword, "lane") == 0){
+    if(sscanf(line, "%*s %20s %15s %20s", name, lane_name, group_name) != 3) return 0;
+
+    street_index = find_scenario_name(s->street_names, *streets, name);
+    group = find_scenario_name(s->group_names, s->group_count, group_name);
+    if(strcmp(lane_name, "left") == 0) lane_type = left_lane;
+    else if(strcmp(lane_name, "straight") == 0) lane_type = straight_right_lane;
+    else return 0;
+    if(street_index < 0 || group < 0 || s->lane_groups[street_index][lane_type] >= 0) return 0;
+    s->lane_groups[street_index][lane_type] = group;
+
+  }else if(strcmp(keyword, "phase") == 0){
+    count = sscanf(line, "%*s %31s %31s %31s %31s %31s", colors[0], colors[1], colors[2], colors[3], colors[4]);
+    if(count != s->group_count || s->phase_count >= MAX_SIGNAL_STATES) return 0;
+
+    for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++){
+      int color = i < count ? get_color_index(colors[i]) : red;
+      if(color < 0) return 0;
+
+      s->phases[s->phase_count][i] = color;
+      s->yellow_phases[s->phase_count] |= color == yellow_to_red || color == yellow_to_green;
+      s->opening_phases[s->phase_count] |= color == yellow_to_green;
+    }
+    s->phase_count++;
+
+  }else if(strcmp(keyword, "first_phase") == 0){
+    if(sscanf(line, "%*s %d", &(s->first_phase)) != 1) return 0;
+  }else if(strcmp(keyword, "min_green") == 0){
+    if(sscanf(line, "%*s %lf", &(s->min_green)) != 1) return 0;
+  }else if(strcmp(keyword, "max_green") == 0){
+    if(sscanf(line, "%*s %lf", &(s->max_green)) != 1) return 0;
+  }else if(strcmp(keyword, "yellow_time") == 0){
+    if(sscanf(line, "%*s %lf", &(s->yellow_time)) != 1) return 0;
+  }else{
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Returns true (1) if nothing is missing from a scenario */
+int check_scenario(const scenario *s, int streets){
+  int i, j;
+
+  if(streets != AMOUNT_OF_STREETS || s->group_count < 1 ||
+     s->phase_count < 1 || s->first_phase < 0 || s->first_phase >= s->phase_count ||
+     s->min_green < 0 || s->max_green < s->min_green || s->yellow_time < 0)
+    return 0;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    for(j = 0; j < LANES_PER_STREET; j++)
+      if(s->lane_groups[i][j] < 0) return 0;
+
+  return 1;
+}
+
+/* Returns the index of a name among the first count names, or -1 */
+int find_scenario_name(char names[][MAX_NAME_LENGTH], int count, const char *name){
+  int i;
+
+  for(i = 0; i < count; i++)
+    if(strcmp(names[i], name) == 0)
+      return i;
+  return -1;
+}
+
+/* Returns the signal_colors value of a color name, or -1 */
+int get_color_index(const char *color){
+  if(strcmp(color, "red") == 0) return red;
+  if(strcmp(color, "yellow_to_red") == 0) return yellow_to_red;
+  if(strcmp(color, "yellow_to_green") == 0) return yellow_to_green;
+  if(strcmp(color, "green") == 0) return green;
+  return -1;
+}
+
+/* Moves a simulation that was made before the scenario was loaded, and has
+   no cars yet, to the scenario */
+void apply_scenario(simulation_state *sim_state){
+  int i, j;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    for(j = 0; j < LANES_PER_STREET; j++)
+      sim_state->streets[i].lanes[j].lane_direction = get_lane_direction(i, j);
+  sim_state->current_signal_state = current_scenario.first_phase;
+}
+
+/* Returns a hash of everything a scenario describes, two scenarios with the
+   same digest run the same intersection */
+unsigned long long get_scenario_digest(const scenario *s){
+  unsigned long long digest = 14695981039346656037ULL;
+  int i;
+
+  /* The names up to their end, what follows is not part of the scenario */
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    add_to_digest(&digest, s->street_names[i], strlen(s->street_names[i]) + 1);
+  for(i = 0; i < s->group_count && i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++)
+    add_to_digest(&digest, s->group_names[i], strlen(s->group_names[i]) + 1);
+
+  add_to_digest(&digest, s->lane_groups, sizeof(s->lane_groups));
+  add_to_digest(&digest, s->phases, sizeof(s->phases));
+  add_to_digest(&digest, s->yellow_phases, sizeof(s->yellow_phases));
+  add_to_digest(&digest, s->opening_phases, sizeof(s->opening_phases));
+  add_to_digest(&digest, &(s->group_count), sizeof(int));
+  add_to_digest(&digest, &(s->phase_count), sizeof(int));
+  add_to_digest(&digest, &(s->first_phase), sizeof(int));
+  add_to_digest(&digest, &(s->min_green), sizeof(double));
+  add_to_digest(&digest, &(s->max_green), sizeof(double));
+  add_to_digest(&digest, &(s->yellow_time), sizeof(double));
+
+  return digest;
+}
+
+
+#endif /* Scenario */
@@ -10,6 +10,12 @@
 #include "ConsoleGraphics.h"
 #include "Simulation_Constants.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CAR_KERNEL_SSE2
+#endif
+
+
 /* ------------------------------------ Adjustable time constants ------------------------------------ */
 #define TICK_RATE 10 /* Amount of times to update simulation per. simulated sceond */
 #define MILLISEC_PER_TICK 1000 / TICK_RATE
@@ -20,6 +26,14 @@
 #define MAX_MILLIS_PER_FRAME 1000 / MAX_FRAME_RATE
 #define MAX_SKIPPED_FRAMES 5 /* Maximum amount of simulation physics updates between each rendered frame */
 
+#define SPAWN_TABLE_HOURS 26 /* Rows of the spawn tables, hour 25 stands for any later time */
+
+#define FORK_STAT_DAYS 2 /* Days of statistics of a fork, which may pass midnight once */
+
+#ifndef IDLE_FAST_FORWARD
+#define IDLE_FAST_FORWARD 1 /* Skip the car updates while no car is able to move, see fast_forward() */
+#endif
+
  /* Seed for random number generator used for spawning cars */
 
 /* --------------------------------------- Simulation Constants --------------------------------------- */
@@ -41,30 +55,95 @@
 #define E_C 2.71828
 #define SEC_PER_HOUR 3600
 
+/* The car following model, chosen at compile time */
+#include "Car_Following.h"
+
+/* The cars of two lanes are updated side by side for the model of the
+   report, see update_lanes() */
+#if defined(CAR_KERNEL_SSE2) && CAR_FOLLOWING_MODEL == CAR_MODEL_REPORT
+#define LANE_PAIR_KERNEL
+
+typedef struct lane_pair lane_pair;
+
+struct lane_pair{
+  lane *a, *b;
+  int ia, ib; /* The car of each lane updated last */
+  int step, cars; /* Cars updated in both lanes and behind the front car of the shorter lane */
+  __m128d front_position, front_speed; /* The car updated last in each lane, after its update */
+  __m128d open, left; /* Masks of the lanes that may drive over the stop line and of the left lanes */
+};
+
+void start_lane_pair(const simulation_state *sim_state, lane_pair *pair, lane *a, lane *b);
+void step_lane_pair(lane_pair *pair);
+void finish_lane_pair(simulation_state *sim_state, lane_pair *pair);
+#endif
 
 
 /* Functions for updating the simulation */
 void update_simulation(simulation_state *sim_state, double time_step, int new_signal);
 void tick(simulation_state *sim_state);
+void advance_clock(simulation_state *sim_state);
+void start_next_day(simulation_state *sim_state);
+
+/* Skipping ticks where nothing moves */
+int fast_forward(simulation_state *sim_state, int max_ticks);
+int is_quiescent(const simulation_state *sim_state);
+int is_lane_frozen(const simulation_state *sim_state, const lane *l);
+int is_car_frozen(const simulation_state *sim_state, const lane *l, int car_index);
 
 /* Update functions for individual cars */
+void update_lanes(simulation_state *sim_state);
+void update_every_lane(simulation_state *sim_state);
+void update_lane(simulation_state *sim_state, lane *l);
+int update_lane_front(simulation_state *sim_state, lane *l);
+int is_lane_moving(const simulation_state *sim_state, const lane *l);
+void get_free_accelerations(const double *speed, double *acceleration, int count);
 void update_car(simulation_state *sim_State, lane *current_lane, int car_index);
+int get_car_in_front(const lane *l, int car_index);
 void move_car(simulation_state *sim_state, lane *current_lane, int current_car_index, int car_in_front_index);
 void accelerate_car(lane *current_lane, int car_index, int car_in_front_index);
-double get_acceleration(double current_speed);
 void remove_car(simulation_state *sim_state, lane *current_lane, int car_index);
 
 /* Car spawning functions */
 void spawn_cars(simulation_state *sim_state);
-int get_car_spawn_count(double current_time, street road);
-void add_car(lane *l);
+void spawn_profile_cars(simulation_state *sim_state, int street_index);
+int get_car_spawn_count(double current_time, int street_index, random_stream *random);
+void add_car(simulation_state *sim_state, lane *l, random_stream *random);
+void place_car(simulation_state *sim_state, lane *l, double extra_distance);
+int reserve_lane(lane *l, int count);
+
+/* Recording and replaying the arrivals and signal changes */
+int start_recording(simulation_state *sim_state, trace_writer *writer, const char *path);
+void stop_recording(simulation_state *sim_state);
+void record_event(simulation_state *sim_state, int type, int street_index, int lane_type, double extra_distance);
+int start_replay(simulation_state *sim_state, trace_reader *reader, const char *path);
+void replay_spawns(simulation_state *sim_state);
+void run_replay(simulation_state *sim_state);
+int open_trace(simulation_state *sim_state, int mode, const char *path, trace_writer *writer, trace_reader *reader);
+void close_trace(simulation_state *sim_state);
+
+/* Per car telemetry */
+int start_telemetry(simulation_state *sim_state, telemetry_stream *stream, const char *path);
+long stop_telemetry(simulation_state *sim_state);
+void record_car_event(simulation_state *sim_state, const lane *l, int car_index, int type);
+
+/* Copies for looking ahead */
+int fork_simulation(simulation_state *fork, const simulation_state *source, unsigned long long stream);
+int fork_simulation_into(simulation_state *fork, const simulation_state *source, unsigned long long stream);
+void init_spawn_tables();
+void fill_spawn_tables();
 
 /* Math functions */
 int factorial(int a);
 double poisson_probability(double k, double lambda);
-double get_probability(double current_time, street road, int k);
+double get_probability(double current_time, int street_index, int k);
 
 
+/* Cumulative probability of spawning 0, 1 ... k cars in a spawn interval, for
+   each street and hour of the day. Filled by init_spawn_tables() */
+double spawn_table[AMOUNT_OF_STREETS][SPAWN_TABLE_HOURS][MAX_SPAWNED_CARS];
+platform_once spawn_tables_once = PLATFORM_ONCE_INIT;
+
 /* Functions for determining the spawn rate of cars at a given time */
 double get_soenderbro_spawn_rate(int time_step);
 double get_kjellerup_spawn_rate(int time_step);
@@ -72,32 +151,71 @@ double get_jylland_spawn_rate(int time_step);
 double get_fyensgade_spawn_rate(int time_step);
 
 /* Graphics */
-void render(simulation_state sim_state);
+void render(const simulation_state *sim_state);
 
 /* Misc */
 void change_signal(simulation_state *sim_state, int new_signal);
-int are_green_lanes_empty(simulation_state sim_state);
-int are_all_lanes_empty(simulation_state sim_state);
 void update_statistics(simulation_state *sim_state);
 
+/* Queries on the car counters, these never copy the simulation */
+int get_lane_car_count(const simulation_state *sim_state, int street_index, int lane_type);
+int get_signal_group_car_count(const simulation_state *sim_state, int signal_direction);
+int get_total_car_count(const simulation_state *sim_state);
+int are_green_lanes_empty(const simulation_state *sim_state);
+int are_all_lanes_empty(const simulation_state *sim_state);
+double get_car_wait_time(const simulation_state *sim_state, const lane *l, int car_index);
+double get_car_position(const simulation_state *sim_state, const lane *l, int car_index);
+
+/* Arrivals from traffic counts */
+#include "Arrival_Profile.h"
+#include "Scenario.h"
+
+/* The queue based engine, chosen per simulation */
+#include "Meso_Engine.h"
+
+/* Saving and loading the whole simulation */
+#include "Checkpoint.h"
 
 
 /* Runs simulation for 'time_step' amount of seconds. Changes current signal to new_signal  */
 void update_simulation(simulation_state *sim_state, double time_step, int new_signal){
   int skipped_frames = 0, frame_count = 0, simulation_running = 1, tick_count = 0, ticks_per_timestep = TICK_RATE * time_step;
-  clock_t next_tick_time = clock(), last_render_time = clock();
+  clock_t next_tick_time, last_render_time;
+  int signal_before = sim_state->current_signal_state;
+
+  /* A scheduled checkpoint is saved between two steps */
+  save_due_checkpoint(sim_state);
 
   /* Change signal if needed */
   change_signal(sim_state, new_signal);
+  if(sim_state->trace != NULL && sim_state->current_signal_state != signal_before)
+    record_event(sim_state, trace_signal, 0, 0, 0);
+
+  /* The meso engine has no cars to draw */
+  if(sim_state->engine == meso_engine){
+    update_meso(sim_state, ticks_per_timestep);
+    return;
+  }
 
   if(!sim_state->render_simulation){
-    int i;
-    for(i = 0; i < ticks_per_timestep; i++){
+    int i = 0;
+    while(i < ticks_per_timestep){
+#if IDLE_FAST_FORWARD
+      int skipped = fast_forward(sim_state, ticks_per_timestep - i);
+      if(skipped > 0){
+        i += skipped;
+        continue;
+      }
+#endif
       tick(sim_state);
+      i++;
     }
     return;
   }
 
+  /* Only a drawn simulation keeps to the wall clock, clock() is a system call */
+  next_tick_time = last_render_time = clock();
+
   /* Simulate the given timeframe  */
   /* Run in a loop that ensures the appropriate amount of ticks and renders per second */
   while(simulation_running){
@@ -122,7 +240,7 @@ void update_simulation(simulation_state *sim_state, double time_step, int new_si
     if(clock() - last_render_time > MAX_MILLIS_PER_FRAME){
       int sim_seconds = (int) sim_state->current_time;
       last_render_time = clock();
-      render(*sim_state);
+      render(sim_state);
       frame_count++;
 
       /* Prints simulation time*/
@@ -133,17 +251,16 @@ void update_simulation(simulation_state *sim_state, double time_step, int new_si
 
 /* Update simulation logic */
 void tick(simulation_state *sim_state){
-  street *streets = sim_state->streets;
-  int i, j, k, day;
+  init_car_model();
 
   /* Check if the yellow period has been exceeded and change signal if so */
   if(is_yellow(sim_state->current_signal_state)){
-    if(sim_state->time_since_change > MAX_YELLOW_TIME)
+    if(sim_state->time_since_change > current_scenario.yellow_time)
       change_signal(sim_state, 1);
 
-  }else if(are_all_lanes_empty(*sim_state)){
+  }else if(are_all_lanes_empty(sim_state)){
     /* Remove switching limitations if all lanes are empty */
-    sim_state->time_since_change = MIN_GREEN_TIME;
+    sim_state->time_since_change = current_scenario.min_green;
   }
 
   /* Spawn cars if needed */
@@ -153,20 +270,17 @@ void tick(simulation_state *sim_state){
   }
 
   /* Update cars in all lanes */
-  for(i = 0; i < AMOUNT_OF_STREETS; i++){
-    for(j = 0; j < LANES_PER_STREET; j++){
-      int car_count = streets[i].lanes[j].amount_of_cars;
-      int front_car_ind = streets[i].lanes[j].index_front_car;
+  update_lanes(sim_state);
 
-      for(k = front_car_ind; k < (car_count + front_car_ind); k++){
-        update_car(sim_state, &(streets[i].lanes[j]), k % MAX_AMOUNT_OF_CARS);
-      }
-    }
-  }
+  advance_clock(sim_state);
+}
 
-  day = sim_state->days_simulated;
+/* Moves the clock one tick forward and saves statistics when due */
+void advance_clock(simulation_state *sim_state){
+  int day = sim_state->days_simulated;
 
   /* Update time variables */
+  sim_state->tick_count++;
   sim_state->current_time += (1.0 / TICK_RATE);
   sim_state->time_since_change += (1.0 / TICK_RATE);
   sim_state->stats[day].time_since_data_save += (1.0 / TICK_RATE);
@@ -179,26 +293,128 @@ void tick(simulation_state *sim_state){
   }
 
   /* Check if current simulated time exceeds a day */
-  if(sim_state->current_time > (3600.0 * 24.0)){
-    sim_state->current_time -= (3600.0 * 24.0);
-    sim_state->last_spawn_time -= (3600.0 * 24.0);
+  if(sim_state->current_time > (3600.0 * 24.0))
+    start_next_day(sim_state);
+}
+
+/* Moves the clock back over midnight and starts the statistics of the next day */
+void start_next_day(simulation_state *sim_state){
+  sim_state->current_time -= (3600.0 * 24.0);
+  sim_state->last_spawn_time -= (3600.0 * 24.0);
+  if(!sim_state->quiet)
     printf("\nSimulated day : %d\n", sim_state->days_simulated);
-    sim_state->days_simulated += 1;
+  sim_state->days_simulated += 1;
+}
+
+/* Runs up to max_ticks ticks without updating the cars, as long as no car
+   is able to move and no car is due to spawn. The clock, the wait time of
+   every car and the statistics advance by the same additions as in tick(),
+   so the result is identical to ticking. Returns the amount of ticks run */
+int fast_forward(simulation_state *sim_state, int max_ticks){
+  street *streets = sim_state->streets;
+  int ticks = 0, i, j, k;
+
+  init_car_model();
+  if(!is_quiescent(sim_state))
+    return 0;
+
+  /* Signals only change on a yellow timeout or a new spawn from here on */
+  while(ticks < max_ticks && (sim_state->current_time - sim_state->last_spawn_time) <= SPAWN_INTERVAL){
+    if(sim_state->total_cars == 0){
+      sim_state->time_since_change = current_scenario.min_green;
+
+    }else{
+      /* Cars waiting for green only collect wait time */
+      for(i = 0; i < AMOUNT_OF_STREETS; i++){
+        for(j = 0; j < LANES_PER_STREET; j++){
+          lane *l = &(streets[i].lanes[j]);
+          for(k = l->index_front_car; k < (l->amount_of_cars + l->index_front_car); k++)
+            l->wait_time[k % l->capacity] += 1.0 / TICK_RATE;
+        }
+      }
+    }
+
+    advance_clock(sim_state);
+    ticks++;
+  }
+
+  return ticks;
+}
+
+/* Returns true (1) if a tick would not move any car or change the signal */
+int is_quiescent(const simulation_state *sim_state){
+  int i, j;
+
+  /* Yellow phases end by themselves and cars drive on green */
+  if(is_yellow(sim_state->current_signal_state) || !are_green_lanes_empty(sim_state))
+    return 0;
+
+  if(sim_state->total_cars == 0)
+    return 1;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      if(!is_lane_frozen(sim_state, &(sim_state->streets[i].lanes[j])))
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Returns true (1) if update_car() would leave every car in the lane where it is */
+int is_lane_frozen(const simulation_state *sim_state, const lane *l){
+  int k;
+
+  for(k = l->index_front_car; k < (l->amount_of_cars + l->index_front_car); k++){
+    if(!is_car_frozen(sim_state, l, k % l->capacity))
+      return 0;
   }
+
+  return 1;
+}
+
+/* Returns true (1) if update_car() would leave the car where it is. That is a
+   car standing in a red lane, either at the stop line or within reach of the
+   car in front of it */
+int is_car_frozen(const simulation_state *sim_state, const lane *l, int car_index){
+  const double *position = l->position;
+  int car_in_front_index = get_car_in_front(l, car_index);
+  double front_car_distance;
+
+  if(l->speed[car_index] != 0 || get_signal_color(sim_state->current_signal_state, l->lane_direction) != red)
+    return 0;
+
+  /* Accelerates, but is stopped at the stop line again */
+  if(car_in_front_index == -1)
+    return position[car_index] == 0;
+
+  front_car_distance = position[car_index] - (position[car_in_front_index] + CAR_LENGTH);
+
+  /* Would accelerate, or be moved up behind the car in front */
+  if(get_following_speed(0, get_acceleration(0), front_car_distance, l->speed[car_in_front_index]) != 0)
+    return 0;
+  if(front_car_distance <= SAFTETY_DISTANCE && position[car_index] != position[car_in_front_index] + SAFTETY_DISTANCE + CAR_LENGTH)
+    return 0;
+
+  return 1;
 }
 
 /* Change current signal if needed */
 void change_signal(simulation_state *sim_state, int new_signal){
   /* Don't change if yellow and within the 4 seconds minimum yellow time */
-  if(new_signal && !(is_yellow(sim_state->current_signal_state) && sim_state->time_since_change < MAX_YELLOW_TIME)){
+  if(new_signal && !(is_yellow(sim_state->current_signal_state) && sim_state->time_since_change < current_scenario.yellow_time)){
     sim_state->time_since_change = 0;
     sim_state->current_signal_state += 1;
-    sim_state->current_signal_state %= AMOUNT_OF_SIGNAL_STATES;
+    sim_state->current_signal_state %= current_scenario.phase_count;
+
+    if(sim_state->telemetry != NULL)
+      record_car_event(sim_state, NULL, 0, telemetry_signal);
   }
 }
 
 /* Displays current state with console graphics */
-void render(simulation_state sim_state){
+void render(const simulation_state *sim_state){
   int i, j, k;
   clear_pixels();
   draw_intersection();
@@ -206,14 +422,15 @@ void render(simulation_state sim_state){
   /* Render cars in all lanes */
   for(i = 0; i < AMOUNT_OF_STREETS; i++){
     for(j = 0; j < LANES_PER_STREET; j++){
-      int start_index = sim_state.streets[i].lanes[j].index_front_car;
-      for(k = start_index; k < sim_state.streets[i].lanes[j].amount_of_cars + start_index; k++)
-        draw_car(sim_state.streets[i].name, sim_state.streets[i].lanes[j].cars[k % MAX_AMOUNT_OF_CARS].position, j);
+      const lane *l = &(sim_state->streets[i].lanes[j]);
+      int start_index = l->index_front_car;
+      for(k = start_index; k < l->amount_of_cars + start_index; k++)
+        draw_car(i, l->position[k % l->capacity], j);
     }
   }
 
   /* Print number of cars in each lane */
-  draw_car_counts(sim_state.streets);
+  draw_car_counts(sim_state->streets);
 
   /* Clear console and render graphics */
   clear_console();
@@ -221,98 +438,293 @@ void render(simulation_state sim_state){
 }
 
 
-/* Updates simulation for a single car */
-void update_car(simulation_state *sim_state, lane *current_lane, int car_index){
-  car *current_car = &(current_lane->cars[car_index]);
-  int car_in_front_index = -1;
+/* Updates every car in every lane for a tick. Only the cars at the front of
+   a lane can leave it, and a car behind one that stays never reaches the
+   despawn position, so the rest of the cars only change their own lane.
+   The front cars are updated first in lane order, which keeps the order of
+   the additions to the statistics. The rest of the cars of two lanes are
+   updated side by side with SSE2, and two such pairs at once, as each car
+   waits for the car in front of it and the pairs do not. The results are
+   identical to update_lane() on every lane */
+void update_lanes(simulation_state *sim_state){
+#ifdef LANE_PAIR_KERNEL
+  lane *busy[AMOUNT_OF_STREETS * LANES_PER_STREET];
+  lane_pair pairs[AMOUNT_OF_STREETS * LANES_PER_STREET / 2];
+  int i, j, k, count = 0, steps;
+
+  /* The telemetry records the cars one at a time */
+  if(sim_state->telemetry == NULL){
+    for(i = 0; i < AMOUNT_OF_STREETS; i++)
+      for(j = 0; j < LANES_PER_STREET; j++)
+        if(update_lane_front(sim_state, &(sim_state->streets[i].lanes[j])) > 0)
+          busy[count++] = &(sim_state->streets[i].lanes[j]);
+
+    for(i = 0; i + 1 < count; i += 2)
+      start_lane_pair(sim_state, &(pairs[i / 2]), busy[i], busy[i + 1]);
+
+    for(i = 0; i + 1 < count / 2; i += 2){
+      steps = pairs[i].cars < pairs[i + 1].cars ? pairs[i].cars : pairs[i + 1].cars;
+      for(k = 0; k < steps; k++){
+        step_lane_pair(&(pairs[i]));
+        step_lane_pair(&(pairs[i + 1]));
+      }
+    }
+    for(i = 0; i < count / 2; i++){
+      while(pairs[i].step < pairs[i].cars)
+        step_lane_pair(&(pairs[i]));
+      finish_lane_pair(sim_state, &(pairs[i]));
+    }
 
-  /* Find index of the car in front of this one */
-  if(current_lane->amount_of_cars > 1 && car_index != current_lane->index_front_car){
-    car_in_front_index = (car_index - 1) % MAX_AMOUNT_OF_CARS;
+    /* A lane left without a partner is updated on its own */
+    if(count % 2 == 1)
+      for(k = 1; k < busy[count - 1]->amount_of_cars; k++)
+        update_car(sim_state, busy[count - 1], (busy[count - 1]->index_front_car + k) % busy[count - 1]->capacity);
+    return;
   }
+#endif
+
+  update_every_lane(sim_state);
+}
+
+/* Updates the lanes one after the other with update_lane() */
+void update_every_lane(simulation_state *sim_state){
+  int i, j;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    for(j = 0; j < LANES_PER_STREET; j++)
+      update_lane(sim_state, &(sim_state->streets[i].lanes[j]));
+}
+
+/* Computes the free road accelerations of a lane and updates its front car,
+   and the next one as long as the front car leaves. Returns the amount of
+   cars behind the front car that are left to update */
+int update_lane_front(simulation_state *sim_state, lane *l){
+  int car_count = l->amount_of_cars, front_car_ind = l->index_front_car, run, left;
+
+  if(car_count == 0) return 0;
+
+  run = l->capacity - front_car_ind;
+  if(run > car_count) run = car_count;
+  get_free_accelerations(l->speed + front_car_ind, l->acceleration + front_car_ind, run);
+  get_free_accelerations(l->speed, l->acceleration, car_count - run);
+
+  do{
+    left = l->amount_of_cars;
+    update_car(sim_state, l, l->index_front_car);
+  }while(l->amount_of_cars > 0 && l->amount_of_cars < left);
+
+  return l->amount_of_cars > 0 ? l->amount_of_cars - 1 : 0;
+}
+
+#ifdef LANE_PAIR_KERNEL
+/* Prepares the update of the cars behind the front cars of two lanes, whose
+   front cars have been updated and stay */
+void start_lane_pair(const simulation_state *sim_state, lane_pair *pair, lane *a, lane *b){
+  int open_a = -is_lane_moving(sim_state, a), open_b = -is_lane_moving(sim_state, b);
+  int left_a = -(a->lane_type == left_lane), left_b = -(b->lane_type == left_lane);
+
+  pair->a = a;
+  pair->b = b;
+  pair->ia = a->index_front_car;
+  pair->ib = b->index_front_car;
+  pair->step = 0;
+  pair->cars = (a->amount_of_cars < b->amount_of_cars ? a->amount_of_cars : b->amount_of_cars) - 1;
+  pair->front_position = _mm_set_pd(b->position[pair->ib], a->position[pair->ia]);
+  pair->front_speed = _mm_set_pd(b->speed[pair->ib], a->speed[pair->ia]);
+  pair->open = _mm_castsi128_pd(_mm_set_epi32(open_b, open_b, open_a, open_a));
+  pair->left = _mm_castsi128_pd(_mm_set_epi32(left_b, left_b, left_a, left_a));
+}
+
+/* Updates the next car of both lanes of a pair. The operations are those of
+   accelerate_car(), get_following_speed() and move_car() in the same order,
+   with a mask in place of every branch, so the results are identical */
+void step_lane_pair(lane_pair *pair){
+  const __m128d zero = _mm_setzero_pd(), tick_rate = _mm_set1_pd(TICK_RATE), max_speed = _mm_set1_pd(MAX_SPEED);
+  const __m128d car_length = _mm_set1_pd(CAR_LENGTH), safety = _mm_set1_pd(SAFTETY_DISTANCE), free_gap = _mm_set1_pd(SAFTETY_DISTANCE + 1.0);
+  lane *a = pair->a, *b = pair->b;
+  int ia, ib;
+  __m128d position, speed, acceleration, sum, move_dist, blocked, mask, moving, stop;
+
+  ia = pair->ia = pair->ia + 1 == a->capacity ? 0 : pair->ia + 1;
+  ib = pair->ib = pair->ib + 1 == b->capacity ? 0 : pair->ib + 1;
+  position = _mm_set_pd(b->position[ib], a->position[ia]);
+  speed = _mm_set_pd(b->speed[ib], a->speed[ia]);
+
+  /* The model of the report accelerates freely unless it is close to the car in front */
+  mask = _mm_cmpgt_pd(_mm_sub_pd(position, _mm_add_pd(pair->front_position, car_length)), free_gap);
+  acceleration = _mm_div_pd(_mm_and_pd(mask, _mm_set_pd(b->acceleration[ib], a->acceleration[ia])), tick_rate);
+  sum = _mm_add_pd(speed, acceleration);
+  mask = _mm_cmplt_pd(sum, zero);
+  acceleration = _mm_or_pd(_mm_and_pd(mask, _mm_sub_pd(zero, speed)), _mm_andnot_pd(mask, acceleration));
+  mask = _mm_cmpge_pd(sum, max_speed);
+  acceleration = _mm_or_pd(_mm_and_pd(mask, _mm_sub_pd(max_speed, speed)), _mm_andnot_pd(mask, acceleration));
+  speed = _mm_add_pd(speed, acceleration);
+
+  /* A car too close to the car in front is put right behind it, the others
+     stop at the left turn or at the stop line */
+  move_dist = _mm_div_pd(speed, tick_rate);
+  blocked = _mm_cmple_pd(_mm_sub_pd(_mm_sub_pd(position, move_dist), _mm_add_pd(pair->front_position, car_length)), safety);
+  moving = _mm_or_pd(pair->open, _mm_cmplt_pd(position, zero));
+  stop = _mm_and_pd(_mm_and_pd(moving, pair->left), _mm_cmplt_pd(_mm_sub_pd(position, move_dist), _mm_set1_pd(LEFT_DESPAWN_POSITION)));
+  move_dist = _mm_or_pd(_mm_and_pd(stop, _mm_sub_pd(position, _mm_set1_pd(LEFT_DESPAWN_POSITION))), _mm_andnot_pd(stop, move_dist));
+  speed = _mm_andnot_pd(stop, speed);
+  stop = _mm_andnot_pd(moving, _mm_cmplt_pd(_mm_sub_pd(position, move_dist), zero));
+  move_dist = _mm_or_pd(_mm_and_pd(stop, position), _mm_andnot_pd(stop, move_dist));
+  speed = _mm_andnot_pd(stop, speed);
+
+  speed = _mm_or_pd(_mm_and_pd(blocked, _mm_mul_pd(pair->front_speed, _mm_set1_pd(0.8))), _mm_andnot_pd(blocked, speed));
+  position = _mm_or_pd(_mm_and_pd(blocked, _mm_add_pd(_mm_add_pd(pair->front_position, safety), car_length)), _mm_andnot_pd(blocked, _mm_sub_pd(position, move_dist)));
+
+  _mm_storel_pd(&(a->position[ia]), position);
+  _mm_storeh_pd(&(b->position[ib]), position);
+  _mm_storel_pd(&(a->speed[ia]), speed);
+  _mm_storeh_pd(&(b->speed[ib]), speed);
+  a->wait_time[ia] += 1.0 / TICK_RATE;
+  b->wait_time[ib] += 1.0 / TICK_RATE;
+
+  pair->front_position = position;
+  pair->front_speed = speed;
+  pair->step++;
+}
+
+/* Updates the cars of the longer lane of a pair that have no partner */
+void finish_lane_pair(simulation_state *sim_state, lane_pair *pair){
+  int k;
+
+  for(k = pair->cars + 1; k < pair->a->amount_of_cars; k++)
+    update_car(sim_state, pair->a, (pair->a->index_front_car + k) % pair->a->capacity);
+  for(k = pair->cars + 1; k < pair->b->amount_of_cars; k++)
+    update_car(sim_state, pair->b, (pair->b->index_front_car + k) % pair->b->capacity);
+}
+#endif
+
+/* Returns true (1) if the signal lets the cars of a lane drive over the stop
+   line, as in move_car() */
+int is_lane_moving(const simulation_state *sim_state, const lane *l){
+  int lane_signal = get_signal_color(sim_state->current_signal_state, l->lane_direction);
+
+  return lane_signal == green || (lane_signal == yellow_to_green && sim_state->time_since_change > 1) || (lane_signal == yellow_to_red && sim_state->time_since_change < 2);
+}
+
+/* Updates every car in a lane for a tick, one car at a time from the front
+   as every car depends on the car in front, which has just moved. A whole
+   lane of accelerations computed up front with get_free_accelerations() is
+   slower than this, it only pays off for the lane pairs of update_lanes() */
+void update_lane(simulation_state *sim_state, lane *l){
+  int k, car_count = l->amount_of_cars, front_car_ind = l->index_front_car;
+
+  for(k = front_car_ind; k < (car_count + front_car_ind); k++){
+    l->acceleration[k % l->capacity] = get_acceleration(l->speed[k % l->capacity]);
+    update_car(sim_state, l, k % l->capacity);
+  }
+}
+
+/* Fills acceleration with get_acceleration() of count speeds, two at a time
+   with SSE2. The operations are the same as in get_acceleration(), so the
+   results are identical. Used for the lanes of update_lanes() */
+void get_free_accelerations(const double *speed, double *acceleration, int count){
+  int k = 0;
+
+#ifdef CAR_KERNEL_SSE2
+  const double *table = free_acceleration_table;
+  __m128d step, fraction, low, high;
+  int i[4];
+
+  for(; k + 2 <= count; k += 2){
+    step = _mm_mul_pd(_mm_loadu_pd(speed + k), _mm_set1_pd((double) FREE_ACCELERATION_STEPS / MAX_SPEED));
+    step = _mm_min_pd(_mm_max_pd(step, _mm_setzero_pd()), _mm_set1_pd(FREE_ACCELERATION_STEPS));
+
+    /* SSE2 has no gather, the table entries are loaded one by one */
+    _mm_storeu_si128((__m128i *) i, _mm_cvttpd_epi32(step));
+    fraction = _mm_sub_pd(step, _mm_set_pd(i[1], i[0]));
+    low = _mm_set_pd(table[i[1]], table[i[0]]);
+    high = _mm_set_pd(table[i[1] + 1], table[i[0] + 1]);
+
+    _mm_storeu_pd(acceleration + k, _mm_add_pd(low, _mm_mul_pd(_mm_sub_pd(high, low), fraction)));
+  }
+#endif
+
+  for(; k < count; k++)
+    acceleration[k] = get_acceleration(speed[k]);
+}
+
+/* Updates simulation for a single car, its free road acceleration must be set */
+void update_car(simulation_state *sim_state, lane *current_lane, int car_index){
+  /* Find index of the car in front of this one */
+  int car_in_front_index = get_car_in_front(current_lane, car_index), was_stopped = current_lane->speed[car_index] == 0;
 
   /* Update speed and position of the car */
   accelerate_car(current_lane, car_index, car_in_front_index);
   move_car(sim_state, current_lane, car_index, car_in_front_index);
 
+  if(sim_state->telemetry != NULL && was_stopped != (current_lane->speed[car_index] == 0))
+    record_car_event(sim_state, current_lane, car_index, was_stopped ? telemetry_start : telemetry_stop);
+
   /* Remove cars if possible */
-  if(current_car->position <= DESPAWN_POSITION){
+  if(current_lane->position[car_index] <= DESPAWN_POSITION){
     remove_car(sim_state, current_lane, car_index);
   }else{
-    current_car->wait_time += 1.0 / TICK_RATE;
+    current_lane->wait_time[car_index] += 1.0 / TICK_RATE;
   }
 }
 
-/* Update speed of the car */
-void accelerate_car(lane *current_lane, int car_index, int car_in_front_index){
-  car *current_car, car_in_front;
-  double front_car_distance, acceleration = 0.0;
-  current_car = &(current_lane->cars[car_index]);
-
-  /* If there is no car in front of this car set acceleration to a default value */
-  if(car_in_front_index == -1){
-    acceleration = (get_acceleration(current_car->speed));
-  }else{
-    /* Calculate distance to car in front */
-    car_in_front = current_lane->cars[car_in_front_index];
-    front_car_distance = current_car->position - (car_in_front.position + CAR_LENGTH);
-
-    if(front_car_distance > SAFTETY_DISTANCE + 1.0)
-      acceleration = get_acceleration(current_car->speed);
-  }
+/* Returns the index of the car in front of the given car, -1 if there is none */
+int get_car_in_front(const lane *l, int car_index){
+  if(l->amount_of_cars > 1 && car_index != l->index_front_car)
+    return (car_index + l->capacity - 1) % l->capacity;
+  return -1;
+}
 
-  /* Match acceleration to the simulated time step */
-  acceleration /= TICK_RATE;
+/* Update speed of the car with the car following model */
+void accelerate_car(lane *current_lane, int car_index, int car_in_front_index){
+  double *speed = current_lane->speed, *position = current_lane->position;
+  double front_car_distance = NO_CAR_IN_FRONT, front_speed = MAX_SPEED;
 
-  /* Make sure car does not accelerate above max speed */
-  if((current_car->speed + acceleration) >= MAX_SPEED){
-    acceleration = MAX_SPEED - current_car->speed;
-  }else if(current_car->speed + acceleration < 0.0){
-    acceleration = 0 - current_car->speed;
+  /* Calculate distance to car in front */
+  if(car_in_front_index != -1){
+    front_car_distance = position[car_index] - (position[car_in_front_index] + CAR_LENGTH);
+    front_speed = speed[car_in_front_index];
   }
 
-  current_car->speed += acceleration;
+  speed[car_index] = get_following_speed(speed[car_index], current_lane->acceleration[car_index], front_car_distance, front_speed);
 }
 
 /* Updates the position of the car */
 void move_car(simulation_state *sim_state, lane *current_lane, int current_car_index, int car_in_front_index){
-  car *current_car, car_in_front;
-  double move_dist;
+  double *speed = current_lane->speed, *position = current_lane->position, move_dist;
   int lane_signal = get_signal_color(sim_state->current_signal_state, current_lane->lane_direction);
 
-  current_car = &(current_lane->cars[current_car_index]);
-  move_dist = current_car->speed / TICK_RATE;
+  move_dist = speed[current_car_index] / TICK_RATE;
 
   /* If there is a car in front */
   if(car_in_front_index != -1){
     double front_car_distance;
-    car_in_front = current_lane->cars[car_in_front_index];
 
-    front_car_distance = (current_car->position - move_dist) - (car_in_front.position + CAR_LENGTH);
+    front_car_distance = (position[current_car_index] - move_dist) - (position[car_in_front_index] + CAR_LENGTH);
 
     if(front_car_distance <= SAFTETY_DISTANCE){
-      current_car->speed = car_in_front.speed * 0.8;
-      current_car->position = car_in_front.position + SAFTETY_DISTANCE + CAR_LENGTH;
+      speed[current_car_index] = get_blocked_speed(speed[car_in_front_index]);
+      position[current_car_index] = position[car_in_front_index] + SAFTETY_DISTANCE + CAR_LENGTH;
       return;
     }
   }
 
 
-  if(lane_signal == green || (lane_signal == yellow_to_green && sim_state->time_since_change > 1) || (lane_signal == yellow_to_red && sim_state->time_since_change < 2) || current_car->position < 0){
+  if(lane_signal == green || (lane_signal == yellow_to_green && sim_state->time_since_change > 1) || (lane_signal == yellow_to_red && sim_state->time_since_change < 2) || position[current_car_index] < 0){
     /* Stop left lane drivers in the middle of the intersection*/
-    if(current_lane->lane_type == left_lane && (current_car->position - move_dist) < LEFT_DESPAWN_POSITION){
-      move_dist = current_car->position - LEFT_DESPAWN_POSITION;
-      current_car->speed = 0;
+    if(current_lane->lane_type == left_lane && (position[current_car_index] - move_dist) < LEFT_DESPAWN_POSITION){
+      move_dist = position[current_car_index] - LEFT_DESPAWN_POSITION;
+      speed[current_car_index] = 0;
     }
 
   }else{
-    if((current_car->position - move_dist) < 0){
-      move_dist = current_car->position;
-      current_car->speed = 0;
+    if((position[current_car_index] - move_dist) < 0){
+      move_dist = position[current_car_index];
+      speed[current_car_index] = 0;
     }
   }
 
-  current_car->position -= move_dist;
+  position[current_car_index] -= move_dist;
 
   /* Hvis current_car->speed > fornt_car_speed - current_car_speed =  front_car_speed*/
 
@@ -323,17 +735,37 @@ void move_car(simulation_state *sim_state, lane *current_lane, int current_car_i
 void spawn_cars(simulation_state *sim_state){
   int i, j, spawned_cars;
 
+  /* The arrivals come from a trace */
+  if(sim_state->replay != NULL){
+    replay_spawns(sim_state);
+    return;
+  }
+
+  init_spawn_tables();
+
   /* Loop through all streets */
   for(i = 0; i < AMOUNT_OF_STREETS; i++){
-    /* Get amount of cars that should spawn in this street */
-    spawned_cars = get_car_spawn_count(sim_state->current_time, sim_state->streets[i]);
+    /* Cars in this street arrive from an upstream intersection */
+    if(sim_state->fed_streets[i]) continue;
+
+    /* Count files give the arrivals of every lane */
+    if(sim_state->arrivals != NULL){
+      spawn_profile_cars(sim_state, i);
+      continue;
+    }
+
+    /* Get amount of cars that should spawn in this street, a higher demand
+       adds independent draws which keeps the arrivals Poisson distributed */
+    spawned_cars = 0;
+    for(j = 0; j < sim_state->demand_factor; j++)
+      spawned_cars += get_car_spawn_count(sim_state->current_time, i, &(sim_state->spawn_random[i]));
 
     /* Spawn all the cars needed */
     for(j = 0; j < spawned_cars; j++){
       int spawn_lane = straight_right_lane, day = sim_state->days_simulated;
 
       /* Add new car to the simulation */
-      add_car(&(sim_state->streets[i].lanes[spawn_lane]));
+      add_car(sim_state, &(sim_state->streets[i].lanes[spawn_lane]), &(sim_state->spawn_random[i]));
 
       /* Update max queue length statistics if applicable */
       if(sim_state->stats[day].max_queue_length < sim_state->streets[i].lanes[spawn_lane].amount_of_cars){
@@ -343,95 +775,467 @@ void spawn_cars(simulation_state *sim_state){
   }
 }
 
-/* Return amount of cars that should be spawned on the given road in the next spawn interval seconds */
-int get_car_spawn_count(double current_time, street road){
-  int car_count = 0, i;
-  double sum_probability[MAX_SPAWNED_CARS], rand_num;
+/* Spawns the cars of a street that arrive in its lanes by the arrival profile */
+void spawn_profile_cars(simulation_state *sim_state, int street_index){
+  const arrival_profile *arrivals = sim_state->arrivals;
+  const arrival_rate *rates = get_arrival_rates(arrivals, get_profile_day(arrivals, sim_state->replica, sim_state->start_day + sim_state->days_simulated), sim_state->current_time);
+  lane *l = &(sim_state->streets[street_index].lanes[straight_right_lane]);
+  int j, spawned_cars = 0, day = sim_state->days_simulated;
 
-  /* Store probability of 1, 2 ... 10 cars spawning in the next time step */
-  /* sum_probability[0] is the probability of 0 cars spawning */
-  sum_probability[0] = get_probability(current_time, road, 0);
+  /* The counts of the left lane were added to this one when compiled */
+  for(j = 0; j < sim_state->demand_factor; j++)
+    spawned_cars += draw_arrivals(&rates[street_index * LANES_PER_STREET + straight_right_lane], &(sim_state->spawn_random[street_index]));
 
-  /* sum_probability[i] is the probability of i cars spawning */
-  for(i = 1; i < MAX_SPAWNED_CARS; i++){
-    sum_probability[i] = sum_probability[i - 1] + get_probability(current_time, road, i);
+  for(j = 0; j < spawned_cars; j++){
+    add_car(sim_state, l, &(sim_state->spawn_random[street_index]));
+
+    if(sim_state->stats[day].max_queue_length < l->amount_of_cars)
+      sim_state->stats[day].max_queue_length = l->amount_of_cars;
   }
+}
+
+/* Return amount of cars that should be spawned on the given road in the next spawn interval seconds */
+int get_car_spawn_count(double current_time, int street_index, random_stream *random){
+  int i, hour = ((int) current_time) / SEC_PER_HOUR;
+  const double *sum_probability;
+  double rand_num;
+
+  if(hour < 0 || hour >= SPAWN_TABLE_HOURS)
+    hour = SPAWN_TABLE_HOURS - 1;
+  sum_probability = spawn_table[street_index][hour];
 
   /* Generate random number */
-  rand_num = (double)rand()/RAND_MAX;
+  rand_num = random_uniform(random);
+
+  /* Find the interval the random number is within, no cars spawn in most
+     intervals so the search nearly always ends at the first entry */
+  if(rand_num < sum_probability[0])
+    return 0;
 
-  /* Check if the random numer is within the probability intervals */
   for(i = 1; i < MAX_SPAWNED_CARS; i++){
-    if(rand_num >= sum_probability[i - 1] && rand_num < sum_probability[i]){
-      car_count = i;
-      break;
+    if(rand_num < sum_probability[i])
+      return i;
+  }
+
+  return 0;
+}
+
+/* Fills the spawn tables the first time cars are spawned, whichever
+   simulation or thread gets there first */
+void init_spawn_tables(){
+  run_once(&spawn_tables_once, fill_spawn_tables);
+}
+
+/* The spawn rates only change on the hour, so the probabilities of each
+   hour are computed once instead of at every spawn */
+void fill_spawn_tables(){
+  int i, hour, k;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(hour = 0; hour < SPAWN_TABLE_HOURS; hour++){
+      double *sum_probability = spawn_table[i][hour];
+
+      /* sum_probability[k] is the probability of k or fewer cars spawning */
+      sum_probability[0] = get_probability(hour * SEC_PER_HOUR, i, 0);
+      for(k = 1; k < MAX_SPAWNED_CARS; k++)
+        sum_probability[k] = sum_probability[k - 1] + get_probability(hour * SEC_PER_HOUR, i, k);
     }
   }
+}
 
-  /* Return amount of cars to spawn */
-  return car_count;
+/* Adds a single car to a given lane. A lane that has reached
+   MAX_AMOUNT_OF_CARS or cannot grow turns the car away, which is counted */
+void add_car(simulation_state *sim_state, lane *l, random_stream *random){
+  /* Add a random distance between cars */
+  place_car(sim_state, l, random_uniform(random) * 5.0);
 }
 
-/* Adds a single car to a given lane */
-void add_car(lane *l){
-  int new_car_index = 0;
-  double spawn_position = CAR_SPAWN_POSITION, extra_distance = 0;
+/* Adds a car extra_distance behind the spawn position, or behind the last
+   car if that is further back. This is where arrivals are recorded */
+void place_car(simulation_state *sim_state, lane *l, double extra_distance){
+  int new_car_index = 0, day = sim_state->days_simulated;
+  double spawn_position = CAR_SPAWN_POSITION;
+
+  if(sim_state->trace != NULL)
+    record_event(sim_state, trace_spawn, l->street_index, l->lane_type, extra_distance);
+
+  if(!reserve_lane(l, l->amount_of_cars + 1)){
+    sim_state->stats[day].cars_turned_away += 1;
+    return;
+  }
 
   /* If there's already cars in the lane, find out where to spawn new car */
   if(l->amount_of_cars > 0){
     /* Find the index of car that is the furthest from the intersection */
-    int last_car_index = ((l->index_front_car) + (l->amount_of_cars) - 1) % MAX_AMOUNT_OF_CARS;
-    new_car_index = (last_car_index + 1) % MAX_AMOUNT_OF_CARS;
+    int last_car_index = ((l->index_front_car) + (l->amount_of_cars) - 1) % l->capacity;
+    new_car_index = (last_car_index + 1) % l->capacity;
 
     /* If the last car is at spawn location or further away, spawn new car just behind the last car */
-    if(l->cars[last_car_index].position > (CAR_SPAWN_POSITION - (CAR_LENGTH + SAFTETY_DISTANCE)))
-    spawn_position = l->cars[last_car_index].position + CAR_LENGTH + SAFTETY_DISTANCE;
+    if(get_car_position(sim_state, l, last_car_index) > (CAR_SPAWN_POSITION - (CAR_LENGTH + SAFTETY_DISTANCE)))
+    spawn_position = get_car_position(sim_state, l, last_car_index) + CAR_LENGTH + SAFTETY_DISTANCE;
   }else{
     l->index_front_car = 0;
   }
 
-  /* Add a random distance between cars */
-  extra_distance = ((double)rand()/RAND_MAX) * 5.0;
   spawn_position += extra_distance;
 
-  /* Add new car */
-  l->cars[new_car_index] = make_car(l->lane_type, MAX_SPEED, spawn_position, 1);
+  /* Add new car, cars spawn on whole meters */
+  l->position[new_car_index] = (int) spawn_position;
+  l->speed[new_car_index] = MAX_SPEED;
+  l->wait_time[new_car_index] = 0;
+  l->acceleration[new_car_index] = 0;
+  l->spawn_tick[new_car_index] = sim_state->engine == meso_engine ? (int) sim_state->tick_count : 0;
   l->amount_of_cars += 1;
+  sim_state->signal_group_cars[l->lane_direction] += 1;
+  sim_state->total_cars += 1;
+
+  if(sim_state->telemetry != NULL)
+    record_car_event(sim_state, l, new_car_index, telemetry_spawn);
+}
+
+/* Makes room for count cars in a lane. The storage doubles when full and the
+   cars are moved so the foremost car is first again. Returns false (0) if
+   the lane would exceed MAX_AMOUNT_OF_CARS or memory runs out */
+int reserve_lane(lane *l, int count){
+  int i, k, capacity;
+  double *block;
+  int *spawn_tick;
+
+  if(count <= l->capacity) return 1;
+  if(count > MAX_AMOUNT_OF_CARS) return 0;
+
+  capacity = l->capacity ? l->capacity * 2 : INITIAL_LANE_CAPACITY;
+  while(capacity < count) capacity *= 2;
+  if(capacity > MAX_AMOUNT_OF_CARS) capacity = MAX_AMOUNT_OF_CARS;
+
+  /* Four double arrays followed by the int array */
+  block = (double *) malloc(capacity * (4 * sizeof(double) + sizeof(int)));
+  if(block == NULL) return 0;
+  spawn_tick = (int *) (block + 4 * capacity);
+
+  for(i = 0; i < l->amount_of_cars; i++){
+    k = (l->index_front_car + i) % l->capacity;
+    block[i] = l->position[k];
+    block[capacity + i] = l->speed[k];
+    block[2 * capacity + i] = l->wait_time[k];
+    block[3 * capacity + i] = l->acceleration[k];
+    spawn_tick[i] = l->spawn_tick[k];
+  }
+
+  free(l->position);
+  l->position = block;
+  l->speed = block + capacity;
+  l->wait_time = block + 2 * capacity;
+  l->acceleration = block + 3 * capacity;
+  l->spawn_tick = spawn_tick;
+  l->capacity = capacity;
+  l->index_front_car = 0;
+  return 1;
+}
+
+/* Makes fork a copy of source that can be simulated on its own, for example
+   to try a signal plan. Only the cars in the lanes are copied, the spawn and
+   car model tables are shared. The statistics of the fork start at zero on
+   its day 0 and it should simulate less than a day, an arrival profile
+   gives it the arrivals of the day source is on. A fork is quiet. Its spawn
+   streams are forked from those of source with the given stream number, so
+   forks with the same number see the same arrivals. Returns false (0) if
+   memory runs out, the fork must be discarded with discard_simulation()
+   either way */
+int fork_simulation(simulation_state *fork, const simulation_state *source, unsigned long long stream){
+  int i, j;
+
+  /* An empty fork, fork_simulation_into() copies the rest */
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      lane *l = &(fork->streets[i].lanes[j]);
+      l->position = l->speed = l->wait_time = l->acceleration = NULL;
+      l->spawn_tick = NULL;
+      l->capacity = 0;
+    }
+  }
+
+  /* fork_simulation_into() clears the statistics of every day */
+  fork->days_simulated = FORK_STAT_DAYS - 1;
+  fork->stat_days = FORK_STAT_DAYS;
+  fork->stats = (statistics *) malloc(FORK_STAT_DAYS * sizeof(statistics));
+  if(fork->stats == NULL) return 0;
+
+  return fork_simulation_into(fork, source, stream);
+}
+
+/* Makes fork a fork of source like fork_simulation(), reusing the storage
+   fork already has from an earlier fork or a simulation_pool. The fork must
+   have at least FORK_STAT_DAYS days of statistics. Nothing is allocated
+   unless a lane of source has more cars than the lane of fork has room for.
+   Returns false (0) if memory runs out */
+int fork_simulation_into(simulation_state *fork, const simulation_state *source, unsigned long long stream){
+  lane storage[AMOUNT_OF_STREETS][LANES_PER_STREET];
+  statistics *stats = fork->stats;
+  int i, j, k, index, ok = 1, stat_days = fork->stat_days, days = fork->days_simulated + 1;
+
+  /* Only the days the storage was used for need clearing */
+  if(days > stat_days) days = stat_days;
+  for(i = 0; i < days; i++)
+    init_statistics(&(stats[i]));
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    for(j = 0; j < LANES_PER_STREET; j++)
+      storage[i][j] = fork->streets[i].lanes[j];
+
+  *fork = *source;
+  fork->render_simulation = 0;
+  fork->quiet = 1;
+  fork->start_day = source->start_day + source->days_simulated;
+  fork->days_simulated = 0;
+  fork->trace = NULL;
+  fork->replay = NULL;
+  fork->telemetry = NULL;
+  fork->checkpoint_path = NULL;
+  fork->stats = stats;
+  fork->stat_days = stat_days;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    fork_random_stream(&(fork->spawn_random[i]), &(source->spawn_random[i]), stream);
+
+    for(j = 0; j < LANES_PER_STREET; j++){
+      lane *l = &(fork->streets[i].lanes[j]);
+      l->position = storage[i][j].position;
+      l->speed = storage[i][j].speed;
+      l->wait_time = storage[i][j].wait_time;
+      l->acceleration = storage[i][j].acceleration;
+      l->spawn_tick = storage[i][j].spawn_tick;
+      l->capacity = storage[i][j].capacity;
+      l->index_front_car = 0;
+      l->amount_of_cars = 0;
+    }
+  }
+
+  /* The cars are stored from the front */
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      const lane *from = &(source->streets[i].lanes[j]);
+      lane *to = &(fork->streets[i].lanes[j]);
+
+      if(from->amount_of_cars == 0) continue;
+      if(!reserve_lane(to, from->amount_of_cars)){
+        ok = 0;
+        continue;
+      }
+
+      for(k = 0; k < from->amount_of_cars; k++){
+        index = (from->index_front_car + k) % from->capacity;
+        to->position[k] = from->position[index];
+        to->speed[k] = from->speed[index];
+        to->wait_time[k] = from->wait_time[index];
+        to->acceleration[k] = from->acceleration[index];
+        to->spawn_tick[k] = from->spawn_tick[index];
+      }
+      to->amount_of_cars = from->amount_of_cars;
+    }
+  }
+
+  return ok;
+}
+
+/* Records the arrivals and signal changes of a simulation from now on to
+   the file at path. The lanes must be empty. Returns true (1) on success */
+int start_recording(simulation_state *sim_state, trace_writer *writer, const char *path){
+  trace_header header;
+
+  if(sim_state->total_cars > 0) return 0;
+
+  memset(&header, 0, sizeof(trace_header));
+  header.demand_factor = sim_state->demand_factor;
+  header.current_time = sim_state->current_time;
+  header.time_since_change = sim_state->time_since_change;
+  header.last_spawn_time = sim_state->last_spawn_time;
+  header.signal_state = sim_state->current_signal_state;
+  header.start_tick = sim_state->tick_count;
+
+  if(!open_trace_writer(writer, path, &header)) return 0;
+  sim_state->trace = writer;
+  return 1;
+}
+
+/* Marks where the recording ends and closes the trace */
+void stop_recording(simulation_state *sim_state){
+  if(sim_state->trace == NULL) return;
+
+  record_event(sim_state, trace_end, 0, 0, 0);
+  close_trace_writer(sim_state->trace);
+  sim_state->trace = NULL;
+}
+
+void record_event(simulation_state *sim_state, int type, int street_index, int lane_type, double extra_distance){
+  trace_event event;
+
+  event.extra_distance = extra_distance;
+  event.tick = sim_state->tick_count;
+  event.type = (unsigned char) type;
+  event.street = (unsigned char) street_index;
+  event.lane = (unsigned char) lane_type;
+  event.signal_state = (unsigned char) sim_state->current_signal_state;
+  append_trace_event(sim_state->trace, &event);
+}
+
+/* Takes the arrivals of a simulation from the trace at path and puts the
+   simulation in the state the recording started from. The lanes must be
+   empty. Returns true (1) on success */
+int start_replay(simulation_state *sim_state, trace_reader *reader, const char *path){
+  if(sim_state->total_cars > 0 || !open_trace_reader(reader, path)) return 0;
+
+  sim_state->demand_factor = reader->header.demand_factor;
+  sim_state->current_time = reader->header.current_time;
+  sim_state->time_since_change = reader->header.time_since_change;
+  sim_state->last_spawn_time = reader->header.last_spawn_time;
+  sim_state->current_signal_state = reader->header.signal_state;
+  sim_state->tick_count = reader->header.start_tick;
+  sim_state->replay = reader;
+  return 1;
+}
+
+/* Places the cars that arrived in this tick of the trace. Signal changes
+   are passed over, they are only followed by run_replay() */
+void replay_spawns(simulation_state *sim_state){
+  trace_reader *reader = sim_state->replay;
+  const trace_event *event;
+  int day = sim_state->days_simulated;
+  lane *l;
+
+  while((event = peek_trace_event(reader)) != NULL && event->tick <= sim_state->tick_count && event->type != trace_end){
+    reader->next_event++;
+    if(event->type != trace_spawn || event->tick != sim_state->tick_count) continue;
+
+    l = &(sim_state->streets[event->street % AMOUNT_OF_STREETS].lanes[event->lane % LANES_PER_STREET]);
+    place_car(sim_state, l, event->extra_distance);
+
+    /* Update max queue length statistics if applicable */
+    if(sim_state->stats[day].max_queue_length < l->amount_of_cars)
+      sim_state->stats[day].max_queue_length = l->amount_of_cars;
+  }
 }
 
+/* Replays the whole trace as fast as possible, with the signal changes of the
+   recording, until the tick the recording stopped at */
+void run_replay(simulation_state *sim_state){
+  trace_reader *reader = sim_state->replay;
+  const trace_event *event;
+
+  while((event = peek_trace_event(reader)) != NULL){
+    if(event->type != trace_spawn && event->tick <= sim_state->tick_count){
+      if(event->type == trace_end) break;
+
+      change_signal(sim_state, 1);
+      reader->next_event++;
+      continue;
+    }
+
+    /* Spawns are placed by the tick they belong to */
+#if IDLE_FAST_FORWARD
+    if(event->tick > sim_state->tick_count && fast_forward(sim_state, event->tick - sim_state->tick_count) > 0)
+      continue;
+#endif
+    tick(sim_state);
+  }
+}
+
+/* Records to path (trace_record) or takes the arrivals from path
+   (trace_arrivals) for a controller. Returns true (1) on success */
+int open_trace(simulation_state *sim_state, int mode, const char *path, trace_writer *writer, trace_reader *reader){
+  if(mode == trace_record) return start_recording(sim_state, writer, path);
+  if(mode == trace_arrivals) return start_replay(sim_state, reader, path);
+  return 1;
+}
+
+/* Ends a recording or a replay */
+void close_trace(simulation_state *sim_state){
+  stop_recording(sim_state);
+  if(sim_state->replay != NULL){
+    close_trace_reader(sim_state->replay);
+    sim_state->replay = NULL;
+  }
+}
+
+/* Sends the events of every car and every signal change from now on to a
+   telemetry file at path. Returns true (1) on success */
+int start_telemetry(simulation_state *sim_state, telemetry_stream *stream, const char *path){
+  if(!open_telemetry_stream(stream, path, TICK_RATE, sim_state->current_time, sim_state->tick_count)) return 0;
+  sim_state->telemetry = stream;
+  return 1;
+}
+
+/* Waits for the writer to empty the ring and closes the file. Returns the
+   amount of events written */
+long stop_telemetry(simulation_state *sim_state){
+  long events;
+
+  if(sim_state->telemetry == NULL) return 0;
+
+  events = close_telemetry_stream(sim_state->telemetry);
+  sim_state->telemetry = NULL;
+  return events;
+}
+
+/* Pushes an event of the car at car_index in l, or a signal change if l is NULL */
+void record_car_event(simulation_state *sim_state, const lane *l, int car_index, int type){
+  telemetry_event event;
+
+  memset(&event, 0, sizeof(telemetry_event));
+  event.tick = sim_state->tick_count;
+  event.type = (unsigned char) type;
+  event.signal_state = (unsigned char) sim_state->current_signal_state;
+
+  if(l != NULL){
+    event.car = l->first_car_number + (car_index - l->index_front_car + l->capacity) % l->capacity;
+    event.position = (float) l->position[car_index];
+    event.speed = (float) l->speed[car_index];
+    event.wait_time = (float) l->wait_time[car_index];
+    event.street = (unsigned char) l->street_index;
+    event.lane = (unsigned char) l->lane_type;
+  }
+
+  push_telemetry(sim_state->telemetry, &event);
+}
 
 /* Removes the given car from the simulation */
 void remove_car(simulation_state *sim_state, lane *current_lane, int car_index){
-  int day = sim_state->days_simulated;
+  int day = sim_state->days_simulated, street_index = current_lane->street_index;
 
   /* Gather data for statistics */
   /* wait time = time spent - minimum time required to drive through the intersection */
-  current_lane->cars[car_index].wait_time -= ((CAR_SPAWN_POSITION - DESPAWN_POSITION) / MAX_SPEED);
+  current_lane->wait_time[car_index] -= ((CAR_SPAWN_POSITION - DESPAWN_POSITION) / MAX_SPEED);
 
   /* Rounding error due to tick rate can cause wait time to go negative */
-  if(current_lane->cars[car_index].wait_time < 0)
-    current_lane->cars[car_index].wait_time = 0;
+  if(current_lane->wait_time[car_index] < 0)
+    current_lane->wait_time[car_index] = 0;
 
   /* Add wait time to total wait time */
   sim_state->sim_car_count += 1;
-  sim_state->stats[day].total_wait_time += current_lane->cars[car_index].wait_time;
+  sim_state->stats[day].total_wait_time += current_lane->wait_time[car_index];
 
   /* Check if this is maximum wait time recorded so far */
-  if(current_lane->cars[car_index].wait_time > sim_state->stats[day].max_wait_time)
-    sim_state->stats[day].max_wait_time = current_lane->cars[car_index].wait_time;
+  if(current_lane->wait_time[car_index] > sim_state->stats[day].max_wait_time)
+    sim_state->stats[day].max_wait_time = current_lane->wait_time[car_index];
 
   /* Stats for individual lanes */
-  sim_state->stats[day].lane_wait_time[get_street_index(current_lane->street_name)][current_lane->lane_type] += current_lane->cars[car_index].wait_time;
-  sim_state->stats[day].cars_passed[get_street_index(current_lane->street_name)][current_lane->lane_type] += 1;
+  sim_state->stats[day].lane_wait_time[street_index][current_lane->lane_type] += current_lane->wait_time[car_index];
+  sim_state->stats[day].cars_passed[street_index][current_lane->lane_type] += 1;
+  sim_state->cars_left[street_index] += 1;
 
   /* Count car in stats */
   sim_state->stats[day].total_cars_passed += 1;
 
+  if(sim_state->telemetry != NULL)
+    record_car_event(sim_state, current_lane, car_index, telemetry_despawn);
+
   /* Remove car from array and simulation */
-  current_lane->cars[car_index].active = 0;
   current_lane->amount_of_cars -= 1;
+  sim_state->signal_group_cars[current_lane->lane_direction] -= 1;
+  sim_state->total_cars -= 1;
   current_lane->index_front_car++;
-  current_lane->index_front_car %= MAX_AMOUNT_OF_CARS;
+  current_lane->index_front_car %= current_lane->capacity;
+  current_lane->first_car_number++;
 }
 
 /* Updates statistics every simulated minute */
@@ -447,20 +1251,21 @@ void update_statistics(simulation_state *sim_state){
 }
 
 /* Returns the probability of k cars spawning within the SPAWN_INTERVAL */
-double get_probability(double current_time, street road, int k){
+double get_probability(double current_time, int street_index, int k){
   double cars_per_hour = 0, cars_per_timestep = 0;
 
-  /* Determine spawnrate for given street */
-  if(strcmp(road.name, street_names[0]) == 0)
+  /* Determine spawnrate for given street, the curves were fitted to the
+     streets of the built-in intersection in this order */
+  if(street_index == 0)
   cars_per_hour = get_kjellerup_spawn_rate(current_time);
 
-  else if(strcmp(road.name, street_names[1]) == 0)
+  else if(street_index == 1)
   cars_per_hour = get_fyensgade_spawn_rate(current_time);
 
-  else if(strcmp(road.name, street_names[2]) == 0)
+  else if(street_index == 2)
   cars_per_hour = get_soenderbro_spawn_rate(current_time);
 
-  else if(strcmp(road.name, street_names[3]) == 0)
+  else if(street_index == 3)
   cars_per_hour = get_jylland_spawn_rate(current_time);
 
   /* Convert to cars per spawn interval */
@@ -470,46 +1275,59 @@ double get_probability(double current_time, street road, int k){
 }
 
 
+/* Returns the amount of cars in a single lane */
+int get_lane_car_count(const simulation_state *sim_state, int street_index, int lane_type){
+  return sim_state->streets[street_index].lanes[lane_type].amount_of_cars;
+}
+
+/* Returns the amount of cars in all lanes that share a signal direction */
+int get_signal_group_car_count(const simulation_state *sim_state, int signal_direction){
+  return sim_state->signal_group_cars[signal_direction];
+}
+
+/* Returns the amount of cars in the intersection */
+int get_total_car_count(const simulation_state *sim_state){
+  return sim_state->total_cars;
+}
+
 /* Return true (1) if all lanes are empty */
-int are_all_lanes_empty(simulation_state sim_state) {
-  int i, j, is_empty = 1;
+int are_all_lanes_empty(const simulation_state *sim_state) {
+  return sim_state->total_cars == 0;
+}
 
-  /* Loop through all lanes */
-  for(i = 0; i < AMOUNT_OF_STREETS; i++){
-    for(j = 0; j < LANES_PER_STREET; j++){
-      lane l = sim_state.streets[i].lanes[j];
-      /* Check if a lane has green signal and has cars in it */
-      if(l.amount_of_cars > 0)
-        is_empty = 0;
-    }
-  }
+/* Returns the seconds a car has been in its lane so far */
+double get_car_wait_time(const simulation_state *sim_state, const lane *l, int car_index){
+  if(sim_state->engine == meso_engine)
+    return (sim_state->tick_count - (unsigned int) l->spawn_tick[car_index]) / (double) TICK_RATE;
+  return l->wait_time[car_index];
+}
 
-  return is_empty;
+/* Returns the meters of a car from the stop line. The meso engine drives
+   a car at MAX_SPEED from its spawn position and queues it at the stop line */
+double get_car_position(const simulation_state *sim_state, const lane *l, int car_index){
+  double position;
+
+  if(sim_state->engine != meso_engine)
+    return l->position[car_index];
+
+  position = l->position[car_index] - (sim_state->tick_count - (unsigned int) l->spawn_tick[car_index]) * ((double) MAX_SPEED / TICK_RATE);
+  return position > 0 ? position : 0;
 }
 
 /* Returns true (1) if all green lanes are empty */
-int are_green_lanes_empty(simulation_state sim_state) {
-  int i, j, is_empty = 1;
+int are_green_lanes_empty(const simulation_state *sim_state) {
+  int i;
 
-  /* Loop through all lanes */
-  for(i = 0; i < AMOUNT_OF_STREETS; i++){
-    for(j = 0; j < LANES_PER_STREET; j++){
-      /* Check if a lane has green signal and has cars in it */
-      lane l = sim_state.streets[i].lanes[j];
-      if(get_signal_color(sim_state.current_signal_state, l.lane_direction) == green && l.amount_of_cars > 0)
-        is_empty = 0;
-    }
+  /* Check if a signal direction is green and has cars in it */
+  for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++){
+    if(get_signal_color(sim_state->current_signal_state, i) == green && sim_state->signal_group_cars[i] > 0)
+      return 0;
   }
 
-  return is_empty;
+  return 1;
 }
 
 
-/* Returns acceleration in m/s^2 */
-double get_acceleration(double current_speed){
-  return (1.9625 * exp(0.093*(current_speed / 3.6)));
-}
-
 /* Returns the factorial of a */
 int factorial(int a){
   int i, result = 1;
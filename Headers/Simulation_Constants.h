@@ -6,6 +6,10 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "Random.h"
+#include "Trace.h"
+#include "Telemetry.h"
+
 #define RAND_SEED 29707329 /* Seed for the random number generator used for spawning cars */
 
 #define MAX_SIM_DAYS 14 /* Maximum amount of days worth of data saved */
@@ -16,11 +20,14 @@
 #define MAX_NAME_LENGTH 20 /* Max length of streetnames */
 
 #define MAX_SPAWNED_CARS 10
-#define MAX_AMOUNT_OF_CARS 200 /* Max amount of cars per lane */
+#define MAX_AMOUNT_OF_CARS 100000 /* Max amount of cars per lane, further cars are turned away */
+#define INITIAL_LANE_CAPACITY 8 /* Car slots of a lane when its first car arrives */
 
-#define AMOUNT_OF_SIGNAL_STATES 6
+#define AMOUNT_OF_SIGNAL_STATES 6 /* Phases of the built-in intersection, the states of the RL agent are laid out by them */
 #define AMOUNT_OF_SIGNAL_DIRECTIONS 4 /* Amount of lanes with signal light */
+#define MAX_SIGNAL_STATES 16 /* Phases a scenario can have */
 
+/* Timings of the built-in intersection, a scenario can change them */
 #define MAX_GREEN_TIME 120.0
 #define MIN_GREEN_TIME 13.0
 #define MAX_YELLOW_TIME 4.0
@@ -32,37 +39,56 @@
 typedef struct signal_state signal_state;
 typedef struct street street;
 typedef struct lane lane;
-typedef struct car car;
 typedef struct simulation_state simulation_state;
 typedef struct statistics statistics;
-
-struct car{
-  int direction; /* The direction the car turns */
-  int active; /* Whether the car is in the current simulation */
-  double speed; /* Current speed measured in m/s */
-  double position; /* Meters from being resolved */
-  double wait_time; /* Time from spawn to being removed */
-};
+typedef struct arrival_profile arrival_profile;
+typedef struct scenario scenario;
 
 struct lane{
-  char street_name[MAX_NAME_LENGTH];
+  int street_index; /* Index of the street in the scenario */
   int lane_type; /* Left lane or right lane */
   int lane_direction;
   int index_front_car; /* Index of the foremost car in the array of cars */
   int amount_of_cars; /* Total amount of active cars in this lane */
-  car cars[MAX_AMOUNT_OF_CARS];
+  int capacity; /* Slots in the car arrays, a ring that grows with the queue, see reserve_lane() */
+  unsigned int first_car_number; /* Telemetry number of the foremost car, the cars behind it count up */
+  unsigned int next_departure; /* Meso engine: first tick the next car may cross the stop line */
+  int was_open; /* Meso engine: the signal let cars cross in the last step */
+
+  /* The cars as one array per field, slot k of every array is the same car.
+     The arrays share a single allocation starting at position */
+  double *position; /* Meters from being resolved */
+  double *speed; /* Current speed measured in m/s */
+  double *wait_time; /* Time from spawn to being removed */
+  double *acceleration; /* Acceleration on a free road at the current speed, see update_lane() */
+  int *spawn_tick; /* Tick the car spawned at, only kept by the meso engine */
 };
 
 struct street{
-  char name[MAX_NAME_LENGTH]; /* Name of the street the car spawns on */
   lane lanes[LANES_PER_STREET];
 };
 
+/* The intersection as flat tables indexed by street, lane type, signal
+   group and phase. The names are only read when files are, the simulation
+   itself works on the indices. The built-in intersection is below and
+   load_scenario() in Scenario.h replaces it from a file */
+struct scenario{
+  char street_names[AMOUNT_OF_STREETS][MAX_NAME_LENGTH]; /* Clockwise from the north arm of the picture */
+  char group_names[AMOUNT_OF_SIGNAL_DIRECTIONS][MAX_NAME_LENGTH];
+  int lane_groups[AMOUNT_OF_STREETS][LANES_PER_STREET]; /* Signal group of every lane */
+  int phases[MAX_SIGNAL_STATES][AMOUNT_OF_SIGNAL_DIRECTIONS]; /* Signal color of every group in every phase */
+  int yellow_phases[MAX_SIGNAL_STATES]; /* Some group is yellow */
+  int opening_phases[MAX_SIGNAL_STATES]; /* Some group is yellow_to_green */
+  int group_count, phase_count, first_phase;
+  double min_green, max_green, yellow_time;
+};
+
 /* Statistics used for  */
 struct statistics{
   int gathered_data_points, gathered_car_data_points, total_cars_passed,
       cars_passed[AMOUNT_OF_STREETS][LANES_PER_STREET], max_queue_length,
-      cars_passed_over_time[DAILY_DATA_POINTS];
+      cars_passed_over_time[DAILY_DATA_POINTS],
+      cars_turned_away; /* Cars that did not fit in their lane */
 
   double time_since_data_save, time_passed, total_wait_time, max_wait_time,
          lane_wait_time[AMOUNT_OF_STREETS][LANES_PER_STREET],
@@ -74,7 +100,30 @@ struct simulation_state{
   street streets[AMOUNT_OF_STREETS];
   double current_time, time_since_change, last_spawn_time, time_scale;
   int current_signal_state, resolved_cars, render_simulation, days_simulated, sim_car_count;
+  int engine; /* micro_engine moves every car, meso_engine queues them, see Meso_Engine.h. Set before the first car */
+  int signal_group_cars[AMOUNT_OF_SIGNAL_DIRECTIONS]; /* Cars in the lanes of each signal direction, kept by add_car() and remove_car() */
+  int total_cars; /* Cars in all lanes */
+  int replica; /* Key of the random streams together with the seed, see seed_simulation_state() */
+  int start_day; /* Days simulated before day 0 of stats, a fork goes on with the day of its source */
+  unsigned long long seed;
+  random_stream spawn_random[AMOUNT_OF_STREETS]; /* Draws for the cars spawned in each street */
+  int fed_streets[AMOUNT_OF_STREETS]; /* Streets whose cars come from another intersection of a network instead of spawns */
+  int cars_left[AMOUNT_OF_STREETS]; /* Cars that have driven through from each street since the start */
+  int demand_factor; /* Each spawn interval draws this many times from the spawn tables */
+  int quiet; /* Prints nothing while it runs, set on forks and on the environments of Vector_Env */
+  unsigned int tick_count; /* Ticks simulated since the start */
+  trace_writer *trace; /* Records the arrivals and signal changes when set, see start_recording() */
+  trace_reader *replay; /* Gives the arrivals instead of the spawn streams when set, see start_replay() */
+  telemetry_stream *telemetry; /* Receives the events of every car when set, see start_telemetry() */
+  const arrival_profile *arrivals; /* Gives the arrival rates of every lane instead of the spawn tables when set, see Arrival_Profile.h */
+  const char *checkpoint_path; /* A checkpoint is saved here at checkpoint_tick when set, see schedule_checkpoint() */
+  unsigned int checkpoint_tick;
   statistics *stats;
+  int stat_days; /* Days of statistics that stats holds */
+};
+
+enum simulation_engine{
+  micro_engine, meso_engine
 };
 
 enum lane_type{
@@ -99,9 +148,13 @@ enum signal_state_label{
   yg_r, g_r, yr_r, r_yg, r_g, r_yr
 };
 
-/* Signal states of the format :
-{north_south, north_south_left, east_west, east_west_left} */
-const int signals[AMOUNT_OF_SIGNAL_STATES][AMOUNT_OF_SIGNAL_DIRECTIONS] = {
+/* The intersection every simulation runs, shared by all of them. Signal
+   states of the format : {north_south, north_south_left, east_west, east_west_left} */
+scenario current_scenario = {
+  {"Kjellerupsgade", "Fyensgade", "Soenderbro", "Jyllandsgade"},
+  {"north_south", "north_south_left", "east_west", "east_west_left"},
+  {{north_south_left, north_south}, {east_west_left, east_west}, {north_south_left, north_south}, {east_west_left, east_west}},
+  {
      {yellow_to_green, red, red, red},
      {green, red, red, red},
      {yellow_to_red, red, red, red},
@@ -109,177 +162,253 @@ const int signals[AMOUNT_OF_SIGNAL_STATES][AMOUNT_OF_SIGNAL_DIRECTIONS] = {
      {red, red, yellow_to_green, red},
      {red, red, green, red},
      {red, red, yellow_to_red, red}
- };
-
-const char *street_names[] = {"Kjellerupsgade","Fyensgade","Soenderbro","Jyllandsgade"};
+  },
+  {1, 0, 1, 1, 0, 1},
+  {1, 0, 0, 1, 0, 0},
+  AMOUNT_OF_SIGNAL_DIRECTIONS, AMOUNT_OF_SIGNAL_STATES, r_g,
+  MIN_GREEN_TIME, MAX_GREEN_TIME, MAX_YELLOW_TIME
+};
 
 /* Functions for initializing structs */
 void initialize_streets(street *streets);
 simulation_state make_simulation_state();
-street make_street(const char *streetname);
-lane make_lane(const char *streetname, int lane_type);
-car make_car(int direction, int speed, int position, int active);
+void init_simulation_state(simulation_state *sim_state, statistics *stats, int stat_days);
+void init_simulation_values(simulation_state *sim_state);
+void reset_simulation(simulation_state *sim_state, unsigned long long seed, int replica, double start_time);
+void init_statistics(statistics *stats);
+void seed_simulation_state(simulation_state *sim_state, unsigned long long seed, int replica);
+street make_street(int street_index);
+lane make_lane(int street_index, int lane_type);
 void discard_simulation(simulation_state *sim_state);
+void discard_lanes(simulation_state *sim_state);
 
-int get_lane_direction(const char *street_name, int lane_type);
-int get_opposing_street(const char *street_name);
+int get_lane_direction(int street_index, int lane_type);
+int get_opposing_street(int street_index);
 const char* get_street_name(int street_id);
 int get_signal_color(int current_signal_state, int lane_direction);
-int get_street_index(char *street_name);
+int get_street_index(const char *street_name);
 int is_yellow(int current_signal_state);
 
 
-/* Returns direction of a lane based on the street name and lane type */
-int get_lane_direction(const char *street_name, int lane_type){
-  if(strcmp(street_name, street_names[0]) == 0 || strcmp(street_name, street_names[2]) == 0){
-    if(lane_type == straight_right_lane)
-      return north_south;
-    else
-      return north_south_left;
-
-  }else{
-    if(lane_type == straight_right_lane)
-      return east_west;
-    else
-      return east_west_left;
-  }
-  return -1;
+/* Returns the signal group of a lane */
+int get_lane_direction(int street_index, int lane_type){
+  return current_scenario.lane_groups[street_index][lane_type];
 }
 
 /* Returns index of street opposite to given street */
-int get_opposing_street(const char *street_name){
-  int i;
-  for(i = 0; i < AMOUNT_OF_STREETS; i++){
-    if(strcmp(street_name, street_names[i]) == 0)
-      return ((i + 2) % 4);
-
-  }
-  return -1;
+int get_opposing_street(int street_index){
+  return (street_index + AMOUNT_OF_STREETS / 2) % AMOUNT_OF_STREETS;
 }
 
 /* Returns the name of a street given its' index */
 const char* get_street_name(int street_id){
   if(street_id >= 0 && street_id < AMOUNT_OF_STREETS)
-    return street_names[street_id];
+    return current_scenario.street_names[street_id];
   return "";
 }
 
 /* Returns the current of color of the signal for a given lane */
 int get_signal_color(int current_signal_state, int lane_direction){
-  return signals[current_signal_state][lane_direction];
+  return current_scenario.phases[current_signal_state][lane_direction];
 }
 
 /* Returns true if the current signal is yellow in any direction */
 int is_yellow(int current_signal_state){
-  int i;
-  for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++){
-    int cur_sig = signals[current_signal_state][i];
-    if(cur_sig == yellow_to_red || cur_sig == yellow_to_green){
-      return 1;
-    }
-  }
-
-  return 0;
+  return current_scenario.yellow_phases[current_signal_state];
 }
 
-/* Return index of a street given its' name */
-int get_street_index(char *street_name){
+/* Return index of a street given its' name or -1 if there is none, only
+   used when reading files */
+int get_street_index(const char *street_name){
   int i;
   for(i = 0; i < AMOUNT_OF_STREETS; i++){
-    if(strcmp(street_name, street_names[i]) == 0)
+    if(strcmp(street_name, current_scenario.street_names[i]) == 0)
       return i;
   }
-  return 0;
+  return -1;
 }
 
 /* Returns a simulation with default values */
 simulation_state make_simulation_state(){
-  int i, j;
   simulation_state new_sim;
-  initialize_streets(new_sim.streets);
-  new_sim.current_time = 0;
-  new_sim.time_since_change = 0;
-  new_sim.current_signal_state = r_g;
-  new_sim.resolved_cars = 0;
-  new_sim.render_simulation = 1;
-  new_sim.days_simulated = 0;
-  new_sim.sim_car_count = 0;
-  new_sim.time_scale = 1;
-  new_sim.last_spawn_time = 0;
 
   /* Allocate memory for statistic storage */
-  new_sim.stats = (statistics *) malloc(sizeof(statistics) * MAX_SIM_DAYS);
+  init_simulation_state(&new_sim, (statistics *) malloc(sizeof(statistics) * MAX_SIM_DAYS), MAX_SIM_DAYS);
+
+  return new_sim;
+}
+
+/* Makes a simulation with default values that keeps its statistics in
+   stats, which holds stat_days days */
+void init_simulation_state(simulation_state *sim_state, statistics *stats, int stat_days){
+  int j;
+
+  initialize_streets(sim_state->streets);
+  sim_state->stats = stats;
+  sim_state->stat_days = stat_days;
 
   /* Initialize statistics structs for all days */
-  for(j = 0; j < MAX_SIM_DAYS; j++){
-    new_sim.stats[j].time_since_data_save = 0;
-    new_sim.stats[j].time_passed = 0;
-    new_sim.stats[j].total_wait_time = 0;
-    new_sim.stats[j].max_wait_time = 0;
-    new_sim.stats[j].total_cars_passed = 0;
-    new_sim.stats[j].max_queue_length = 0;
-    new_sim.stats[j].gathered_data_points = 0;
-
-    for(i = 0; i < AMOUNT_OF_STREETS; i++){
-      new_sim.stats[j].lane_wait_time[i][left_lane] = 0;
-      new_sim.stats[j].lane_wait_time[i][straight_right_lane] = 0;
-      new_sim.stats[j].cars_passed[i][left_lane] = 0;
-      new_sim.stats[j].cars_passed[i][straight_right_lane] = 0;
-    }
+  for(j = 0; j < stat_days; j++)
+    init_statistics(&(sim_state->stats[j]));
+
+  init_simulation_values(sim_state);
+}
+
+/* Sets everything but the streets and the statistics to the default values */
+void init_simulation_values(simulation_state *sim_state){
+  int i;
+
+  sim_state->current_time = 0;
+  sim_state->time_since_change = 0;
+  sim_state->current_signal_state = current_scenario.first_phase;
+  sim_state->resolved_cars = 0;
+  sim_state->render_simulation = 1;
+  sim_state->engine = micro_engine;
+  sim_state->days_simulated = 0;
+  sim_state->start_day = 0;
+  sim_state->sim_car_count = 0;
+  sim_state->time_scale = 1;
+  sim_state->last_spawn_time = 0;
+  sim_state->total_cars = 0;
+  sim_state->demand_factor = 1;
+  sim_state->quiet = 0;
+  sim_state->tick_count = 0;
+  sim_state->trace = NULL;
+  sim_state->replay = NULL;
+  sim_state->telemetry = NULL;
+  sim_state->arrivals = NULL;
+  sim_state->checkpoint_path = NULL;
+  sim_state->checkpoint_tick = 0;
+  for(i = 0; i < AMOUNT_OF_SIGNAL_DIRECTIONS; i++)
+    sim_state->signal_group_cars[i] = 0;
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    sim_state->fed_streets[i] = 0;
+    sim_state->cars_left[i] = 0;
   }
 
   /* Initialize randomness used for spawning cars */
-  srand(RAND_SEED);
-  rand();
+  seed_simulation_state(sim_state, RAND_SEED, 0);
+}
 
-  return new_sim;
+/* Puts a used simulation back in the state make_simulation_state() gives,
+   seeded with (seed, replica) and starting at start_time. The lanes keep
+   their car storage and only the days that were simulated are cleared, the
+   others have not been written to. The lanes follow the signal groups of
+   the current scenario. Nothing is allocated */
+void reset_simulation(simulation_state *sim_state, unsigned long long seed, int replica, double start_time){
+  int i, j, days = sim_state->days_simulated + 1;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      lane *l = &(sim_state->streets[i].lanes[j]);
+      l->index_front_car = 0;
+      l->amount_of_cars = 0;
+      l->first_car_number = 0;
+      l->next_departure = 0;
+      l->was_open = 0;
+      l->lane_direction = get_lane_direction(i, j);
+    }
+  }
+
+  if(days > sim_state->stat_days) days = sim_state->stat_days;
+  for(i = 0; i < days; i++)
+    init_statistics(&(sim_state->stats[i]));
+
+  init_simulation_values(sim_state);
+  seed_simulation_state(sim_state, seed, replica);
+  sim_state->current_time = start_time;
+}
+
+/* Zeroes the counters of a day, the data points are written before they are read */
+void init_statistics(statistics *stats){
+  int i;
+
+  stats->time_since_data_save = 0;
+  stats->time_passed = 0;
+  stats->total_wait_time = 0;
+  stats->max_wait_time = 0;
+  stats->total_cars_passed = 0;
+  stats->max_queue_length = 0;
+  stats->gathered_data_points = 0;
+  stats->cars_turned_away = 0;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    stats->lane_wait_time[i][left_lane] = 0;
+    stats->lane_wait_time[i][straight_right_lane] = 0;
+    stats->cars_passed[i][left_lane] = 0;
+    stats->cars_passed[i][straight_right_lane] = 0;
+  }
+}
+
+/* Gives every street of a simulation its own random stream keyed by
+   (seed, replica, street). Replicas with the same seed and replica number
+   spawn the same cars, whatever else runs at the same time */
+void seed_simulation_state(simulation_state *sim_state, unsigned long long seed, int replica){
+  int i;
+
+  sim_state->seed = seed;
+  sim_state->replica = replica;
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    seed_random_stream(&(sim_state->spawn_random[i]), seed, (unsigned long long) replica, (unsigned long long) i);
 }
 
 /* Initilizes street structs */
 void initialize_streets(street streets[AMOUNT_OF_STREETS]){
   int i;
   for ( i = 0; i < AMOUNT_OF_STREETS; i++) {
-    streets[i] = make_street(street_names[i]);
+    streets[i] = make_street(i);
   }
 }
 
-street make_street(const char *streetname){
+street make_street(int street_index){
   street new_street;
-  strcpy(new_street.name, streetname);
 
-  new_street.lanes[straight_right_lane] = make_lane(streetname, straight_right_lane);
-  new_street.lanes[left_lane] = make_lane(streetname, left_lane);
+  new_street.lanes[straight_right_lane] = make_lane(street_index, straight_right_lane);
+  new_street.lanes[left_lane] = make_lane(street_index, left_lane);
 
   return new_street;
 }
 
-lane make_lane(const char *streetname, int lane_type){
-  int i;
+/* The lane gets its car storage when the first car arrives */
+lane make_lane(int street_index, int lane_type){
   lane new_lane;
-  strcpy(new_lane.street_name, streetname);
+  new_lane.street_index = street_index;
   new_lane.lane_type = lane_type;
-  new_lane.lane_direction = get_lane_direction(streetname, lane_type);
+  new_lane.lane_direction = get_lane_direction(street_index, lane_type);
   new_lane.index_front_car = 0;
   new_lane.amount_of_cars = 0;
-  for(i = 0; i < MAX_AMOUNT_OF_CARS; i++)
-    new_lane.cars[i] = make_car(0, 0, 0, 0);
+  new_lane.capacity = 0;
+  new_lane.first_car_number = 0;
+  new_lane.next_departure = 0;
+  new_lane.was_open = 0;
+  new_lane.position = NULL;
+  new_lane.speed = NULL;
+  new_lane.wait_time = NULL;
+  new_lane.acceleration = NULL;
+  new_lane.spawn_tick = NULL;
 
   return new_lane;
 }
 
-car make_car(int direction, int speed, int position, int active){
-  car new_car;
-  new_car.direction = direction;
-  new_car.speed = speed;
-  new_car.position = position;
-  new_car.active = active;
-  new_car.wait_time = 0;
-  return new_car;
-}
-
 /* Frees allocated memory in the given sim state */
 void discard_simulation(simulation_state *sim_state){
-    free(sim_state->stats);
+  discard_lanes(sim_state);
+  free(sim_state->stats);
+}
+
+/* Frees the car storage of every lane */
+void discard_lanes(simulation_state *sim_state){
+  int i, j;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      lane *l = &(sim_state->streets[i].lanes[j]);
+      free(l->position);
+      l->position = l->speed = l->wait_time = l->acceleration = NULL;
+      l->spawn_tick = NULL;
+      l->capacity = 0;
+    }
+  }
 }
 
 
@@ -0,0 +1,104 @@
+#ifndef SimulationPool /* Include guard */
+#define SimulationPool
+
+/* ------------- Simulations that are made once and reused ------------- */
+/* make_simulation_state() allocates the statistics of MAX_SIM_DAYS days and
+   every lane allocates its cars as the queue grows, which costs as much as a
+   short run. A pool makes its simulations once, with the statistics of all
+   of them in one block, and hands them out to be reset with
+   reset_simulation() or fork_simulation_into(). The lanes keep the storage
+   of the longest queue they have had, so a pooled simulation soon stops
+   allocating at all. Taking and returning simulations is safe from any
+   thread */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Simulation.h"
+#include "Platform.h"
+
+typedef struct simulation_pool simulation_pool;
+
+struct simulation_pool{
+  simulation_state *states;
+  statistics *stats; /* days_per_state days of every simulation */
+  int *free_states; /* Indices of the simulations that are not taken */
+  int size, days_per_state, free_count;
+  platform_mutex lock;
+};
+
+int make_simulation_pool(simulation_pool *pool, int size, int days_per_state);
+simulation_state *take_simulation(simulation_pool *pool);
+void return_simulation(simulation_pool *pool, simulation_state *sim_state);
+void discard_simulation_pool(simulation_pool *pool);
+
+
+/* Makes size simulations with days_per_state days of statistics each.
+   Returns false (0) if memory runs out */
+int make_simulation_pool(simulation_pool *pool, int size, int days_per_state){
+  int i;
+
+  pool->size = size;
+  pool->days_per_state = days_per_state;
+  pool->free_count = 0;
+  pool->states = (simulation_state *) malloc(size * sizeof(simulation_state));
+  pool->stats = (statistics *) malloc((size_t) size * days_per_state * sizeof(statistics));
+  pool->free_states = (int *) malloc(size * sizeof(int));
+
+  if(pool->states == NULL || pool->stats == NULL || pool->free_states == NULL){
+    free(pool->states);
+    free(pool->stats);
+    free(pool->free_states);
+    pool->states = NULL;
+    pool->stats = NULL;
+    pool->free_states = NULL;
+    pool->size = 0;
+    return 0;
+  }
+  init_mutex(&(pool->lock));
+
+  for(i = 0; i < size; i++){
+    init_simulation_state(&(pool->states[i]), pool->stats + (size_t) i * days_per_state, days_per_state);
+    pool->free_states[pool->free_count++] = size - 1 - i;
+  }
+
+  return 1;
+}
+
+/* Returns a simulation that no one else has taken, NULL if all are taken.
+   It is in the state it was returned in */
+simulation_state *take_simulation(simulation_pool *pool){
+  simulation_state *sim_state = NULL;
+
+  lock_mutex(&(pool->lock));
+  if(pool->free_count > 0)
+    sim_state = &(pool->states[pool->free_states[--pool->free_count]]);
+  unlock_mutex(&(pool->lock));
+
+  return sim_state;
+}
+
+void return_simulation(simulation_pool *pool, simulation_state *sim_state){
+  lock_mutex(&(pool->lock));
+  pool->free_states[pool->free_count++] = (int) (sim_state - pool->states);
+  unlock_mutex(&(pool->lock));
+}
+
+/* Frees every simulation of the pool, none may be taken */
+void discard_simulation_pool(simulation_pool *pool){
+  int i;
+
+  for(i = 0; i < pool->size; i++)
+    discard_lanes(&(pool->states[i]));
+
+  free(pool->states);
+  free(pool->stats);
+  free(pool->free_states);
+  destroy_mutex(&(pool->lock));
+  pool->states = NULL;
+  pool->stats = NULL;
+  pool->free_states = NULL;
+  pool->size = 0;
+}
+
+
+#endif /* SimulationPool */
@@ -0,0 +1,173 @@
+#ifndef Telemetry /* Include guard */
+#define Telemetry
+
+/* ------------- Per car telemetry written by a background thread ------------- */
+/* The simulation pushes fixed size telemetry_events into a ring that only it
+   writes to, and a writer thread takes them out in batches and appends them
+   to a binary file. Neither side takes a lock: the simulation publishes how
+   many events it pushed (head) and the writer how many it wrote (tail). The
+   simulation only waits if the writer falls a whole ring behind, which is
+   counted in the header.
+   The file starts with a telemetry_header, followed by the events in the
+   order they happened. A car is identified by its street, lane and car
+   number, the cars of a lane are numbered from 0 in the order they arrive */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#define TELEMETRY_MAGIC "TLTM"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_RING_SIZE 65536 /* Events, a power of two */
+#define TELEMETRY_BATCH 4096 /* Events the writer waits for before it writes */
+#define TELEMETRY_CACHE_LINE 64
+#define MAX_TELEMETRY_PATH 200
+
+typedef struct telemetry_header telemetry_header;
+typedef struct telemetry_event telemetry_event;
+typedef struct telemetry_stream telemetry_stream;
+
+enum telemetry_event_type{
+  telemetry_spawn, telemetry_stop, telemetry_start, telemetry_despawn, telemetry_signal
+};
+
+/* First 48 bytes of every telemetry file */
+struct telemetry_header{
+  char magic[4];
+  unsigned int version, event_size, tick_rate;
+  double start_time; /* Time of day of start_tick */
+  unsigned int start_tick; /* tick_count of the simulation when the stream was opened */
+  unsigned int event_count; /* Filled in when the stream is closed */
+  unsigned int producer_waits; /* Times the simulation waited for the writer */
+  unsigned int reserved[3];
+};
+
+/* A single event (24 bytes). Signal changes only fill in tick and signal_state */
+struct telemetry_event{
+  unsigned int tick; /* tick_count of the simulation */
+  unsigned int car; /* Number of the car in its lane */
+  float position, speed;
+  float wait_time; /* Despawns: the wait time counted in the statistics */
+  unsigned char type, street, lane, signal_state;
+};
+
+struct telemetry_stream{
+  /* Written by the simulation only */
+  volatile long head; /* Events pushed */
+  long cached_tail; /* Last tail seen, the ring has room up to here */
+  long producer_waits;
+  char head_padding[TELEMETRY_CACHE_LINE];
+
+  /* Written by the writer only */
+  volatile long tail; /* Events written to the file */
+  char tail_padding[TELEMETRY_CACHE_LINE];
+
+  volatile long stopping;
+  telemetry_event *ring;
+  FILE *fp;
+  platform_thread writer;
+  telemetry_header header;
+};
+
+int open_telemetry_stream(telemetry_stream *stream, const char *path, int tick_rate, double start_time, unsigned int start_tick);
+void push_telemetry(telemetry_stream *stream, const telemetry_event *event);
+long close_telemetry_stream(telemetry_stream *stream);
+void telemetry_writer(void *argument);
+
+
+/* Creates the file and starts the writer. Returns true (1) on success */
+int open_telemetry_stream(telemetry_stream *stream, const char *path, int tick_rate, double start_time, unsigned int start_tick){
+  memset(stream, 0, sizeof(telemetry_stream));
+
+  memcpy(stream->header.magic, TELEMETRY_MAGIC, 4);
+  stream->header.version = TELEMETRY_VERSION;
+  stream->header.event_size = sizeof(telemetry_event);
+  stream->header.tick_rate = tick_rate;
+  stream->header.start_time = start_time;
+  stream->header.start_tick = start_tick;
+
+  stream->ring = (telemetry_event *) malloc(TELEMETRY_RING_SIZE * sizeof(telemetry_event));
+  stream->fp = fopen(path, "wb");
+  if(stream->ring == NULL || stream->fp == NULL || fwrite(&(stream->header), sizeof(telemetry_header), 1, stream->fp) != 1 ||
+     !start_thread(&(stream->writer), telemetry_writer, stream)){
+    if(stream->fp != NULL) fclose(stream->fp);
+    free(stream->ring);
+    memset(stream, 0, sizeof(telemetry_stream));
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Adds an event to the ring. Only called by the simulation */
+void push_telemetry(telemetry_stream *stream, const telemetry_event *event){
+  long head = stream->head;
+
+  /* The writer's counter is only read when the ring looks full */
+  if(head - stream->cached_tail >= TELEMETRY_RING_SIZE){
+    stream->cached_tail = load_acquire(&(stream->tail));
+
+    while(head - stream->cached_tail >= TELEMETRY_RING_SIZE){
+      stream->producer_waits++;
+      sleep_milliseconds(1);
+      stream->cached_tail = load_acquire(&(stream->tail));
+    }
+  }
+
+  stream->ring[head & (TELEMETRY_RING_SIZE - 1)] = *event;
+  store_release(&(stream->head), head + 1);
+}
+
+/* Writes what is left in the ring, completes the header and closes the
+   file. Returns the amount of events written */
+long close_telemetry_stream(telemetry_stream *stream){
+  if(stream->fp == NULL) return 0;
+
+  store_release(&(stream->stopping), 1);
+  join_thread(&(stream->writer));
+
+  stream->header.event_count = (unsigned int) stream->tail;
+  stream->header.producer_waits = (unsigned int) stream->producer_waits;
+  fseek(stream->fp, 0, SEEK_SET);
+  fwrite(&(stream->header), sizeof(telemetry_header), 1, stream->fp);
+  fclose(stream->fp);
+  stream->fp = NULL;
+
+  free(stream->ring);
+  stream->ring = NULL;
+  return stream->tail;
+}
+
+/* The writer thread. It writes whole batches while the simulation runs and
+   everything that is left once the stream is stopping */
+void telemetry_writer(void *argument){
+  telemetry_stream *stream = (telemetry_stream *) argument;
+  long head, tail = stream->tail, count, index;
+  int stopping;
+
+  for(;;){
+    /* Read stopping first, every event pushed before it is then in head */
+    stopping = (int) load_acquire(&(stream->stopping));
+    head = load_acquire(&(stream->head));
+
+    if(head == tail && stopping) break;
+    if(head - tail < TELEMETRY_BATCH && !stopping){
+      sleep_milliseconds(1);
+      continue;
+    }
+
+    /* Up to the end of the ring, the rest is written in the next round */
+    index = tail & (TELEMETRY_RING_SIZE - 1);
+    count = head - tail;
+    if(count > TELEMETRY_RING_SIZE - index)
+      count = TELEMETRY_RING_SIZE - index;
+
+    fwrite(&(stream->ring[index]), sizeof(telemetry_event), count, stream->fp);
+    tail += count;
+    store_release(&(stream->tail), tail);
+  }
+}
+
+
+#endif /* Telemetry */
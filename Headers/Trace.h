@@ -0,0 +1,143 @@
+#ifndef Trace /* Include guard */
+#define Trace
+
+/* ------------- Traces of the arrivals and signal changes of a run ------------- */
+/* A trace starts with a trace_header holding the state the recording started
+   from, followed by fixed size trace_events in the order they happened:
+   every car placed in a lane with the random distance it was given, every
+   signal change asked for by the controller and an end marker. Replaying the
+   whole trace gives exactly the run that was recorded without drawing a
+   single random number. Replaying only the spawns lets another controller
+   face the same arrivals */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC "TLTR"
+#define TRACE_VERSION 2
+#define MAX_TRACE_PATH 200
+
+typedef struct trace_header trace_header;
+typedef struct trace_event trace_event;
+typedef struct trace_writer trace_writer;
+typedef struct trace_reader trace_reader;
+
+enum trace_event_type{
+  trace_spawn, trace_signal, trace_end
+};
+
+/* What a controller does with its trace file, see open_trace() */
+enum trace_mode{
+  trace_off, trace_record, trace_arrivals
+};
+
+/* First 64 bytes of every trace */
+struct trace_header{
+  char magic[4];
+  unsigned int version, event_size, demand_factor;
+  double current_time, time_since_change, last_spawn_time;
+  int signal_state;
+  unsigned int start_tick; /* tick_count of the simulation when the recording started */
+  unsigned int reserved[4];
+};
+
+/* A single event (16 bytes) */
+struct trace_event{
+  double extra_distance; /* Spawns: random distance behind the last car, see place_car() */
+  unsigned int tick; /* tick_count of the simulation when it happened */
+  unsigned char type, street, lane, signal_state;
+};
+
+struct trace_writer{
+  FILE *fp;
+  long events_written;
+};
+
+/* The whole trace is read into memory, replaying never waits for the disk */
+struct trace_reader{
+  trace_header header;
+  trace_event *events;
+  long event_count, next_event;
+};
+
+int open_trace_writer(trace_writer *writer, const char *path, const trace_header *header);
+void append_trace_event(trace_writer *writer, const trace_event *event);
+void close_trace_writer(trace_writer *writer);
+
+int open_trace_reader(trace_reader *reader, const char *path);
+const trace_event *peek_trace_event(const trace_reader *reader);
+void close_trace_reader(trace_reader *reader);
+
+
+/* Creates a trace starting with the given header. Returns true (1) on success */
+int open_trace_writer(trace_writer *writer, const char *path, const trace_header *header){
+  trace_header written = *header;
+
+  writer->events_written = 0;
+  writer->fp = fopen(path, "wb");
+  if(writer->fp == NULL) return 0;
+
+  memcpy(written.magic, TRACE_MAGIC, 4);
+  written.version = TRACE_VERSION;
+  written.event_size = sizeof(trace_event);
+  fwrite(&written, sizeof(trace_header), 1, writer->fp);
+  return 1;
+}
+
+void append_trace_event(trace_writer *writer, const trace_event *event){
+  if(writer->fp == NULL) return;
+  fwrite(event, sizeof(trace_event), 1, writer->fp);
+  writer->events_written++;
+}
+
+void close_trace_writer(trace_writer *writer){
+  if(writer->fp != NULL)
+    fclose(writer->fp);
+  writer->fp = NULL;
+}
+
+/* Reads a whole trace. Returns true (1) if it is a trace of this version */
+int open_trace_reader(trace_reader *reader, const char *path){
+  FILE *fp = fopen(path, "rb");
+  long size;
+
+  memset(reader, 0, sizeof(trace_reader));
+  if(fp == NULL) return 0;
+
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp) - (long) sizeof(trace_header);
+  fseek(fp, 0, SEEK_SET);
+
+  if(size < 0 || fread(&(reader->header), sizeof(trace_header), 1, fp) != 1 || memcmp(reader->header.magic, TRACE_MAGIC, 4) != 0 ||
+     reader->header.version != TRACE_VERSION || reader->header.event_size != sizeof(trace_event)){
+    fclose(fp);
+    return 0;
+  }
+
+  reader->event_count = size / (long) sizeof(trace_event);
+  reader->events = (trace_event *) malloc((reader->event_count > 0 ? reader->event_count : 1) * sizeof(trace_event));
+  if(reader->events == NULL || (long) fread(reader->events, sizeof(trace_event), reader->event_count, fp) != reader->event_count){
+    fclose(fp);
+    close_trace_reader(reader);
+    return 0;
+  }
+
+  fclose(fp);
+  return 1;
+}
+
+/* Returns the next event without taking it, NULL at the end of the trace */
+const trace_event *peek_trace_event(const trace_reader *reader){
+  if(reader->next_event >= reader->event_count) return NULL;
+  return &(reader->events[reader->next_event]);
+}
+
+void close_trace_reader(trace_reader *reader){
+  free(reader->events);
+  reader->events = NULL;
+  reader->event_count = 0;
+  reader->next_event = 0;
+}
+
+
+#endif /* Trace */
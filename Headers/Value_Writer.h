@@ -0,0 +1,90 @@
+#ifndef ValueWriter /* Include guard */
+#define ValueWriter
+
+/* ------------- Writes value arrays to disk on a background thread ------------- */
+/* The writer only reads the array it is given, so the solver can keep reading
+   the same array while it computes the next horizon into another buffer. The
+   array must not be modified until the write is finished, which is the case
+   when the next write is started or finish_value_write() returns. Files are
+   written under a temporary name and renamed when complete. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#define MAX_VALUE_PATH 200
+#define VALUE_WRITE_BUFFER (1 << 20)
+
+typedef struct value_writer value_writer;
+
+struct value_writer{
+  platform_thread thread;
+  int busy, failed;
+  char directory[MAX_VALUE_PATH], file_name[MAX_VALUE_PATH];
+  const double *values;
+  int count;
+};
+
+void init_value_writer(value_writer *writer);
+void start_value_write(value_writer *writer, const char *directory, const char *file_name, const double *values, int count);
+int finish_value_write(value_writer *writer);
+void write_value_file(void *argument);
+
+
+void init_value_writer(value_writer *writer){
+  memset(writer, 0, sizeof(value_writer));
+}
+
+/* Hands an array to the writer thread, after the previous write has finished */
+void start_value_write(value_writer *writer, const char *directory, const char *file_name, const double *values, int count){
+  finish_value_write(writer);
+
+  strcpy(writer->directory, directory);
+  strcpy(writer->file_name, file_name);
+  writer->values = values;
+  writer->count = count;
+  writer->busy = 1;
+
+  /* Write on this thread if a new one can not be started */
+  if(!start_thread(&(writer->thread), write_value_file, writer)){
+    write_value_file(writer);
+    writer->busy = 0;
+  }
+}
+
+/* Waits for the current write. Returns false (0) if any write has failed */
+int finish_value_write(value_writer *writer){
+  if(writer->busy){
+    join_thread(&(writer->thread));
+    writer->busy = 0;
+  }
+  return !writer->failed;
+}
+
+/* Writes every value in the format [Number] and moves the file into place */
+void write_value_file(void *argument){
+  value_writer *writer = (value_writer *) argument;
+  char temp_name[MAX_VALUE_PATH + 4];
+  FILE *fp;
+  int i;
+
+  make_directory(writer->directory);
+  sprintf(temp_name, "%s.tmp", writer->file_name);
+
+  fp = fopen(temp_name, "w");
+  if(fp == NULL){
+    writer->failed = 1;
+    return;
+  }
+  setvbuf(fp, NULL, _IOFBF, VALUE_WRITE_BUFFER);
+
+  for(i = 0; i < writer->count; i++)
+    fprintf(fp, "[%0.5f]", writer->values[i]);
+
+  if(fclose(fp) != 0 || !replace_file(temp_name, writer->file_name))
+    writer->failed = 1;
+}
+
+
+#endif /* ValueWriter */
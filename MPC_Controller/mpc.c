@@ -0,0 +1,321 @@
+#include "..\Headers\Simulation.h"
+#include "..\Headers\Simulation_Evaluation.h"
+#include "..\Headers\Monte_Carlo.h"
+#include "..\Headers\Run_Options.h"
+#include "..\Headers\Simulation_Pool.h"
+#include "..\Headers\Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <math.h>
+
+/* Model predictive controller. Every second the green phase may change, the
+   controller forks the simulation and plays candidate plans into the future:
+   switch now, in 5 s, in 10 s and so on, or keep the phase for the whole
+   horizon. Every plan is rolled out on the same samples of future arrivals
+   and the plan with the lowest wait time is followed for a second, after
+   which the controller plans again. The rollouts run on a thread pool and
+   stop starting new samples when the time budget of a decision runs out.
+   Every thread forks into a pooled simulation, so a rollout allocates
+   nothing once the lanes have grown */
+
+#define MPC_DECISION_INTERVAL 1.0 /* Seconds between decisions */
+#define MPC_PLAN_STEP 5 /* Seconds between the switch times of two plans */
+#define MPC_DEFAULT_HORIZON 30 /* Seconds looked ahead */
+#define MPC_DEFAULT_SAMPLES 2 /* Rollouts of every plan */
+#define MPC_DEFAULT_BUDGET 5.0 /* Milliseconds per decision */
+#define MPC_MAX_CANDIDATES 32
+#define MPC_MAX_SAMPLES 64
+
+typedef struct mpc_settings mpc_settings;
+typedef struct mpc_controller mpc_controller;
+
+struct mpc_settings{
+  int horizon, samples, threads;
+  double budget; /* Milliseconds */
+};
+
+struct mpc_controller{
+  mpc_settings settings;
+  int candidates; /* Plans, the last one keeps the phase */
+  thread_pool pool;
+  simulation_pool forks; /* A fork for every thread */
+
+  /* The decision being made */
+  const simulation_state *current;
+  double deadline;
+  unsigned long long decision; /* Keys the forked random streams */
+  double costs[MPC_MAX_CANDIDATES * MPC_MAX_SAMPLES];
+  char done[MPC_MAX_CANDIDATES * MPC_MAX_SAMPLES];
+
+  /* Wall time of every decision that rolled out plans */
+  double *latencies;
+  int decisions, latency_capacity;
+  long rollouts;
+};
+
+void start_mpc_controller(mpc_controller *mpc, const mpc_settings *settings);
+void stop_mpc_controller(mpc_controller *mpc);
+void sim_mpc(simulation_state *sim_state, void *context);
+void run_mpc_day(simulation_state *sim_state, mpc_controller *mpc);
+int mpc_decide(const simulation_state *sim_state, mpc_controller *mpc);
+int mpc_rollout(void *context, int task);
+double get_rollout_cost(const simulation_state *fork);
+void print_decision_latency(mpc_controller *mpc);
+int compare_doubles(const void *a, const void *b);
+
+
+int main() {
+  int renderSim, replicas = 1;
+  double startTime, simTimeScale = 1, targetWidth = 0;
+  simulation_state sim_state = make_simulation_state();
+  monte_carlo_summary summary;
+  run_options options;
+  mpc_settings settings;
+  mpc_controller mpc;
+
+  printf("Simulate with graphics OFF(0) or ON(1): ");
+  scanf("%d", &renderSim);
+
+  printf("\nStart time in seconds (0 = 00:00 and 28800 = 08:00): ");
+  scanf("%lf", &startTime);
+
+  if (renderSim){
+    printf("\nSimulation timescale (1.0 = realtime and 2.5 = 1 sec in real life is 2.5 sec in the simulation): ");
+    scanf("%lf", &simTimeScale);
+  }else{
+    printf("\nReplica days (1 = a single day): ");
+    scanf("%d", &replicas);
+
+    if (replicas > 1){
+      printf("\nStop when the 95%% confidence interval of the average wait time is narrower than (seconds, 0 = run every replica): ");
+      scanf("%lf", &targetWidth);
+    }
+  }
+
+  printf("\nSeconds to look ahead (default %d): ", MPC_DEFAULT_HORIZON);
+  if(scanf("%d", &settings.horizon) != 1 || settings.horizon < MPC_PLAN_STEP) settings.horizon = MPC_DEFAULT_HORIZON;
+
+  printf("\nRollouts of every plan (1 - %d, default %d): ", MPC_MAX_SAMPLES, MPC_DEFAULT_SAMPLES);
+  if(scanf("%d", &settings.samples) != 1 || settings.samples < 1 || settings.samples > MPC_MAX_SAMPLES) settings.samples = MPC_DEFAULT_SAMPLES;
+
+  printf("\nTime budget per decision in milliseconds (default %0.1f): ", MPC_DEFAULT_BUDGET);
+  if(scanf("%lf", &settings.budget) != 1 || settings.budget <= 0) settings.budget = MPC_DEFAULT_BUDGET;
+
+  /* Replica days already keep every processor busy */
+  settings.threads = 1;
+  if (replicas <= 1){
+    printf("\nThreads (0 = all processors): ");
+    if(scanf("%d", &settings.threads) != 1) settings.threads = 0;
+  }
+
+  /* The checkpoint, scenario, counts, trace and telemetry of the run */
+  prompt_run_options(&options, replicas, 1);
+  printf("Simulating...\n");
+
+  sim_state.current_time = startTime; /* Start time of day (measured in seconds past 00:00:00) */
+  sim_state.time_scale = simTimeScale;
+  sim_state.render_simulation = renderSim; /* Disable/enable rendering of simulation */
+  open_run_options(&options, &sim_state, replicas);
+
+  /* Summarise independent days instead of a single one */
+  if (replicas > 1){
+    run_monte_carlo(&summary, sim_mpc, &settings, startTime, options.checkpoint_mode == checkpoint_start ? &sim_state : NULL, options.counts_on ? &options.arrivals : NULL, replicas, targetWidth, 0);
+    print_monte_carlo_summary(&summary);
+    close_run_options(&options, &sim_state);
+    discard_simulation(&sim_state);
+
+    system("pause");
+    return 0;
+  }
+
+  /* Run the model predictive controller */
+  start_mpc_controller(&mpc, &settings);
+  run_mpc_day(&sim_state, &mpc);
+
+  /* Print and output statistics for the simulation */
+  print_stats(&sim_state);
+  print_decision_latency(&mpc);
+  close_run_options(&options, &sim_state);
+  output_statistics(&sim_state, "mpc");
+
+  /* Free memory */
+  stop_mpc_controller(&mpc);
+  discard_simulation(&sim_state);
+
+  system("pause");
+  return 0;
+}
+
+void start_mpc_controller(mpc_controller *mpc, const mpc_settings *settings){
+  memset(mpc, 0, sizeof(mpc_controller));
+  mpc->settings = *settings;
+
+  mpc->candidates = settings->horizon / MPC_PLAN_STEP + 1;
+  if(mpc->candidates > MPC_MAX_CANDIDATES)
+    mpc->candidates = MPC_MAX_CANDIDATES;
+
+  mpc->settings.threads = start_thread_pool(&(mpc->pool), settings->threads);
+  if(!make_simulation_pool(&(mpc->forks), mpc->settings.threads, FORK_STAT_DAYS)){
+    printf("Unable to allocate the forks of the controller\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void stop_mpc_controller(mpc_controller *mpc){
+  stop_thread_pool(&(mpc->pool));
+  discard_simulation_pool(&(mpc->forks));
+  free(mpc->latencies);
+  mpc->latencies = NULL;
+}
+
+/* Runs a replica day, context holds the settings */
+void sim_mpc(simulation_state *sim_state, void *context){
+  mpc_controller mpc;
+
+  start_mpc_controller(&mpc, (mpc_settings *) context);
+  run_mpc_day(sim_state, &mpc);
+  stop_mpc_controller(&mpc);
+}
+
+/* Run a full simulation with the model predictive controller */
+void run_mpc_day(simulation_state *sim_state, mpc_controller *mpc){
+  while(sim_state->days_simulated < 1)
+    update_simulation(sim_state, MPC_DECISION_INTERVAL, mpc_decide(sim_state, mpc));
+}
+
+/* Returns 1 to change the signal now, 0 to keep it */
+int mpc_decide(const simulation_state *sim_state, mpc_controller *mpc){
+  int candidate, sample, rounds, task, best;
+  double start, cost, best_cost = 0;
+
+  /* Cases that need no look ahead */
+  if(is_yellow(sim_state->current_signal_state) || sim_state->time_since_change < current_scenario.min_green)
+    return 0;
+  if(sim_state->time_since_change >= current_scenario.max_green)
+    return 1;
+  if(are_green_lanes_empty(sim_state))
+    return !are_all_lanes_empty(sim_state);
+
+  start = wall_time();
+  mpc->current = sim_state;
+  mpc->deadline = start + mpc->settings.budget / 1000.0;
+  mpc->decision++;
+  memset(mpc->done, 0, sizeof(mpc->done));
+
+  run_pool_tasks(&(mpc->pool), mpc_rollout, mpc, mpc->candidates * mpc->settings.samples);
+
+  /* Only samples rolled out for every plan are compared */
+  for(rounds = 0; rounds < mpc->settings.samples; rounds++){
+    for(candidate = 0; candidate < mpc->candidates; candidate++){
+      if(!mpc->done[rounds * mpc->candidates + candidate]) break;
+    }
+    if(candidate < mpc->candidates) break;
+  }
+
+  /* On equal costs the phase is kept the longest */
+  best = mpc->candidates - 1;
+  for(candidate = mpc->candidates - 1; rounds > 0 && candidate >= 0; candidate--){
+    cost = 0;
+    for(sample = 0; sample < rounds; sample++){
+      task = sample * mpc->candidates + candidate;
+      cost += mpc->costs[task];
+    }
+
+    if(candidate == mpc->candidates - 1 || cost < best_cost){
+      best = candidate;
+      best_cost = cost;
+    }
+  }
+
+  /* Keep the latency of every decision, a decision is left out of the
+     statistics if there is no memory to keep it */
+  if(mpc->decisions == mpc->latency_capacity){
+    int capacity = mpc->latency_capacity ? mpc->latency_capacity * 2 : 1024;
+    double *latencies = (double *) realloc(mpc->latencies, capacity * sizeof(double));
+
+    if(latencies != NULL){
+      mpc->latencies = latencies;
+      mpc->latency_capacity = capacity;
+    }
+  }
+  if(mpc->decisions < mpc->latency_capacity){
+    mpc->latencies[mpc->decisions++] = wall_time() - start;
+    mpc->rollouts += rounds * mpc->candidates;
+  }
+
+  return rounds > 0 && best == 0;
+}
+
+/* Rolls out plan task % candidates on sample task / candidates. Samples
+   after the first are skipped once the budget has run out */
+int mpc_rollout(void *context, int task){
+  mpc_controller *mpc = (mpc_controller *) context;
+  int candidate = task % mpc->candidates, sample = task / mpc->candidates, second;
+  simulation_state *fork;
+
+  if(sample > 0 && wall_time() > mpc->deadline)
+    return 0;
+
+  /* Every thread holds at most one fork */
+  fork = take_simulation(&(mpc->forks));
+  if(fork_simulation_into(fork, mpc->current, mpc->decision * MPC_MAX_SAMPLES + sample)){
+    /* The last plan keeps the phase for the whole horizon */
+    for(second = 0; second < mpc->settings.horizon; second++)
+      update_simulation(fork, MPC_DECISION_INTERVAL, candidate < mpc->candidates - 1 && second == candidate * MPC_PLAN_STEP);
+
+    mpc->costs[task] = get_rollout_cost(fork);
+    mpc->done[task] = 1;
+  }
+
+  return_simulation(&(mpc->forks), fork);
+  return 1;
+}
+
+/* Wait time of the cars that left during the rollout and of the cars still
+   waiting at its end. Cars that were there at the fork count the same in
+   every plan */
+double get_rollout_cost(const simulation_state *fork){
+  double cost = 0;
+  int i, j, k, day;
+
+  for(day = 0; day <= fork->days_simulated && day < FORK_STAT_DAYS; day++)
+    cost += fork->stats[day].total_wait_time;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++){
+    for(j = 0; j < LANES_PER_STREET; j++){
+      const lane *l = &(fork->streets[i].lanes[j]);
+      for(k = l->index_front_car; k < (l->amount_of_cars + l->index_front_car); k++)
+        cost += get_car_wait_time(fork, l, k % l->capacity);
+    }
+  }
+
+  return cost;
+}
+
+void print_decision_latency(mpc_controller *mpc){
+  double *sorted = mpc->latencies, total = 0;
+  int i;
+
+  printf("\n--------------- Decisions ---------------\n");
+  printf("Planned decisions     : %d on %d threads\n", mpc->decisions, mpc->settings.threads);
+  if(mpc->decisions == 0) return;
+
+  /* The latencies are not needed in their order any more */
+  qsort(sorted, mpc->decisions, sizeof(double), compare_doubles);
+  for(i = 0; i < mpc->decisions; i++)
+    total += sorted[i];
+
+  printf("Rollouts per decision : %0.1f\n", (double) mpc->rollouts / mpc->decisions);
+  printf("Latency mean          : %0.3f ms\n", 1000.0 * total / mpc->decisions);
+  printf("Latency p50 / p90 / p99 / max : %0.3f / %0.3f / %0.3f / %0.3f ms\n",
+         1000.0 * sorted[(int) (0.50 * (mpc->decisions - 1))], 1000.0 * sorted[(int) (0.90 * (mpc->decisions - 1))],
+         1000.0 * sorted[(int) (0.99 * (mpc->decisions - 1))], 1000.0 * sorted[mpc->decisions - 1]);
+}
+
+int compare_doubles(const void *a, const void *b){
+  double x = *((const double *) a), y = *((const double *) b);
+  return (x > y) - (x < y);
+}
@@ -0,0 +1,90 @@
+#include "..\Headers\Network.h"
+#include "..\Headers\Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Simulates a corridor (1 row) or a grid of intersections. Every signal is
+   actuated: it stays green for at least the minimum green time and changes
+   when its green lanes are empty while others wait, or when the maximum green
+   time is reached */
+
+#define NETWORK_MAX_GREEN 40.0
+
+int actuated_signal(const simulation_state *sim_state, int intersection, void *context);
+
+int main() {
+  network_state network;
+  int rows, columns, threads, i, day, cars_passed = 0, cars_waiting = 0;
+  double link_length, hours, start_time, max_green = NETWORK_MAX_GREEN, total_wait = 0, start, elapsed;
+
+  printf("Rows of intersections (1 = a corridor): ");
+  if(scanf("%d", &rows) != 1 || rows < 1) rows = 1;
+
+  printf("\nIntersections per row: ");
+  if(scanf("%d", &columns) != 1 || columns < 1) columns = 1;
+
+  printf("\nDistance between intersections in meters (default %0.0f): ", DEFAULT_LINK_LENGTH);
+  if(scanf("%lf", &link_length) != 1 || link_length <= 0) link_length = DEFAULT_LINK_LENGTH;
+
+  printf("\nStart time in seconds (0 = 00:00 and 28800 = 08:00): ");
+  if(scanf("%lf", &start_time) != 1) start_time = 0;
+
+  printf("\nHours to simulate (max 24): ");
+  if(scanf("%lf", &hours) != 1 || hours <= 0 || hours > 24) hours = 1;
+
+  printf("\nThreads (0 = all processors): ");
+  if(scanf("%d", &threads) != 1) threads = 0;
+  printf("Simulating...\n");
+
+  if(!make_network(&network, rows, columns, link_length, start_time)){
+    printf("Unable to allocate %d intersections\n", rows * columns);
+    return 1;
+  }
+
+  start = wall_time();
+  if(!run_network(&network, hours * SEC_PER_HOUR, actuated_signal, &max_green, threads)){
+    printf("Unable to allocate the cars between the intersections\n");
+    discard_network(&network);
+    return 1;
+  }
+  elapsed = wall_time() - start;
+
+  /* A car is counted at every intersection it drives through */
+  for(i = 0; i < network.intersection_count; i++){
+    for(day = 0; day <= network.intersections[i].days_simulated && day < MAX_SIM_DAYS; day++){
+      cars_passed += network.intersections[i].stats[day].total_cars_passed;
+      total_wait += network.intersections[i].stats[day].total_wait_time;
+    }
+    cars_waiting += get_total_car_count(&(network.intersections[i]));
+  }
+  for(i = 0; i < network.link_count; i++)
+    cars_waiting += network.links[i].count;
+
+  printf("\n%d x %d intersections, %d links, %0.1f hours\n", rows, columns, network.link_count, hours);
+  printf("Intersection passages: %d\n", cars_passed);
+  printf("Average wait time per intersection: %0.6f\n", cars_passed > 0 ? total_wait / cars_passed : 0);
+  printf("Cars still in the network: %d\n", cars_waiting);
+  printf("\nWall time: %0.3f s\n", elapsed);
+  printf("Simulated intersection hours per wall second: %0.1f\n", network.intersection_count * hours / elapsed);
+
+  discard_network(&network);
+  return 0;
+}
+
+/* Changes the signal when the green lanes are empty while cars wait elsewhere,
+   or when the green time reaches the maximum given by context */
+int actuated_signal(const simulation_state *sim_state, int intersection, void *context){
+  double max_green = *((double *) context);
+  (void) intersection;
+
+  if(is_yellow(sim_state->current_signal_state) || sim_state->time_since_change < MIN_GREEN_TIME)
+    return 0;
+
+  if(sim_state->time_since_change >= max_green)
+    return 1;
+
+  return are_green_lanes_empty(sim_state) && !are_all_lanes_empty(sim_state);
+}
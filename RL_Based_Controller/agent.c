@@ -7,10 +7,19 @@
 #include "..\Headers\AgentConstants.h"
 #include "..\Headers\Simulation.h"
 #include "..\Headers\Simulation_Evaluation.h"
+#include "..\Headers\Experience_Dataset.h"
+#include "..\Headers\SMDP_Solver.h"
+#include "..\Headers\Value_Writer.h"
+#include "..\Headers\Policy_Tree.h"
+#include "..\Headers\Monte_Carlo.h"
+#include "..\Headers\Run_Options.h"
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))                                                     /* Returns the minimum value of 2 inputs*/
 #define max(a, b) (((a) > (b)) ? (a) : (b))                                                     /* Returns the maximum value of 2 inputs*/
 
+#define EXPERIENCE_FOLDER "Experience"                                                          /* Folder for recorded experience datasets*/
+#define TREE_FEATURES 6                                                                         /* Raw cars {N, S, E, W}, signal phase and seconds since change*/
+
 void initializeValueArray();                                                                    /* Will initialize the V_last array to all zerro*/
 void GenerateValueArray();                                                                      /* Generates and saves every V array for each time horizon step*/
 double valueIteration(agent_state currentState);                                                /* Performs one value iteration*/
@@ -22,6 +31,7 @@ double Pr(int action, agent_state currentState, agent_state newState);
 double Pr_TimeChange(action action, agent_state currentState, agent_state newState);            /* The probability of a time interval change*/
 double Pr_SignalChange(action action, agent_state currentState, agent_state newState);          /* The probability of a signal change*/
 double Pr_CarIntervalChange(action action, agent_state currentState, agent_state newState);     /* The probability of all car interval changees*/
+double Pr_laneCarIntervalChange(agent_state currentState, agent_state newState, int dir);       /* The probability of the car interval change in a single direction*/
 
 double Pr_OPEN_stayCarInterval(agent_state currentState, int dir);                              /* The probability of staying in an interval when the lane is open*/
 double Pr_CLOSED_stayCarInterval(agent_state currentState, int dir);                            /* The probability of staying in an interval when the lane is closed*/
@@ -39,36 +49,69 @@ double Pr_carLoad(int C, int D);
 int isActionAvailable(action action, agent_state currentState);                                 /* Check if a certain action is available in the current state*/
 int isLaneOpen(agent_state currentState, int dir);                                              /* Check if a certain lane is available in the current state*/
 int isCarIntervalChangePossible(action action, agent_state currentState, agent_state newState); /* Check if a total car interval change is possible*/
+int isLaneIntervalChangePossible(int laneOpen, int currentIntervalID, int newIntervalID);       /* Check if a car interval change in a single direction is possible*/
 
 int factorialAgent(int f);                                                                      /* Returns the value of f!*/
 double poisson(int k, double lamda);                                                            /* Returns the probability according to a poisson distribution*/
 
-agent_state readCurrentState(simulation_state simState);                                        /* Returns the current state*/
+agent_state readCurrentState(const simulation_state *simState);                                        /* Returns the current state*/
 int convertCarInterval(int cars);                                                               /* Converts a ceartain amount of cars into it's interval ID*/
 int convertTimeInterval(double time_sec);                                                       /* Converts a ceartain amount of seconds into it's interval ID*/
 
 void output_ValueArray(int H);                                                                  /* Outputs a formatted file of the current value array*/
+void swapValueArrays();                                                                         /* Makes the current value array the last value array*/
 void readData(double discount, int H);                                                          /* Reads and includes a formatted file of a previous value array*/
 
+void initializeSMDPModel();                                                                     /* Builds the semi-MDP model from the interval transition probabilities*/
+void GenerateSMDPValueArray();                                                                  /* Generates and saves the semi-MDP value array for each time horizon step*/
+int isSMDPDecisionState(agent_state currentState);                                              /* Check if the semi-MDP controller makes a decision in the current state*/
+int signalPhase(int signalState);                                                               /* Converts a green / red signal state into a semi-MDP phase*/
+void output_SMDPValueArray(int H);                                                              /* Outputs a formatted file of the current semi-MDP value array*/
+void readSMDPData(double discount, int H);                                                      /* Reads a semi-MDP value array and derives its policy*/
+
+int tableAction(agent_state currentState);                                                      /* The action of the value array or semi-MDP policy in the current state*/
+int agentAction(const simulation_state *simState, agent_state currentState);                    /* The action of the chosen controller in the current state*/
+void simulateAgentDay(simulation_state *simState, void *context);                               /* Controls the intersection until a day has been simulated*/
+int isDecisionState(agent_state currentState);                                                  /* Check if the controller has a free choice between both actions*/
+void readTreeFeatures(const simulation_state *simState, int *features);                         /* Reads the raw measurements the decision tree splits on*/
+void distillPolicy(int maxDepth);                                                               /* Compresses the policy into a decision tree and reports its fidelity*/
+void output_PolicyTree(int maxDepth);                                                           /* Outputs the decision tree as a list of nested rules*/
+void benchmarkPolicy();                                                                         /* Measures the time per decision of the table and the tree*/
+
 int sizeOfFullInterval(int A, int B);                                                           /* Calculates the size of a full interval. Example: |[A;B]|*/
 int sizeOfInnerInterval(int A, int B);                                                          /* Calculates the size of an inner interval. Example: |]A;B[]|*/
 int sizeOfEdgeInterval(int A, int B);                                                           /* Calculates the size of an edge interval. Example: |[A;B[| or |]A;B]|*/
 
 void checkForErrors(int error, char *error_Msg);                                                /* Exits the program with an error msg if an error is detected*/
 
-double V[TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_SIGNAL_STATES][TOTAL_TIME_STATES];         /* The value array*/
-double V_last[TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_SIGNAL_STATES][TOTAL_TIME_STATES];    /* The last value array*/
+double valueBuffers[2][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_SIGNAL_STATES][TOTAL_TIME_STATES];  /* Storage for both value arrays*/
+double (*V)[TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_SIGNAL_STATES][TOTAL_TIME_STATES] = valueBuffers[0];                /* The value array*/
+double (*V_last)[TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_SIGNAL_STATES][TOTAL_TIME_STATES] = valueBuffers[1];           /* The last value array*/
+value_writer valueWriter;                                                                                                                   /* Writes finished value arrays in the background*/
 
 int fac[10] = {1,1,2,6,24,120,720,5040,40320,32880};  /* A factorial look up table */
 double discountValue; /* The discount value */
 int timeHorizon;      /* The time horizon   */
+int semiMDP;          /* Whether the semi-MDP solver is used */
+smdp_model smdp;      /* The semi-MDP model over decision states only */
+int treeController;   /* Whether the distilled decision tree controls the signal */
+
+policy_tree policyTree;    /* The distilled policy */
+tree_samples treeSamples;  /* Every decision state with the action of the full policy */
+signed char policyTable[TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_SIGNAL_STATES][TOTAL_TIME_STATES];  /* Action of the full policy in each decision state, -1 elsewhere*/
 
 int main(void) {
   simulation_state simState;
   agent_state currentState;
-  int action, scans, sim, simGraphics;
-  double startTime, simTimeScale = 1;
-  char outputFileName[100];
+  int action, scans, sim, simGraphics, experienceShard = -1, treeDepth, treeDecisions = 0, treeAgreements = 0, replicas = 1;
+  double startTime, simTimeScale = 1, targetWidth = 0;
+  char outputFileName[100], experiencePath[MAX_EXPERIENCE_PATH];
+  experience_writer experienceWriter;
+  experience_record record;
+  monte_carlo_summary summary;
+  run_options options;
+
+  init_value_writer(&valueWriter);
 
   printf("Do you wish to train(0) or simulate(1) an agent?: ");
   scans = scanf("%d", &sim);
@@ -81,7 +124,21 @@ int main(void) {
   scans = scanf("%d", &timeHorizon);
   checkForErrors(scans != 1, "An input was unable to be loaded...");
 
+  printf("\nUse the semi-MDP solver NO(0) or YES(1): ");
+  scans = scanf("%d", &semiMDP);
+  checkForErrors(scans != 1, "An input was unable to be loaded...");
+
   if (sim){
+    printf("\nController: policy table(0) or distilled decision tree(1): ");
+    scans = scanf("%d", &treeController);
+    checkForErrors(scans != 1, "An input was unable to be loaded...");
+
+    if (treeController){
+      printf("\nMaximum tree depth: ");
+      scans = scanf("%d", &treeDepth);
+      checkForErrors(scans != 1, "An input was unable to be loaded...");
+    }
+
     printf("\nTurn graphics OFF(0) or ON(1): ");
     scans = scanf("%d", &simGraphics);
     checkForErrors(scans != 1, "An input was unable to be loaded...");
@@ -94,11 +151,31 @@ int main(void) {
       printf("\nSimulation timescale (1.0 = realtime and 2.5 = 1 sec in real life is 2.5 sec in the simulation): ");
       scans = scanf("%lf", &simTimeScale);
       checkForErrors(scans != 1, "An input was unable to be loaded...");
+    } else {
+      printf("\nReplica days (1 = a single day): ");
+      scans = scanf("%d", &replicas);
+      checkForErrors(scans != 1, "An input was unable to be loaded...");
+
+      if (replicas > 1){
+        printf("\nStop when the 95%% confidence interval of the average wait time is narrower than (seconds, 0 = run every replica): ");
+        scans = scanf("%lf", &targetWidth);
+        checkForErrors(scans != 1, "An input was unable to be loaded...");
+      }
     }
 
-    printf("\nData output filename: ");
-    scans = scanf("%s", outputFileName);
-    checkForErrors(scans != 1, "An input was unable to be loaded...");
+    /* The checkpoint, counts, trace and telemetry of the run */
+    checkForErrors(!prompt_run_options(&options, replicas, 0), "An input was unable to be loaded...");
+
+    /* Replicas are only summarised, nothing is written per day */
+    if (replicas <= 1){
+      printf("\nData output filename: ");
+      scans = scanf("%s", outputFileName);
+      checkForErrors(scans != 1, "An input was unable to be loaded...");
+
+      printf("\nRecord experience OFF(-1) or to shard (0 - %d): ", MAX_EXPERIENCE_SHARDS - 1);
+      scans = scanf("%d", &experienceShard);
+      checkForErrors(scans != 1, "An input was unable to be loaded...");
+    }
 
     printf("Simulating...\n");
   }
@@ -107,44 +184,115 @@ int main(void) {
   if (sim){
 
     /* Prepare simulation */
-    readData(discountValue, timeHorizon);
+    if (semiMDP){
+      initializeSMDPModel();
+      readSMDPData(discountValue, timeHorizon);
+    } else {
+      readData(discountValue, timeHorizon);
+    }
+
+    if (treeController){
+      distillPolicy(treeDepth);
+    }
 
     simState = make_simulation_state();
     simState.render_simulation = simGraphics;
     simState.current_time = startTime;
     simState.time_scale = simTimeScale;
+    checkForErrors(!open_run_options(&options, &simState, replicas), "Unable to open the files of the run");
+
+    /* The policy is only read from here on, so the replicas share it */
+    if (replicas > 1){
+      run_monte_carlo(&summary, simulateAgentDay, NULL, startTime, options.checkpoint_mode == checkpoint_start ? &simState : NULL, options.counts_on ? &options.arrivals : NULL, replicas, targetWidth, 0);
+      print_monte_carlo_summary(&summary);
+      close_run_options(&options, &simState);
+      discard_simulation(&simState);
+
+      if (treeController){
+        free_policy_tree(&policyTree);
+        free_tree_samples(&treeSamples);
+      }
+      if (semiMDP){
+        free_smdp_model(&smdp);
+      }
+
+      system("pause");
+      return 0;
+    }
+
+    /* Open the shard that transitions are appended to */
+    if (experienceShard >= 0){
+      make_directory(EXPERIENCE_FOLDER);
+      sprintf(experiencePath, "%s" PATH_SEPARATOR "D [%0.2f]", EXPERIENCE_FOLDER, discountValue);
+      checkForErrors(!open_experience_writer(&experienceWriter, experiencePath, experienceShard), "Unable to open the experience shard");
+      memset(&record, 0, sizeof(record));
+    }
 
     /* Run simulation for 1 day */
     while (simState.days_simulated != 1){
 
-      currentState = readCurrentState(simState);
+      currentState = readCurrentState(&simState);
 
-      /* If max time in signal has been reached, then change signal */
-      if (currentState.timeState == (TOTAL_TIME_STATES - 1)){
-        update_simulation(&simState, 1, ChangeSignal);
+      if (experienceShard >= 0){
+        record.time_of_day = (float) simState.current_time;
+        record.day = simState.days_simulated;
+        make_experience_observation(&record.state, &simState);
+      }
 
-      /* Else if action ChangeSignal is available then calculate the best action */
-      } else if (isActionAvailable(ChangeSignal, currentState)){
-        action = argmax(currentState);
-        update_simulation(&simState, 1, action);
+      action = agentAction(&simState, currentState);
 
-      /* Else just wait */
-      } else {
-        update_simulation(&simState, 1, wait);
+      if (treeController && isDecisionState(currentState)){
+        treeDecisions++;
+        treeAgreements += (action == policyTable[currentState.carState[0]][currentState.carState[1]][currentState.carState[2]][currentState.carState[3]][currentState.signalState][currentState.timeState]);
       }
+
+      update_simulation(&simState, 1, action);
+
+      /* Run through the forced yellow and minimum green phases in one go */
+      if (semiMDP && action == ChangeSignal){
+        update_simulation(&simState, smdp.macro_length - 1, wait);
+      }
+
+      /* Save the transition */
+      if (experienceShard >= 0){
+        record.action = (unsigned char) action;
+        record.reward = (float) R(action, currentState, readCurrentState(&simState), 1);
+        make_experience_observation(&record.next_state, &simState);
+        checkForErrors(!append_experience(&experienceWriter, &record), "Unable to write to the experience shard");
+      }
+    }
+
+    if (experienceShard >= 0){
+      close_experience_writer(&experienceWriter);
+    }
+
+    if (treeController){
+      printf("Tree agreed with the full policy in %d of %d decisions (%0.2f%%)\n", treeAgreements, treeDecisions, treeDecisions ? 100.0 * treeAgreements / treeDecisions : 100.0);
+      free_policy_tree(&policyTree);
+      free_tree_samples(&treeSamples);
     }
 
     /* Prints stats and generate output file. And free the memory */
-    print_stats(simState);
-    output_statistics(simState, outputFileName);
+    print_stats(&simState);
+    close_run_options(&options, &simState);
+    output_statistics(&simState, outputFileName);
     discard_simulation(&simState);
 
+  } else if (semiMDP){
+    /* Build the semi-MDP model and train over decision states only */
+    initializeSMDPModel();
+    GenerateSMDPValueArray();
+
   } else {
     /* initialize value arrays and begin the agent training */
     initializeValueArray();
     GenerateValueArray();
   }
 
+  if (semiMDP){
+    free_smdp_model(&smdp);
+  }
+
   system("pause");
 
   return 0;
@@ -152,7 +300,7 @@ int main(void) {
 
 /* Will initialize the V_last array to all zerro*/
 void initializeValueArray(){
-  memset(V_last, 0, sizeof(V_last));
+  memset(V_last, 0, sizeof(valueBuffers[0]));
 }
 
 /* Generates and saves every V array for each time horizon step*/
@@ -190,9 +338,19 @@ void GenerateValueArray(){
       }
     }
 
+    /* The finished array is written while the next horizon is computed from it */
     output_ValueArray(h);
-    memcpy(V_last, V, sizeof(V));
+    swapValueArrays();
   }
+
+  checkForErrors(!finish_value_write(&valueWriter), "Unable to write the value array");
+}
+
+/* Makes the current value array the last value array*/
+void swapValueArrays(){
+  double (*temp)[TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_CAR_STATES][TOTAL_SIGNAL_STATES][TOTAL_TIME_STATES] = V_last;
+  V_last = V;
+  V = temp;
 }
 
 /* Performs one value iteration*/
@@ -424,61 +582,69 @@ double Pr_SignalChange(action action, agent_state currentState, agent_state newS
 
 /* The probability of all car interval changees*/
 double Pr_CarIntervalChange(action action, agent_state currentState, agent_state newState){
-  int dir, currentCarState, newCarState, laneOPEN;
+  int dir;
 
   double output = 1;
 
   for (dir = 0; dir < NUMBER_OF_DIRECTIONS; dir++){
 
-    currentCarState = currentState.carState[dir];
-    newCarState = newState.carState[dir];
+    output *= Pr_laneCarIntervalChange(currentState, newState, dir);
 
-    laneOPEN = isLaneOpen(currentState, dir);
+    if (output == 0){
+      return output;
+    }
 
-    /* If we are going up in intervals */
-    if (currentCarState < newCarState){
+  }
 
-      /* If the lane is open */
-      if ( laneOPEN ){
-        output *= Pr_OPEN_upCarInterval(currentState, newState, dir);
+  return output;
+}
 
-      /* If the lane is closed */
-      } else {
-        output *= Pr_CLOSED_upCarInterval(currentState, newState, dir);
-      }
+/* The probability of the car interval change in a single direction*/
+double Pr_laneCarIntervalChange(agent_state currentState, agent_state newState, int dir){
+  int currentCarState = currentState.carState[dir],
+      newCarState = newState.carState[dir],
+      laneOPEN = isLaneOpen(currentState, dir);
 
-    /* If we are staying in an interval */
-    } else if (currentCarState == newCarState){
+  double output = 0;
 
-      /* If the lane is open */
-      if ( laneOPEN ){
-        output *= Pr_OPEN_stayCarInterval(currentState, dir);
+  /* If we are going up in intervals */
+  if (currentCarState < newCarState){
 
-      /* If the lane is closed */
-      } else {
-        output *= Pr_CLOSED_stayCarInterval(currentState, dir);
-      }
+    /* If the lane is open */
+    if ( laneOPEN ){
+      output = Pr_OPEN_upCarInterval(currentState, newState, dir);
 
-    /* If we are going down in intervals */
-    } else if (currentCarState > newCarState){
+    /* If the lane is closed */
+    } else {
+      output = Pr_CLOSED_upCarInterval(currentState, newState, dir);
+    }
 
-      /* If the lane is open */
-      if ( laneOPEN ){
-        output *= Pr_OPEN_downCarInterval(currentState, newState, dir);
+  /* If we are staying in an interval */
+  } else if (currentCarState == newCarState){
 
-      /* If the lane is closed */
-      } else {
-        output *= 0;
-      }
+    /* If the lane is open */
+    if ( laneOPEN ){
+      output = Pr_OPEN_stayCarInterval(currentState, dir);
 
-    } else{
-      checkForErrors(1, "SOMETHING WENT TOTALLY WRONG WITH CAR STATES");
+    /* If the lane is closed */
+    } else {
+      output = Pr_CLOSED_stayCarInterval(currentState, dir);
     }
 
-    if (output == 0){
-      return output;
+  /* If we are going down in intervals */
+  } else if (currentCarState > newCarState){
+
+    /* If the lane is open */
+    if ( laneOPEN ){
+      output = Pr_OPEN_downCarInterval(currentState, newState, dir);
+
+    /* If the lane is closed */
+    } else {
+      output = 0;
     }
 
+  } else{
+    checkForErrors(1, "SOMETHING WENT TOTALLY WRONG WITH CAR STATES");
   }
 
   return output;
@@ -735,39 +901,42 @@ int isLaneOpen(agent_state currentState, int dir){
 
 /* Check if a total car interval change is possible*/
 int isCarIntervalChangePossible(action action, agent_state currentState, agent_state newState){
-  int dir, currentIntervalID, newIntervalID, currentIntervalStart, currentIntervalEnd, newIntervalStart, newIntervalEnd;
-  int output;
+  int dir;
 
   /* For every direction */
   for (dir = 0; dir < NUMBER_OF_DIRECTIONS; dir++){
-    currentIntervalID = currentState.carState[dir];
-    newIntervalID = newState.carState[dir];
 
-    currentIntervalStart = CarInterval[currentIntervalID][0];
-    currentIntervalEnd = CarInterval[currentIntervalID][1];
-    newIntervalStart = CarInterval[newIntervalID][0];
-    newIntervalEnd = CarInterval[newIntervalID][1];
+    /* If it's not possible to change interval in one direction, 0 is returned */
+    if (!isLaneIntervalChangePossible(isLaneOpen(currentState, dir), currentState.carState[dir], newState.carState[dir])){
+      return 0;
+    }
+  }
 
-    /* If the lane is open and the new interval is bigger than the current and it's possible reach within our spawn and despawn limits */
-    if (isLaneOpen(currentState, dir) && (currentIntervalID > newIntervalID) && (currentIntervalStart - LAMDA <= newIntervalEnd)){
-      output = 1;
+  return 1;
+}
 
-    /* If the new interval is lower than the current and it's possible to reach within our spawn and despawn limits */
-    } else if ((currentIntervalID < newIntervalID) && (currentIntervalEnd + LAMDA >= newIntervalStart)){
-      output = 1;
+/* Check if a car interval change in a single direction is possible*/
+int isLaneIntervalChangePossible(int laneOpen, int currentIntervalID, int newIntervalID){
+  int currentIntervalStart = CarInterval[currentIntervalID][0],
+      currentIntervalEnd = CarInterval[currentIntervalID][1],
+      newIntervalStart = CarInterval[newIntervalID][0],
+      newIntervalEnd = CarInterval[newIntervalID][1];
 
-    /* Else if we stay in the same interval */
-    } else if (currentIntervalID == newIntervalID){
-      output = 1;
+  /* If the lane is open and the new interval is bigger than the current and it's possible reach within our spawn and despawn limits */
+  if (laneOpen && (currentIntervalID > newIntervalID) && (currentIntervalStart - LAMDA <= newIntervalEnd)){
+    return 1;
 
-    /* Else it's not possible to change interval, and 0 is returned */
-    } else {
-      output = 0;
-      return output;
-    }
+  /* If the new interval is lower than the current and it's possible to reach within our spawn and despawn limits */
+  } else if ((currentIntervalID < newIntervalID) && (currentIntervalEnd + LAMDA >= newIntervalStart)){
+    return 1;
+
+  /* Else if we stay in the same interval */
+  } else if (currentIntervalID == newIntervalID){
+    return 1;
   }
 
-  return output;
+  /* Else it's not possible to change interval */
+  return 0;
 }
 
 /* Returns the value of f!*/
@@ -781,18 +950,18 @@ double poisson(int k, double lamda){
 }
 
 /* Returns the current state*/
-agent_state readCurrentState(simulation_state simState){
+agent_state readCurrentState(const simulation_state *simState){
   agent_state currentState;
 
   /* Car intervals */
-  currentState.carState[0] = convertCarInterval(simState.streets[north].lanes[straight_right_lane].amount_of_cars);
-  currentState.carState[1] = convertCarInterval(simState.streets[south].lanes[straight_right_lane].amount_of_cars);
-  currentState.carState[2] = convertCarInterval(simState.streets[east].lanes[straight_right_lane].amount_of_cars);
-  currentState.carState[3] = convertCarInterval(simState.streets[west].lanes[straight_right_lane].amount_of_cars);
+  currentState.carState[0] = convertCarInterval(get_lane_car_count(simState, north, straight_right_lane));
+  currentState.carState[1] = convertCarInterval(get_lane_car_count(simState, south, straight_right_lane));
+  currentState.carState[2] = convertCarInterval(get_lane_car_count(simState, east, straight_right_lane));
+  currentState.carState[3] = convertCarInterval(get_lane_car_count(simState, west, straight_right_lane));
 
   /* Signal and time states */
-  currentState.signalState = simState.current_signal_state;
-  currentState.timeState = convertTimeInterval(simState.time_since_change);
+  currentState.signalState = simState->current_signal_state;
+  currentState.timeState = convertTimeInterval(simState->time_since_change);
 
   return currentState;
 }
@@ -827,25 +996,35 @@ int convertTimeInterval(double time_d){
 
 /* Outputs a formatted file of the current value array*/
 void output_ValueArray(int H){
-  FILE *fp ;
-  int car_N, car_S, car_E, car_W, signalState, timeState;
-  char PATH[20];
+  char directory[MAX_VALUE_PATH - 16], PATH[MAX_VALUE_PATH]; /* PATH has room for the file name after the directory */
 
-  sprintf(PATH, "Agents\\D [%0.2f]", discountValue);
-  CreateDirectory(PATH, NULL);
+  snprintf(directory, sizeof(directory), "Agents" PATH_SEPARATOR "D [%0.2f]", discountValue);
+  snprintf(PATH, MAX_VALUE_PATH, "%s" PATH_SEPARATOR "%d.txt", directory, H);
 
-  sprintf(PATH, "%s\\%d.txt", PATH, H);
+  /* For every datapoint, we print it in the format [Number] */
+  start_value_write(&valueWriter, directory, PATH, &V[0][0][0][0][0][0], sizeof(valueBuffers[0]) / sizeof(double));
+}
 
-  fp = fopen(PATH, "w");
+/* Reads and includes a formatted file of a previous value array*/
+void readData(double discount, int H){
+  int car_N, car_S, car_E, car_W, signalState, timeState, scans;
+  char PATH[MAX_VALUE_PATH];
+  FILE *fp;
 
-  /* For every datapoint, we print it in the format [Number] */
+  snprintf(PATH, MAX_VALUE_PATH, "Agents" PATH_SEPARATOR "D [%0.2f]" PATH_SEPARATOR "%d.txt", discount, H);
+
+  fp = fopen(PATH, "r");
+  checkForErrors(!fp, "Unable to open the required datafile");
+
+  /* For every expected datapoint, read and store it */
   for (car_N = 0; car_N < TOTAL_CAR_STATES; car_N++){
     for (car_S = 0; car_S < TOTAL_CAR_STATES; car_S++){
       for (car_E = 0; car_E < TOTAL_CAR_STATES; car_E++){
         for (car_W = 0; car_W < TOTAL_CAR_STATES; car_W++){
           for (signalState = 0; signalState < TOTAL_SIGNAL_STATES; signalState++){
             for (timeState = 0; timeState < TOTAL_TIME_STATES; timeState++){
-              fprintf(fp, "[%0.5f]", V[car_N][car_S][car_E][car_W][signalState][timeState]);
+              scans = fscanf(fp, " [%lf]", &V[car_N][car_S][car_E][car_W][signalState][timeState]);
+              checkForErrors(scans != 1, "Unable to read a datapoint form datafile");
             }
           }
         }
@@ -853,29 +1032,234 @@ void output_ValueArray(int H){
     }
   }
 
-  fclose(fp);
+  memcpy(V_last, V, sizeof(valueBuffers[0]));
 }
 
-/* Reads and includes a formatted file of a previous value array*/
-void readData(double discount, int H){
-  int car_N, car_S, car_E, car_W, signalState, timeState, scans;
-  char PATH[25];
+/* Builds the semi-MDP model from the interval transition probabilities*/
+void initializeSMDPModel(){
+  int dir, laneOpen, carState, newCarState, timeState;
+  agent_state currentState, newState;
+
+  checkForErrors(!init_smdp_model(&smdp, TOTAL_CAR_STATES, TOTAL_TIME_STATES, discountValue), "Unable to allocate the semi-MDP model");
+
+  memset(&currentState, 0, sizeof(currentState));
+  memset(&newState, 0, sizeof(newState));
+
+  /* Transition matrix of every direction for a closed and an open lane */
+  for (dir = 0; dir < NUMBER_OF_DIRECTIONS; dir++){
+    for (laneOpen = 0; laneOpen < 2; laneOpen++){
+
+      /* Pick a green / red signal state in which the lane has the wanted status */
+      currentState.signalState = (laneOpen == (dir == 0 || dir == 1)) ? g_r : r_g;
+
+      for (carState = 0; carState < TOTAL_CAR_STATES; carState++){
+        for (newCarState = 0; newCarState < TOTAL_CAR_STATES; newCarState++){
+          currentState.carState[dir] = carState;
+          newState.carState[dir] = newCarState;
+
+          if (isLaneIntervalChangePossible(laneOpen, carState, newCarState)){
+            smdp.transition[dir][laneOpen][carState * TOTAL_CAR_STATES + newCarState] = Pr_laneCarIntervalChange(currentState, newState, dir);
+          }
+        }
+      }
+    }
+  }
+
+  /* Rewards and penalties of each car interval */
+  for (carState = 0; carState < TOTAL_CAR_STATES; carState++){
+    smdp.lane_reward[0][carState] = penelty[carState];
+    smdp.lane_reward[1][carState] = reward[carState];
+  }
+
+  /* Chance of leaving each time interval per second */
+  for (timeState = 0; timeState < TOTAL_TIME_STATES; timeState++){
+    smdp.time_advance[timeState] = (double) 1 / sizeOfFullInterval(timeInterval[timeState][0], timeInterval[timeState][1]);
+  }
+
+  /* ChangeSignal runs through two yellow phases and the minimum green time */
+  set_smdp_macro(&smdp, YELLOW_TIME_LIMIT, timeInterval[1][0]);
+  finish_smdp_model(&smdp);
+}
+
+/* Generates and saves the semi-MDP value array for each time horizon step*/
+void GenerateSMDPValueArray(){
+  int h;
+
+  for (h = 1; h <= timeHorizon; h++){
+    printf("Discount: %0.2f  SMDP H[%d/%d]\n", discountValue, h, timeHorizon);
+
+    smdp_backup(&smdp);
+    output_SMDPValueArray(h);
+    smdp_swap_values(&smdp);
+  }
+
+  checkForErrors(!finish_value_write(&valueWriter), "Unable to write the semi-MDP value array");
+}
+
+/* Check if the semi-MDP controller makes a decision in the current state*/
+int isSMDPDecisionState(agent_state currentState){
+  return (currentState.signalState == g_r || currentState.signalState == r_g) && currentState.timeState != 0;
+}
+
+/* Converts a green / red signal state into a semi-MDP phase*/
+int signalPhase(int signalState){
+  return (signalState == g_r) ? 0 : 1;
+}
+
+/* Outputs a formatted file of the current semi-MDP value array*/
+void output_SMDPValueArray(int H){
+  char directory[MAX_VALUE_PATH - 16], PATH[MAX_VALUE_PATH]; /* PATH has room for the file name after the directory */
+
+  snprintf(directory, sizeof(directory), "Agents" PATH_SEPARATOR "SMDP D [%0.2f]", discountValue);
+  snprintf(PATH, MAX_VALUE_PATH, "%s" PATH_SEPARATOR "%d.txt", directory, H);
+
+  /* Ordered by phase, time state and then the car intervals {N, S, E, W} */
+  start_value_write(&valueWriter, directory, PATH, smdp.value, SMDP_PHASES * smdp.time_states * smdp.tensor_size);
+}
+
+/* Reads a semi-MDP value array and derives its policy*/
+void readSMDPData(double discount, int H){
   FILE *fp;
+  int i, scans, size = SMDP_PHASES * smdp.time_states * smdp.tensor_size;
+  char PATH[MAX_VALUE_PATH];
 
-  sprintf(PATH, "Agents\\D [%0.2f]\\%d.txt", discount, H);
+  snprintf(PATH, MAX_VALUE_PATH, "Agents" PATH_SEPARATOR "SMDP D [%0.2f]" PATH_SEPARATOR "%d.txt", discount, H);
 
   fp = fopen(PATH, "r");
   checkForErrors(!fp, "Unable to open the required datafile");
 
-  /* For every expected datapoint, read and store it */
+  for (i = 0; i < size; i++){
+    scans = fscanf(fp, " [%lf]", &smdp.value_last[i]);
+    checkForErrors(scans != 1, "Unable to read a datapoint form datafile");
+  }
+
+  fclose(fp);
+
+  /* The greedy policy with respect to the loaded values */
+  smdp_backup(&smdp);
+}
+
+/* The action of the value array or semi-MDP policy in the current state*/
+int tableAction(agent_state currentState){
+
+  /* The semi-MDP policy only covers decision states, every other state waits */
+  if (semiMDP){
+    return isSMDPDecisionState(currentState) ? smdp_policy(&smdp, signalPhase(currentState.signalState), currentState.timeState, currentState.carState) : wait;
+
+  /* If max time in signal has been reached, then change signal */
+  } else if (currentState.timeState == (TOTAL_TIME_STATES - 1)){
+    return ChangeSignal;
+
+  /* Else if action ChangeSignal is available then calculate the best action */
+  } else if (isActionAvailable(ChangeSignal, currentState)){
+    return argmax(currentState);
+  }
+
+  /* Else just wait */
+  return wait;
+}
+
+/* The action of the chosen controller in the current state*/
+int agentAction(const simulation_state *simState, agent_state currentState){
+  int features[TREE_FEATURES];
+
+  /* The tree replaces the policy wherever there is a choice to make */
+  if (treeController && isDecisionState(currentState)){
+    readTreeFeatures(simState, features);
+    return policy_tree_decide(&policyTree, features);
+  }
+
+  return tableAction(currentState);
+}
+
+/* Controls the intersection until a day has been simulated*/
+void simulateAgentDay(simulation_state *simState, void *context){
+  int action;
+  (void) context;
+
+  while (simState->days_simulated != 1){
+    action = agentAction(simState, readCurrentState(simState));
+    update_simulation(simState, 1, action);
+
+    if (semiMDP && action == ChangeSignal){
+      update_simulation(simState, smdp.macro_length - 1, wait);
+    }
+  }
+}
+
+/* Check if the controller has a free choice between both actions*/
+int isDecisionState(agent_state currentState){
+  if (currentState.timeState == (TOTAL_TIME_STATES - 1)){
+    return 0;
+  }
+
+  return semiMDP ? isSMDPDecisionState(currentState) : isActionAvailable(ChangeSignal, currentState);
+}
+
+/* Reads the raw measurements the decision tree splits on*/
+void readTreeFeatures(const simulation_state *simState, int *features){
+  features[0] = get_lane_car_count(simState, north, straight_right_lane);
+  features[1] = get_lane_car_count(simState, south, straight_right_lane);
+  features[2] = get_lane_car_count(simState, east, straight_right_lane);
+  features[3] = get_lane_car_count(simState, west, straight_right_lane);
+  features[4] = signalPhase(simState->current_signal_state);
+  features[5] = (int) simState->time_since_change;
+}
+
+/* Compresses the policy into a decision tree and reports its fidelity*/
+void distillPolicy(int maxDepth){
+  int car_N, car_S, car_E, car_W, signalState, timeState, dir, i, label, features[TREE_FEATURES];
+  int table_bytes = 0;
+  agent_state currentState;
+
+  checkForErrors(!init_tree_samples(&treeSamples, TREE_FEATURES, 2 * TOTAL_TIME_STATES * TOTAL_CAR_STATES * TOTAL_CAR_STATES * TOTAL_CAR_STATES * TOTAL_CAR_STATES), "Unable to allocate the tree samples");
+  memset(policyTable, -1, sizeof(policyTable));
+
+  /* The tree may only split where a car or time interval ends, so every raw
+     value in an interval takes the same path as the interval itself */
+  for (dir = 0; dir < NUMBER_OF_DIRECTIONS; dir++){
+    for (i = 0; i < TOTAL_CAR_STATES - 1; i++){
+      add_tree_threshold(&treeSamples, dir, CarInterval[i][1]);
+    }
+  }
+  add_tree_threshold(&treeSamples, 4, 0);
+  for (i = 0; i < TOTAL_TIME_STATES - 1; i++){
+    add_tree_threshold(&treeSamples, 5, timeInterval[i][1]);
+  }
+
+  /* Label every decision state with the action of the full policy */
   for (car_N = 0; car_N < TOTAL_CAR_STATES; car_N++){
+    printf("Distilling the policy %0.2f%%\n", (double) car_N / TOTAL_CAR_STATES * 100);
+
     for (car_S = 0; car_S < TOTAL_CAR_STATES; car_S++){
       for (car_E = 0; car_E < TOTAL_CAR_STATES; car_E++){
         for (car_W = 0; car_W < TOTAL_CAR_STATES; car_W++){
           for (signalState = 0; signalState < TOTAL_SIGNAL_STATES; signalState++){
             for (timeState = 0; timeState < TOTAL_TIME_STATES; timeState++){
-              scans = fscanf(fp, " [%lf]", &V[car_N][car_S][car_E][car_W][signalState][timeState]);
-              checkForErrors(scans != 1, "Unable to read a datapoint form datafile");
+              currentState.carState[0] = car_N;
+              currentState.carState[1] = car_S;
+              currentState.carState[2] = car_E;
+              currentState.carState[3] = car_W;
+
+              currentState.signalState = signalState;
+              currentState.timeState = timeState;
+
+              if (!isDecisionState(currentState)){
+                continue;
+              }
+
+              label = tableAction(currentState);
+              policyTable[car_N][car_S][car_E][car_W][signalState][timeState] = (signed char) label;
+              table_bytes++;
+
+              /* The lower bound of each interval represents the interval */
+              for (dir = 0; dir < NUMBER_OF_DIRECTIONS; dir++){
+                features[dir] = CarInterval[currentState.carState[dir]][0];
+              }
+              features[4] = signalPhase(signalState);
+              features[5] = timeInterval[timeState][0];
+
+              add_tree_sample(&treeSamples, features, label, 1);
             }
           }
         }
@@ -883,7 +1267,88 @@ void readData(double discount, int H){
     }
   }
 
-  memcpy(V_last, V, sizeof(V));
+  checkForErrors(!build_policy_tree(&policyTree, &treeSamples, maxDepth), "Unable to allocate the decision tree");
+
+  printf("\nDecision states: %d (%d bytes as a table)\n", treeSamples.sample_count, table_bytes);
+  printf("Tree nodes: %d (%d bytes), depth %d\n", policyTree.node_count, (int) (policyTree.node_count * sizeof(tree_node)), policyTree.depth);
+  printf("Fidelity over the decision states: %0.2f%%\n", policy_tree_fidelity(&policyTree, &treeSamples) * 100);
+
+  benchmarkPolicy();
+  output_PolicyTree(maxDepth);
+}
+
+/* Outputs the decision tree as a list of nested rules*/
+void output_PolicyTree(int maxDepth){
+  const char *featureNames[TREE_FEATURES] = {"cars_N", "cars_S", "cars_E", "cars_W", "phase_EW", "seconds_since_change"};
+  const char *actionNames[TOTALACTIONS] = {"wait", "ChangeSignal"};
+  char PATH[MAX_VALUE_PATH];
+  FILE *fp;
+
+  snprintf(PATH, MAX_VALUE_PATH, "Agents" PATH_SEPARATOR "%sD [%0.2f]" PATH_SEPARATOR "%d tree %d.txt", semiMDP ? "SMDP " : "", discountValue, timeHorizon, maxDepth);
+
+  fp = fopen(PATH, "w");
+  checkForErrors(!fp, "Unable to create the tree file");
+
+  write_policy_tree(&policyTree, fp, featureNames, actionNames, 0, 0);
+  fclose(fp);
+
+  printf("Tree rules written to %s\n\n", PATH);
+}
+
+/* Measures the time per decision of the table and the tree*/
+void benchmarkPolicy(){
+  int i, repeat, dir, decisions, repetitions = 200, *x;
+  volatile int sink = 0;
+  double start, treeTime, tableTime, argmaxTime;
+  agent_state currentState;
+
+  decisions = treeSamples.sample_count * repetitions;
+
+  /* The tree only needs the raw measurements */
+  start = wall_time();
+  for (repeat = 0; repeat < repetitions; repeat++){
+    for (i = 0; i < treeSamples.sample_count; i++){
+      sink += policy_tree_decide(&policyTree, treeSamples.features + i * TREE_FEATURES);
+    }
+  }
+  treeTime = wall_time() - start;
+
+  /* The table first converts the measurements into intervals */
+  start = wall_time();
+  for (repeat = 0; repeat < repetitions; repeat++){
+    for (i = 0; i < treeSamples.sample_count; i++){
+      x = treeSamples.features + i * TREE_FEATURES;
+      for (dir = 0; dir < NUMBER_OF_DIRECTIONS; dir++){
+        currentState.carState[dir] = convertCarInterval(x[dir]);
+      }
+      currentState.signalState = x[4] ? r_g : g_r;
+      currentState.timeState = convertTimeInterval(x[5]);
+      sink += policyTable[currentState.carState[0]][currentState.carState[1]][currentState.carState[2]][currentState.carState[3]][currentState.signalState][currentState.timeState];
+    }
+  }
+  tableTime = wall_time() - start;
+
+  printf("Per decision: tree %0.1f ns, table lookup %0.1f ns", treeTime / decisions * 1e9, tableTime / decisions * 1e9);
+
+  /* Without a stored table the value array is searched on every decision */
+  if (!semiMDP){
+    decisions = min(treeSamples.sample_count, 50);
+    start = wall_time();
+    for (i = 0; i < decisions; i++){
+      x = treeSamples.features + i * TREE_FEATURES;
+      for (dir = 0; dir < NUMBER_OF_DIRECTIONS; dir++){
+        currentState.carState[dir] = convertCarInterval(x[dir]);
+      }
+      currentState.signalState = x[4] ? r_g : g_r;
+      currentState.timeState = convertTimeInterval(x[5]);
+      sink += argmax(currentState);
+    }
+    argmaxTime = wall_time() - start;
+
+    printf(", argmax %0.1f us", argmaxTime / decisions * 1e6);
+  }
+
+  printf("\n");
 }
 
 /* Calculates the size of a full interval. Example: |[A;B]|*/
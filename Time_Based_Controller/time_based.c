@@ -1,5 +1,7 @@
 #include "..\Headers\Simulation.h"
 #include "..\Headers\Simulation_Evaluation.h"
+#include "..\Headers\Monte_Carlo.h"
+#include "..\Headers\Run_Options.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,13 +19,18 @@
 
 
 void run_cycle(simulation_state *sim_state, double green_light, double increase_factor);
-void sim_time_based(simulation_state *sim_state);
+void run_phase(simulation_state *sim_state, double green_light, double increase_factor);
+double get_yellow_run(int phase);
+void sim_time_based(simulation_state *sim_state, void *context);
+double get_increase_factor(double current_time);
 
 
 int main() {
-  int renderSim;
-  double startTime, simTimeScale = 1;
+  int renderSim, replicas = 1;
+  double startTime, simTimeScale = 1, targetWidth = 0;
   simulation_state sim_state = make_simulation_state();
+  monte_carlo_summary summary;
+  run_options options;
 
   printf("Simulate with graphics OFF(0) or ON(1): ");
   scanf("%d", &renderSim);
@@ -34,20 +41,43 @@ int main() {
   if (renderSim){
     printf("\nSimulation timescale (1.0 = realtime and 2.5 = 1 sec in real life is 2.5 sec in the simulation): ");
     scanf("%lf", &simTimeScale);
+  }else{
+    printf("\nReplica days (1 = a single day): ");
+    scanf("%d", &replicas);
+
+    if (replicas > 1){
+      printf("\nStop when the 95%% confidence interval of the average wait time is narrower than (seconds, 0 = run every replica): ");
+      scanf("%lf", &targetWidth);
+    }
   }
-  printf("Simulating...\n");
 
+  /* The checkpoint, scenario, counts, trace and telemetry of the run */
+  prompt_run_options(&options, replicas, 1);
+  printf("Simulating...\n");
 
   sim_state.current_time = startTime; /* Start time of day (measured in seconds past 00:00:00) */
   sim_state.time_scale = simTimeScale;
   sim_state.render_simulation = renderSim; /* Disable/enable rendering of simulation */
+  open_run_options(&options, &sim_state, replicas);
+
+  /* Summarise independent days instead of a single one */
+  if (replicas > 1){
+    run_monte_carlo(&summary, sim_time_based, NULL, startTime, options.checkpoint_mode == checkpoint_start ? &sim_state : NULL, options.counts_on ? &options.arrivals : NULL, replicas, targetWidth, 0);
+    print_monte_carlo_summary(&summary);
+    close_run_options(&options, &sim_state);
+    discard_simulation(&sim_state);
+
+    system("pause");
+    return 0;
+  }
 
   /* Run time based solution */
-  sim_time_based(&sim_state);
+  sim_time_based(&sim_state, NULL);
 
   /* Print and output statistics for the simulation */
-  print_stats(sim_state);
-  output_statistics(sim_state, "timebased");
+  print_stats(&sim_state);
+  close_run_options(&options, &sim_state);
+  output_statistics(&sim_state, "timebased");
 
   /* Free memory */
   discard_simulation(&sim_state);
@@ -57,36 +87,69 @@ int main() {
 }
 
 /* Run a full simulation with a timebased controller */
-void sim_time_based(simulation_state *sim_state){
-  double current_time;
+void sim_time_based(simulation_state *sim_state, void *context){
+  (void) context;
+
+  /* A checkpoint saved partway through a cycle goes on with the rest of it */
+  while(sim_state->current_signal_state != current_scenario.first_phase && sim_state->days_simulated < 1)
+    run_phase(sim_state, STANDARD_GREEN_TIME, get_increase_factor(sim_state->current_time));
 
   /* Run simulation until */
   while(sim_state->days_simulated < 1){
-    current_time = sim_state->current_time;
-
-    /* Morning peak hours*/
-    if(current_time >= 26400 && current_time <= 30000){
-      run_cycle(sim_state, STANDARD_GREEN_TIME, INCREASE_MORNING_PEAK_TIME);
-    }
-    /* Afternoon peak hours */
-    else if(current_time >= 54600 && current_time <= 58200){
-      run_cycle(sim_state, STANDARD_GREEN_TIME,  INCREASE_AFTERNOON_PEAK_TIME);
-    }
-    /* Other times of day */
-    else{
-      run_cycle(sim_state, STANDARD_GREEN_TIME, 1.0);
-    }
+    run_cycle(sim_state, STANDARD_GREEN_TIME, get_increase_factor(sim_state->current_time));
   }
 }
 
-/* Runs a single cycle */
+/* Returns the factor of the green time of the second half of a cycle */
+double get_increase_factor(double current_time){
+  /* Morning peak hours*/
+  if(current_time >= 26400 && current_time <= 30000)
+    return INCREASE_MORNING_PEAK_TIME;
+  /* Afternoon peak hours */
+  if(current_time >= 54600 && current_time <= 58200)
+    return INCREASE_AFTERNOON_PEAK_TIME;
+  /* Other times of day */
+  return 1.0;
+}
+
+/* Runs a single cycle, from the first phase of the scenario through every
+   green phase and back */
 void run_cycle(simulation_state *sim_state, double green_light, double increase_factor){
-  if(sim_state->current_signal_state != r_g){
-    printf("Error : Expected signal %d but current signal is %d\n", r_yg, sim_state->current_signal_state);
+  if(sim_state->current_signal_state != current_scenario.first_phase){
+    printf("Error : Expected signal %d but current signal is %d\n", current_scenario.first_phase, sim_state->current_signal_state);
     exit(0);
   }
 
   /* Run through a full cycle using the given green times */
-  update_simulation(sim_state, green_light + MAX_YELLOW_TIME * 2, 1);
-  update_simulation(sim_state, green_light * increase_factor + (MAX_YELLOW_TIME * 2), 1);
+  do{
+    run_phase(sim_state, green_light, increase_factor);
+  }while(sim_state->current_signal_state != current_scenario.first_phase);
+}
+
+/* Changes to the next green phase through the yellow phases between them.
+   The first phase gets the longer green time of the second half of a cycle */
+void run_phase(simulation_state *sim_state, double green_light, double increase_factor){
+  int phase = sim_state->current_signal_state, next = phase;
+  double yellow = get_yellow_run(phase);
+
+  do{
+    next = (next + 1) % current_scenario.phase_count;
+  }while(is_yellow(next) && next != phase);
+
+  if(next == current_scenario.first_phase)
+    green_light *= increase_factor;
+  update_simulation(sim_state, green_light + yellow, 1);
+}
+
+/* Returns the seconds of the yellow phases that follow a phase */
+double get_yellow_run(int phase){
+  double yellow = 0;
+  int i, next;
+
+  for(i = 1; i < current_scenario.phase_count; i++){
+    next = (phase + i) % current_scenario.phase_count;
+    if(!is_yellow(next)) break;
+    yellow += current_scenario.yellow_time;
+  }
+  return yellow;
 }
@@ -0,0 +1,46 @@
+#include "..\Headers\Simulation.h"
+#include "..\Headers\Simulation_Evaluation.h"
+#include "..\Headers\Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Replays a trace recorded by one of the controllers as fast as the simulator
+   runs. The arrivals and signal changes are taken from the trace, so no
+   controller is needed and not a single random number is drawn. The
+   statistics digest printed at the end must match the one of the recording */
+
+int main() {
+  simulation_state sim_state = make_simulation_state();
+  trace_reader reader;
+  char traceFile[MAX_TRACE_PATH];
+  unsigned long long digest;
+  double start, elapsed, hours;
+  long events;
+
+  printf("Trace file: ");
+  if(scanf("%199s", traceFile) != 1) return 1;
+
+  sim_state.render_simulation = 0;
+  if(!start_replay(&sim_state, &reader, traceFile)){
+    printf("Unable to read the trace %s\n", traceFile);
+    discard_simulation(&sim_state);
+    return 1;
+  }
+  events = reader.event_count;
+  printf("Replaying %ld events...\n", events);
+
+  start = wall_time();
+  run_replay(&sim_state);
+  elapsed = wall_time() - start;
+  hours = (sim_state.tick_count - reader.header.start_tick) / (double) TICK_RATE / SEC_PER_HOUR;
+
+  print_stats(&sim_state);
+  digest = get_statistics_digest(&sim_state);
+  printf("Statistics digest: %08x%08x\n", (unsigned int) (digest >> 32), (unsigned int) digest);
+  printf("Replayed %0.2f simulated hours in %0.3f s (%0.1f simulated hours per second)\n", hours, elapsed, elapsed > 0 ? hours / elapsed : 0);
+
+  close_trace(&sim_state);
+  discard_simulation(&sim_state);
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "..\Headers\Simulation.h"
 #include "..\Headers\Simulation_Evaluation.h"
+#include "..\Headers\Monte_Carlo.h"
+#include "..\Headers\Run_Options.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,9 +9,10 @@
 #include <string.h>
 #include <math.h>
 
+void sim_traffic_based(simulation_state *sim_state, void *context);
 void run_cycle(simulation_state *sim_state);
 void run_sequence(simulation_state *sim_state, double green_time);
-int get_total_cars(simulation_state sim_state, int cardinal_direction, int cardinal_direction_2, int lane_type);
+int get_total_cars(const simulation_state *sim_state, int cardinal_direction, int cardinal_direction_2, int lane_type);
 
 double fairness(int x);
 double max_val(double a, double b);
@@ -17,9 +20,11 @@ double min_val(double a, double b);
 
 /* Controls traffic based on car counts from censors */
 int main() {
-  int renderSim;
-  double startTime, simTimeScale = 1;
+  int renderSim, replicas = 1;
+  double startTime, simTimeScale = 1, targetWidth = 0;
   simulation_state sim_state = make_simulation_state();
+  monte_carlo_summary summary;
+  run_options options;
 
   printf("Simulate with graphics OFF(0) or ON(1): ");
   scanf("%d", &renderSim);
@@ -30,26 +35,55 @@ int main() {
   if (renderSim){
     printf("\nSimulation timescale (1.0 = realtime and 2.5 = 1 sec in real life is 2.5 sec in the simulation): ");
     scanf("%lf", &simTimeScale);
+  }else{
+    printf("\nReplica days (1 = a single day): ");
+    scanf("%d", &replicas);
+
+    if (replicas > 1){
+      printf("\nStop when the 95%% confidence interval of the average wait time is narrower than (seconds, 0 = run every replica): ");
+      scanf("%lf", &targetWidth);
+    }
   }
-  printf("Simulating...\n");
 
+  /* The checkpoint, scenario, counts, trace and telemetry of the run */
+  prompt_run_options(&options, replicas, 1);
+  printf("Simulating...\n");
 
   sim_state.current_time = startTime; /* Start time of day (measured in seconds past 00:00:00) */
   sim_state.time_scale = simTimeScale;
   sim_state.render_simulation = renderSim; /* Disable/enable rendering of simulation */
+  open_run_options(&options, &sim_state, replicas);
+
+  /* Summarise independent days instead of a single one */
+  if (replicas > 1){
+    run_monte_carlo(&summary, sim_traffic_based, NULL, startTime, options.checkpoint_mode == checkpoint_start ? &sim_state : NULL, options.counts_on ? &options.arrivals : NULL, replicas, targetWidth, 0);
+    print_monte_carlo_summary(&summary);
+    close_run_options(&options, &sim_state);
+    discard_simulation(&sim_state);
 
-  while(sim_state.days_simulated < 1){
-    run_cycle(&sim_state);
+    system("pause");
+    return 0;
   }
 
-  print_stats(sim_state);
-  output_statistics(sim_state, "SemiIntelligent");
+  sim_traffic_based(&sim_state, NULL);
+
+  print_stats(&sim_state);
+  close_run_options(&options, &sim_state);
+  output_statistics(&sim_state, "SemiIntelligent");
   discard_simulation(&sim_state);
 
   system("pause");
   return 0;
 }
 
+/* Run a full simulation with the traffic based controller */
+void sim_traffic_based(simulation_state *sim_state, void *context){
+  (void) context;
+
+  while(sim_state->days_simulated < 1){
+    run_cycle(sim_state);
+  }
+}
 
 /* Calculate green-time for each lane using formula : green_time_lane = (cars_in_lane / total_cars) * (total_cars * time_factor) */
 void run_cycle(simulation_state *sim_state) {
@@ -80,8 +114,8 @@ void run_cycle(simulation_state *sim_state) {
   }
 
   /* Run the sequence with the given calculated green times */
-  run_sequence(sim_state, green_time_ns + 2 * MAX_YELLOW_TIME);
-  run_sequence(sim_state, green_time_ew + 2 * MAX_YELLOW_TIME);
+  run_sequence(sim_state, green_time_ns + 2 * current_scenario.yellow_time);
+  run_sequence(sim_state, green_time_ew + 2 * current_scenario.yellow_time);
 }
 
 /* Changes to next signal and runs simulation until the given green time has passed
@@ -100,10 +134,10 @@ void run_sequence(simulation_state *sim_state, double green_time) {
   }
 
   /* Make sure the given green time is within the maximum/minimum limits */
-  if(green_time > MAX_GREEN_TIME)
-    green_time = MAX_GREEN_TIME;
-  else if(green_time < MIN_GREEN_TIME)
-    green_time = MIN_GREEN_TIME;
+  if(green_time > current_scenario.max_green)
+    green_time = current_scenario.max_green;
+  else if(green_time < current_scenario.min_green)
+    green_time = current_scenario.min_green;
 
   /* Simulate the remaining green time */
   while(green_time > 0){
@@ -115,7 +149,7 @@ void run_sequence(simulation_state *sim_state, double green_time) {
 
 
     /* Skip signal if the green lanes are empty */
-    if(are_green_lanes_empty(*sim_state))
+    if(are_green_lanes_empty(sim_state))
       break;
 
     update_simulation(sim_state, time_step, 0);
@@ -123,8 +157,8 @@ void run_sequence(simulation_state *sim_state, double green_time) {
 }
 
 /* Returns total amount of cars with the same signal direction as the given lane*/
-int get_total_cars(simulation_state sim_state, int cardinal_direction, int cardinal_direction_2, int lane_type){
-  return sim_state.streets[cardinal_direction].lanes[lane_type].amount_of_cars + sim_state.streets[cardinal_direction_2].lanes[lane_type].amount_of_cars;
+int get_total_cars(const simulation_state *sim_state, int cardinal_direction, int cardinal_direction_2, int lane_type){
+  return get_lane_car_count(sim_state, cardinal_direction, lane_type) + get_lane_car_count(sim_state, cardinal_direction_2, lane_type);
 }
 
 /* A fairness function dictacting how much more green time a lane should have
@@ -0,0 +1,181 @@
+#define VECTOR_ENV_BUILD
+#include "vector_env.h"
+#include "../Headers/Simulation.h"
+#include "../Headers/Simulation_Pool.h"
+#include "../Headers/Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The vector_env shared library, see vector_env.h for the interface. Every
+   environment is a simulation of a pool made at creation, so an episode is
+   started with reset_simulation() and nothing is allocated per call. The
+   environments are stepped in blocks on a thread pool that lives as long as
+   the vector_env, the calling thread works on a block as well */
+
+#define VECTOR_ENV_BLOCK 16 /* Environments a thread takes at a time */
+#define VECTOR_ENV_STAT_DAYS 2 /* An episode ends on the first tick of day 1 */
+
+struct vector_env{
+  vector_env_settings settings;
+  simulation_pool pool;
+  simulation_state **states;
+  double *elapsed; /* Simulated seconds of the current episode */
+  int *episodes; /* Episodes started, keys the random streams of the next */
+  unsigned char *done;
+  thread_pool threads;
+
+  /* The call being run */
+  const int *actions;
+  const unsigned char *mask;
+  float *observations, *rewards;
+  unsigned char *dones;
+};
+
+int reset_block(void *context, int task);
+int step_block(void *context, int task);
+void start_episode(vector_env *env, int index);
+void write_observation(const simulation_state *sim_state, float *observation);
+int get_block_count(const vector_env *env);
+
+
+VECTOR_ENV_API vector_env *vector_env_create(const vector_env_settings *settings){
+  vector_env *env;
+  int i, count = settings->count;
+
+  if(count < 1 || settings->step_seconds * TICK_RATE < 1 || settings->episode_seconds < 0 ||
+     (settings->engine != micro_engine && settings->engine != meso_engine))
+    return NULL;
+
+  env = (vector_env *) calloc(1, sizeof(vector_env));
+  if(env == NULL) return NULL;
+  env->settings = *settings;
+
+  env->states = (simulation_state **) malloc(count * sizeof(simulation_state *));
+  env->elapsed = (double *) calloc(count, sizeof(double));
+  env->episodes = (int *) calloc(count, sizeof(int));
+  env->done = (unsigned char *) calloc(count, sizeof(unsigned char));
+  if(env->states == NULL || env->elapsed == NULL || env->episodes == NULL || env->done == NULL ||
+     !make_simulation_pool(&(env->pool), count, VECTOR_ENV_STAT_DAYS)){
+    free(env->states);
+    free(env->elapsed);
+    free(env->episodes);
+    free(env->done);
+    free(env);
+    return NULL;
+  }
+
+  for(i = 0; i < count; i++)
+    env->states[i] = take_simulation(&(env->pool));
+
+  env->settings.threads = start_thread_pool(&(env->threads), settings->threads);
+  vector_env_reset(env, NULL, NULL);
+  return env;
+}
+
+VECTOR_ENV_API void vector_env_destroy(vector_env *env){
+  if(env == NULL) return;
+
+  stop_thread_pool(&(env->threads));
+  discard_simulation_pool(&(env->pool));
+  free(env->states);
+  free(env->elapsed);
+  free(env->episodes);
+  free(env->done);
+  free(env);
+}
+
+VECTOR_ENV_API int vector_env_count(const vector_env *env){
+  return env->settings.count;
+}
+
+VECTOR_ENV_API void vector_env_reset(vector_env *env, const unsigned char *mask, float *observations){
+  env->mask = mask;
+  env->observations = observations;
+  run_pool_tasks(&(env->threads), reset_block, env, get_block_count(env));
+}
+
+VECTOR_ENV_API void vector_env_step(vector_env *env, const int *actions, float *observations, float *rewards, unsigned char *dones){
+  env->actions = actions;
+  env->observations = observations;
+  env->rewards = rewards;
+  env->dones = dones;
+  run_pool_tasks(&(env->threads), step_block, env, get_block_count(env));
+}
+
+/* Starts the episodes of a block of environments. Always returns true (1) */
+int reset_block(void *context, int task){
+  vector_env *env = (vector_env *) context;
+  int i, end = (task + 1) * VECTOR_ENV_BLOCK;
+
+  if(end > env->settings.count) end = env->settings.count;
+  for(i = task * VECTOR_ENV_BLOCK; i < end; i++){
+    if(env->mask == NULL || env->mask[i])
+      start_episode(env, i);
+    if(env->observations != NULL)
+      write_observation(env->states[i], env->observations + (size_t) i * VECTOR_ENV_OBSERVATION_SIZE);
+  }
+
+  return 1;
+}
+
+/* Steps a block of environments. Always returns true (1) */
+int step_block(void *context, int task){
+  vector_env *env = (vector_env *) context;
+  simulation_state *sim_state;
+  double step_seconds = env->settings.step_seconds, episode_seconds = env->settings.episode_seconds;
+  int i, end = (task + 1) * VECTOR_ENV_BLOCK;
+
+  if(end > env->settings.count) end = env->settings.count;
+  for(i = task * VECTOR_ENV_BLOCK; i < end; i++){
+    sim_state = env->states[i];
+
+    /* A finished episode waits for its reset */
+    if(env->done[i]){
+      env->rewards[i] = 0;
+    }else{
+      update_simulation(sim_state, step_seconds, env->actions[i] != 0);
+      env->elapsed[i] += step_seconds;
+      env->rewards[i] = (float) (-get_total_car_count(sim_state) * step_seconds);
+      env->done[i] = sim_state->days_simulated >= 1 || (episode_seconds > 0 && env->elapsed[i] >= episode_seconds);
+    }
+
+    env->dones[i] = env->done[i];
+    write_observation(sim_state, env->observations + (size_t) i * VECTOR_ENV_OBSERVATION_SIZE);
+  }
+
+  return 1;
+}
+
+/* Resets an environment with the streams of its next episode */
+void start_episode(vector_env *env, int index){
+  simulation_state *sim_state = env->states[index];
+  int replica = index + env->settings.count * env->episodes[index];
+
+  reset_simulation(sim_state, env->settings.seed, replica, env->settings.start_time);
+  sim_state->render_simulation = 0;
+  sim_state->quiet = 1; /* Nothing is printed at midnight */
+  sim_state->engine = env->settings.engine;
+
+  env->episodes[index]++;
+  env->elapsed[index] = 0;
+  env->done[index] = 0;
+}
+
+/* Writes the observation laid out in vector_env.h */
+void write_observation(const simulation_state *sim_state, float *observation){
+  int i, j;
+
+  for(i = 0; i < AMOUNT_OF_STREETS; i++)
+    for(j = 0; j < LANES_PER_STREET; j++)
+      observation[i * LANES_PER_STREET + j] = (float) sim_state->streets[i].lanes[j].amount_of_cars;
+
+  observation[8] = (float) sim_state->current_signal_state;
+  observation[9] = (float) sim_state->time_since_change;
+  observation[10] = (float) sim_state->current_time;
+}
+
+int get_block_count(const vector_env *env){
+  return (env->settings.count + VECTOR_ENV_BLOCK - 1) / VECTOR_ENV_BLOCK;
+}
@@ -0,0 +1,67 @@
+#ifndef VectorEnv /* Include guard */
+#define VectorEnv
+
+/* ------------- Batches of intersections for external trainers ------------- */
+/* The C interface of the vector_env shared library, built from vector_env.c.
+   A vector_env holds count intersections that are all stepped by one call,
+   split between threads. Every buffer is provided by the caller and holds a
+   value for every environment one after the other, the observations
+   VECTOR_ENV_OBSERVATION_SIZE floats per environment:
+
+     0 - 7  cars in each lane, street * 2 + lane (north, east, south, west and
+            the left lane before the straight and right lane)
+     8      signal state, see enum signal_state_label in Headers/Simulation_Constants.h
+     9      seconds since the signal last changed
+     10     time of day in seconds
+
+   An action of 0 keeps the signal and anything else changes it, when the
+   signal allows it. The reward of a step is minus the cars in the lanes
+   after the step times the seconds of the step. An environment is done at
+   midnight or when its episode is over and stays as it is until it is
+   reset. Nothing is allocated while stepping once the lanes have grown */
+
+#if defined(_WIN32) && defined(VECTOR_ENV_BUILD)
+  #define VECTOR_ENV_API __declspec(dllexport)
+#elif defined(_WIN32)
+  #define VECTOR_ENV_API __declspec(dllimport)
+#else
+  #define VECTOR_ENV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VECTOR_ENV_OBSERVATION_SIZE 11
+
+typedef struct vector_env vector_env;
+typedef struct vector_env_settings vector_env_settings;
+
+struct vector_env_settings{
+  int count; /* Environments */
+  int threads; /* 0 = all processors */
+  double start_time; /* Time of day every episode starts at */
+  double episode_seconds; /* 0 = until midnight */
+  double step_seconds; /* Simulated seconds of every step, whole ticks */
+  int engine; /* 0 = the car model, 1 = the meso engine */
+  unsigned long long seed;
+};
+
+/* Returns NULL if memory runs out or the settings make no sense */
+VECTOR_ENV_API vector_env *vector_env_create(const vector_env_settings *settings);
+VECTOR_ENV_API void vector_env_destroy(vector_env *env);
+VECTOR_ENV_API int vector_env_count(const vector_env *env);
+
+/* Starts a new episode in every environment whose mask is not 0, or in all
+   of them if mask is NULL, and writes the observations of every environment.
+   Every episode gets its own arrivals */
+VECTOR_ENV_API void vector_env_reset(vector_env *env, const unsigned char *mask, float *observations);
+
+/* Steps every environment that is not done with its action */
+VECTOR_ENV_API void vector_env_step(vector_env *env, const int *actions, float *observations, float *rewards, unsigned char *dones);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VectorEnv */
@@ -0,0 +1,119 @@
+#include "vector_env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Checks that a batch of environments is deterministic. The same batch is
+   stepped on a single thread and on four threads with the same actions,
+   and every observation, reward and done flag must be bit for bit the same.
+   The episodes are short, so the finished environments are reset on the way
+   and start their next episodes. Built together with the library source:
+
+     gcc -O2 vector_env_test.c vector_env.c -o vector_env_test -lm -lpthread
+
+   Returns 0 if the batches agree */
+
+#define TEST_ENVIRONMENTS 40
+#define TEST_STEPS 1500
+
+int run_batch(int threads, float *observations, float *rewards, unsigned char *dones);
+
+int main() {
+  size_t observation_count = (size_t) TEST_STEPS * TEST_ENVIRONMENTS * VECTOR_ENV_OBSERVATION_SIZE;
+  size_t step_count = (size_t) TEST_STEPS * TEST_ENVIRONMENTS;
+  float *observations[2], *rewards[2], *last;
+  unsigned char *dones[2];
+  int i, ok = 1, episodes = 0, differing = 0;
+  double total_reward = 0;
+
+  for(i = 0; i < 2; i++){
+    observations[i] = (float *) malloc(observation_count * sizeof(float));
+    rewards[i] = (float *) malloc(step_count * sizeof(float));
+    dones[i] = (unsigned char *) malloc(step_count);
+    if(observations[i] == NULL || rewards[i] == NULL || dones[i] == NULL){
+      printf("Unable to allocate the test buffers\n");
+      return 1;
+    }
+  }
+
+  if(!run_batch(1, observations[0], rewards[0], dones[0]) || !run_batch(4, observations[1], rewards[1], dones[1])){
+    printf("Unable to create the environments\n");
+    return 1;
+  }
+
+  if(memcmp(observations[0], observations[1], observation_count * sizeof(float)) != 0){
+    printf("The observations differ between the runs\n");
+    ok = 0;
+  }
+  if(memcmp(rewards[0], rewards[1], step_count * sizeof(float)) != 0){
+    printf("The rewards differ between the runs\n");
+    ok = 0;
+  }
+  if(memcmp(dones[0], dones[1], step_count) != 0){
+    printf("The done flags differ between the runs\n");
+    ok = 0;
+  }
+
+  /* A batch that does nothing, or steps every environment alike, would
+     agree with itself as well */
+  for(i = 0; i < (int) step_count; i++){
+    total_reward += rewards[0][i];
+    episodes += dones[0][i];
+  }
+  last = observations[0] + (step_count - TEST_ENVIRONMENTS) * VECTOR_ENV_OBSERVATION_SIZE;
+  for(i = 1; i < TEST_ENVIRONMENTS; i++)
+    differing += memcmp(last, last + (size_t) i * VECTOR_ENV_OBSERVATION_SIZE, VECTOR_ENV_OBSERVATION_SIZE * sizeof(float)) != 0;
+
+  if(total_reward == 0 || episodes == 0 || differing == 0){
+    printf("The batch did not simulate any traffic\n");
+    ok = 0;
+  }
+
+  printf("%d environments, %d steps, %d episodes finished, total reward %0.0f\n", TEST_ENVIRONMENTS, TEST_STEPS, episodes, total_reward);
+  printf(ok ? "The batches are identical\n" : "Test failed\n");
+
+  for(i = 0; i < 2; i++){
+    free(observations[i]);
+    free(rewards[i]);
+    free(dones[i]);
+  }
+  return ok ? 0 : 1;
+}
+
+/* Steps a batch on the given amount of threads and keeps the observations,
+   rewards and done flags of every step. An environment that is done is
+   reset before the next step. Returns false (0) if the batch cannot be made */
+int run_batch(int threads, float *observations, float *rewards, unsigned char *dones){
+  vector_env_settings settings;
+  vector_env *env;
+  int actions[TEST_ENVIRONMENTS], step, i;
+  unsigned char *done;
+
+  memset(&settings, 0, sizeof(settings));
+  settings.count = TEST_ENVIRONMENTS;
+  settings.threads = threads;
+  settings.start_time = 8 * 3600.0; /* The morning peak */
+  settings.episode_seconds = 600;
+  settings.step_seconds = 1.0;
+  settings.engine = 0;
+  settings.seed = 2024;
+
+  env = vector_env_create(&settings);
+  if(env == NULL) return 0;
+
+  for(step = 0; step < TEST_STEPS; step++){
+    done = dones + (size_t) step * TEST_ENVIRONMENTS;
+
+    /* Every environment asks for a change at its own rhythm */
+    for(i = 0; i < TEST_ENVIRONMENTS; i++)
+      actions[i] = (step + i) % (15 + i % 10) == 0;
+
+    vector_env_step(env, actions, observations + (size_t) step * TEST_ENVIRONMENTS * VECTOR_ENV_OBSERVATION_SIZE,
+                    rewards + (size_t) step * TEST_ENVIRONMENTS, done);
+    vector_env_reset(env, done, NULL);
+  }
+
+  vector_env_destroy(env);
+  return 1;
+}